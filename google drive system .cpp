@@ -1,646 +1,7119 @@
 #include <iostream>
+#include <fstream>
 #include <string>
 #include <ctime>           // for showing local time
 #include <limits>
 #include <cstdlib>          // for random generating
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <shared_mutex>
+#include <atomic>
+#include <memory>
+#include <functional>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <bcrypt.h>
+#pragma comment(lib, "bcrypt.lib")
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 using namespace std;
 
-//  function to get the current time
-string getCurrentTime() {
-    time_t now = time(0);
+// seconds since the epoch as local "dd-mm-yyyy hh:mm:ss"; 0 (never) is ""
+string formatTime(int64_t seconds) {
+    if (!seconds) return string();
+    time_t when = (time_t)seconds;
     tm localtm;
-    localtime_s(&localtm, &now);
+    localtime_s(&localtm, &when);
     char buffer[80];
     strftime(buffer, 80, "%d-%m-%Y %H:%M:%S", &localtm);    //howing the local time
     return string(buffer);
 }
 
+// inverse of formatTime(); 0 for anything it can't read
+int64_t parseTime(const string& text) {
+    tm localtm = {};
+    if (sscanf(text.c_str(), "%d-%d-%d %d:%d:%d", &localtm.tm_mday, &localtm.tm_mon, &localtm.tm_year,
+        &localtm.tm_hour, &localtm.tm_min, &localtm.tm_sec) != 6) return 0;
+    localtm.tm_mon -= 1;
+    localtm.tm_year -= 1900;
+    localtm.tm_isdst = -1;
+    time_t when = mktime(&localtm);
+    return when == (time_t)-1 ? 0 : (int64_t)when;
+}
 
-struct TreeNode {
-    string name;
-    bool isFile;
-    string content;
-    TreeNode* left;
-    TreeNode* right;
-    TreeNode* parent;
+//  function to get the current time
+string getCurrentTime() {
+    return formatTime((int64_t)time(0));
+}
 
-    TreeNode(const string& nodeName, bool file = false)
-        : name(nodeName), isFile(file), content(""), left(nullptr), right(nullptr), parent(nullptr) {
+// Seconds since the epoch for stamping records on the write path.  A ticker
+// thread refreshes the cached value TICKS_PER_SECOND times a second, so a
+// stamp is one relaxed load rather than a clock call.
+class Coarse_Clock {
+private:
+    static constexpr int TICKS_PER_SECOND = 10;
+
+    atomic<int64_t> seconds;
+    mutex lock;
+    condition_variable wake;
+    bool stopping;
+    thread ticker;
+
+    Coarse_Clock() : seconds((int64_t)time(nullptr)), stopping(false) {
+        ticker = thread([this] {
+            unique_lock<mutex> guard(lock);
+            while (!wake.wait_for(guard, chrono::milliseconds(1000 / TICKS_PER_SECOND), [this] { return stopping; })) {
+                seconds.store((int64_t)time(nullptr), memory_order_relaxed);
+            }
+        });
+    }
+
+    ~Coarse_Clock() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_one();
+        ticker.join();
+    }
+
+public:
+    static int64_t now() {
+        static Coarse_Clock clock;
+        return clock.seconds.load(memory_order_relaxed);
     }
 };
 
-// Binary Search Tree for the File System
-class FileSystemTree {
+
+// Allocation counters for the node pools: "allocations" are objects handed
+// out, "slabs" are the only calls that actually reach malloc
+struct Pool_Stats {
+    const char* name;
+    size_t objectSize;
+    size_t allocations;
+    size_t releases;
+    size_t slabs;
+};
+
+class Pool_Registry {
 private:
-    TreeNode* root;
-    TreeNode* currentDir;
+    vector<const Pool_Stats*> pools;
+    mutex lock;
 
-    //   delete the entire tree
-    void deleteTree(TreeNode* node) {
-        if (!node) return;
-        deleteTree(node->left);
-        deleteTree(node->right);
-        delete node;
+public:
+    static Pool_Registry& get() {
+        static Pool_Registry registry;
+        return registry;
     }
 
-    //  to find a node by name
-    TreeNode* findNode(TreeNode* node, const string& name) const {
-        if (!node) return nullptr;
-        if (node->name == name) return node;
+    void add(const Pool_Stats* stats) {
+        lock_guard<mutex> guard(lock);
+        pools.push_back(stats);
+    }
 
-        if (name < node->name) {
-            return findNode(node->left, name);
-        }
-        else {
-            return findNode(node->right, name);
+    size_t totalSlabs() const {
+        size_t total = 0;
+        for (const Pool_Stats* stats : pools) total += stats->slabs;
+        return total;
+    }
+
+    void display() const {
+        cout << "Node pool allocations:\n";
+        for (const Pool_Stats* stats : pools) {
+            cout << "- " << stats->name << " (" << stats->objectSize << " bytes): "
+                << stats->allocations << " allocated, " << stats->releases << " freed, "
+                << stats->allocations - stats->releases << " live, "
+                << stats->slabs << " slab mallocs\n";
         }
     }
+};
 
-    //  insert a new node
-    TreeNode* insertNode(TreeNode* root, TreeNode* newNode) {
-        if (!root) return newNode;
+// Fixed-size slab allocator with a freelist, one per node type.  Node types
+// route their operator new/delete here, so call sites keep using new/delete.
+// Only mutations allocate nodes, so a plain mutex is enough.
+template <typename T>
+class Node_Pool {
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
 
-        if (newNode->name < root->name) {
-            root->left = insertNode(root->left, newNode);
-            root->left->parent = root;
-        }
-        else {
-            root->right = insertNode(root->right, newNode);
-            root->right->parent = root;
-        }
+    static const size_t ALIGN = alignof(T) > alignof(FreeBlock) ? alignof(T) : alignof(FreeBlock);
+    static const size_t RAW_SIZE = sizeof(T) > sizeof(FreeBlock) ? sizeof(T) : sizeof(FreeBlock);
+    static const size_t BLOCK_SIZE = (RAW_SIZE + ALIGN - 1) / ALIGN * ALIGN;
+    static const size_t SLAB_BYTES = 64 * 1024;
+    static const size_t BLOCKS_PER_SLAB = SLAB_BYTES / BLOCK_SIZE ? SLAB_BYTES / BLOCK_SIZE : 1;
 
-        return root;
+    FreeBlock* freeList;
+    vector<void*> slabs;
+    Pool_Stats stats;
+    mutex lock;
+
+    explicit Node_Pool(const char* name) : freeList(nullptr) {
+        stats = Pool_Stats{ name, sizeof(T), 0, 0, 0 };
+        Pool_Registry::get().add(&stats);
     }
 
-public:
-    FileSystemTree() {
-        root = new TreeNode("Root");
-        currentDir = root;
+    void grow() {
+        char* slab = static_cast<char*>(::operator new(BLOCK_SIZE * BLOCKS_PER_SLAB));
+        slabs.push_back(slab);
+        stats.slabs++;
+        for (size_t i = BLOCKS_PER_SLAB; i-- > 0;) {
+            FreeBlock* block = reinterpret_cast<FreeBlock*>(slab + i * BLOCK_SIZE);
+            block->next = freeList;
+            freeList = block;
+        }
     }
 
-    ~FileSystemTree() {
-        deleteTree(root);
+public:
+    static Node_Pool& get(const char* name) {
+        static Node_Pool pool(name);
+        return pool;
     }
 
-    TreeNode* getCurrentDir() const {
-        return currentDir;
+    ~Node_Pool() {
+        for (void* slab : slabs) ::operator delete(slab);
     }
 
-    string getCurrentDirectory() const {
-        return currentDir->name;
+    void* allocate(size_t size) {
+        if (size != sizeof(T)) return ::operator new(size);     // a derived type
+        lock_guard<mutex> guard(lock);
+        if (!freeList) grow();
+        FreeBlock* block = freeList;
+        freeList = block->next;
+        stats.allocations++;
+        return block;
     }
 
-    bool rename_Directory(const string& oldName, const string& newName) {
-        TreeNode* node = findNode(currentDir, oldName);
-        if (node && !node->isFile) {
-            node->name = newName;
-            return true;
+    void release(void* block, size_t size) {
+        if (!block) return;
+        if (size != sizeof(T)) {
+            ::operator delete(block);
+            return;
         }
-        return false;
+        FreeBlock* freed = static_cast<FreeBlock*>(block);
+        lock_guard<mutex> guard(lock);
+        freed->next = freeList;
+        freeList = freed;
+        stats.releases++;
     }
+};
 
-    bool changeDirectory(const string& dirName) {
-        if (dirName == "..") { // Move to parent directory
-            if (currentDir->parent) {
-                currentDir = currentDir->parent;
-                return true;
-            }
-            cout << "Already at the root directory.\n";
-            return false;
-        }
+// Reader-writer lock for read-mostly data.  Each reader thread counts itself
+// in its own cache line, so concurrent readers never write a shared line and
+// read throughput scales with cores; a writer raises the flag and waits for
+// every slot to drain.  Shared acquisition is not reentrant.
+class Distributed_Rw_Lock {
+private:
+    static constexpr size_t READER_SLOTS = 32;
 
-        TreeNode* node = findNode(currentDir, dirName);
-        if (node && !node->isFile) {
-            currentDir = node;
-            return true;
-        }
+    struct alignas(64) Reader_Slot {
+        atomic<uint32_t> readers{ 0 };
+    };
 
-        cout << "Directory not found: " << dirName << endl;
-        return false;
-    }
+    Reader_Slot slots[READER_SLOTS];
+    alignas(64) atomic<bool> writing{ false };
+    mutex writers;
 
-    bool makeDirectory(const string& dirName) {
-        if (dirName.empty()) {
-            cout << "Directory name cannot be empty.\n";
-            return false;
-        }
+    static size_t slotOfThread() {
+        static atomic<size_t> nextSlot{ 0 };
+        thread_local size_t slot = nextSlot.fetch_add(1) % READER_SLOTS;
+        return slot;
+    }
 
-        if (findNode(currentDir, dirName)) {
-            cout << "A directory with the name '" << dirName << "' already exists.\n";
-            return false;
+public:
+    void lock_shared() {
+        atomic<uint32_t>& readers = slots[slotOfThread()].readers;
+        while (true) {
+            readers.fetch_add(1);
+            if (!writing.load()) return;
+            readers.fetch_sub(1);       // a writer is in: step aside until it's done
+            while (writing.load(memory_order_relaxed)) this_thread::yield();
         }
+    }
 
-        TreeNode* newDir = new TreeNode(dirName, false);
-        currentDir = insertNode(currentDir, newDir);
-        cout << "Directory '" << dirName << "' created successfully.\n";
-        return true;
+    void unlock_shared() {
+        slots[slotOfThread()].readers.fetch_sub(1, memory_order_release);
     }
 
-    TreeNode* createFile(const string& fileName, const string& content = "") {
-        if (findNode(currentDir, fileName)) {
-            cout << "A file with the name '" << fileName << "' already exists in this directory.\n";
-            return nullptr;
+    void lock() {
+        writers.lock();
+        writing.store(true);
+        for (Reader_Slot& slot : slots) {
+            while (slot.readers.load()) this_thread::yield();
         }
+    }
 
-        TreeNode* newFile = new TreeNode(fileName, true);
-        newFile->content = content;
-        currentDir = insertNode(currentDir, newFile);
-        return newFile;
+    void unlock() {
+        writing.store(false, memory_order_release);
+        writers.unlock();
     }
+};
 
-    void listContents(TreeNode* node = nullptr) const {
-        if (!node) node = currentDir;
+// Fixed set of worker threads draining a task queue
+class Worker_Pool {
+private:
+    vector<thread> workers;
+    vector<function<void()>> queue;
+    size_t next;
+    size_t running;
+    bool stopping;
+    mutex lock;
+    condition_variable wakeWorkers;
+    condition_variable wakeWaiters;
+
+    void work() {
+        unique_lock<mutex> guard(lock);
+        while (true) {
+            wakeWorkers.wait(guard, [&] { return stopping || next < queue.size(); });
+            if (next == queue.size()) return;
+            function<void()> task = std::move(queue[next++]);
+            running++;
+            guard.unlock();
+            task();
+            guard.lock();
+            running--;
+            if (next == queue.size() && !running) {
+                queue.clear();
+                next = 0;
+                wakeWaiters.notify_all();
+            }
+        }
+    }
 
-        if (node->left) listContents(node->left);
-        cout << (node->isFile ? "[File] " : "[Folder] ") << node->name << endl;
-        if (node->right) listContents(node->right);
+public:
+    explicit Worker_Pool(size_t threads = thread::hardware_concurrency())
+        : next(0), running(0), stopping(false) {
+        if (!threads) threads = 1;
+        for (size_t i = 0; i < threads; i++) workers.emplace_back(&Worker_Pool::work, this);
     }
 
-    TreeNode* findFile(const string& fileName) const {
-        return findNode(currentDir, fileName);
+    ~Worker_Pool() {
+        wait();
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wakeWorkers.notify_all();
+        for (thread& worker : workers) worker.join();
     }
 
-    bool removeFile(const string& fileName) {
-        TreeNode* fileToRemove = findFile(fileName);
-        if (!fileToRemove || !fileToRemove->isFile)
-            return false;
+    Worker_Pool(const Worker_Pool&) = delete;
+    Worker_Pool& operator=(const Worker_Pool&) = delete;
 
-        TreeNode* parent = fileToRemove->parent;
-        if (!parent)
-            return false;
+    size_t size() const { return workers.size(); }
 
-        if (parent->left == fileToRemove) {
-            parent->left = nullptr;
-        }
-        else if (parent->right == fileToRemove) {
-            parent->right = nullptr;
-        }
-        else {
-            return false;
+    void submit(function<void()> task) {
+        {
+            lock_guard<mutex> guard(lock);
+            queue.push_back(std::move(task));
         }
+        wakeWorkers.notify_one();
+    }
 
-        delete fileToRemove;
-        return true;
+    // blocks until every submitted task has finished
+    void wait() {
+        unique_lock<mutex> guard(lock);
+        wakeWaiters.wait(guard, [&] { return next == queue.size() && !running; });
     }
 };
 
-// Hash Table for File Metadata
-class File_Meta_data {
+// Self-balancing (AVL) index, walked iteratively so sorted input can't
+// degrade it into a chain or recurse deep enough to overflow the stack.
+// KeyOf::get(value) returns the key a value is ordered by.
+template <typename Value, typename KeyOf>
+class Balanced_Index {
 public:
-    string name;
-    string type;
-    size_t size;
-    string owner;
-    string creationDate;
-    string lastModified;
-    TreeNode* fileNode;
-};
+    typedef typename KeyOf::Key Key;
 
-class HashTable {
 private:
-    static const int TABLE_SIZE = 100;
+    struct AvlNode {
+        Value value;
+        AvlNode* left;
+        AvlNode* right;
+        int height;
+
+        static void* operator new(size_t size) { return Node_Pool<AvlNode>::get("AvlNode").allocate(size); }
+        static void operator delete(void* block, size_t size) { Node_Pool<AvlNode>::get("AvlNode").release(block, size); }
+    };
 
-    struct HashEntry {
-        string key;
-        File_Meta_data* value;
-        HashEntry* next;
+    static const int MAX_DEPTH = 96;    // AVL height for 2^64 nodes stays below this
 
-        HashEntry(string k, File_Meta_data* v) : key(k), value(v), next(nullptr) {}
-    };
+    AvlNode* root;
+    size_t count;
+
+    static int heightOf(const AvlNode* node) { return node ? node->height : 0; }
+
+    static void updateHeight(AvlNode* node) {
+        int lh = heightOf(node->left), rh = heightOf(node->right);
+        node->height = (lh > rh ? lh : rh) + 1;
+    }
+
+    static AvlNode* rotateRight(AvlNode* node) {
+        AvlNode* pivot = node->left;
+        node->left = pivot->right;
+        pivot->right = node;
+        updateHeight(node);
+        updateHeight(pivot);
+        return pivot;
+    }
+
+    static AvlNode* rotateLeft(AvlNode* node) {
+        AvlNode* pivot = node->right;
+        node->right = pivot->left;
+        pivot->left = node;
+        updateHeight(node);
+        updateHeight(pivot);
+        return pivot;
+    }
 
-    HashEntry** table;
+    static AvlNode* rebalance(AvlNode* node) {
+        updateHeight(node);
+        int balance = heightOf(node->left) - heightOf(node->right);
+        if (balance > 1) {
+            if (heightOf(node->left->left) < heightOf(node->left->right))
+                node->left = rotateLeft(node->left);
+            return rotateRight(node);
+        }
+        if (balance < -1) {
+            if (heightOf(node->right->right) < heightOf(node->right->left))
+                node->right = rotateRight(node->right);
+            return rotateLeft(node);
+        }
+        return node;
+    }
 
-    int hashFunction(const string& key) {
-        int hash = 0;
-        for (size_t i = 0; i < key.length(); i++) {
-            hash = (hash * 31 + key[i]) % TABLE_SIZE;
+    // walk back up a recorded path fixing heights and rotating
+    static void rebalancePath(AvlNode** path[], int depth) {
+        while (depth-- > 0) {
+            *path[depth] = rebalance(*path[depth]);
         }
-        return hash;
     }
 
 public:
-    HashTable() {
-        table = new HashEntry * [TABLE_SIZE]();
+    Balanced_Index() : root(nullptr), count(0) {}
+
+    ~Balanced_Index() { clear(); }
+
+    Balanced_Index(const Balanced_Index&) = delete;
+    Balanced_Index& operator=(const Balanced_Index&) = delete;
+
+    size_t size() const { return count; }
+
+    void clear() {
+        AvlNode* stack[MAX_DEPTH];
+        int top = 0;
+        if (root) stack[top++] = root;
+        while (top > 0) {
+            AvlNode* node = stack[--top];
+            if (node->left) stack[top++] = node->left;
+            if (node->right) stack[top++] = node->right;
+            delete node;
+        }
+        root = nullptr;
+        count = 0;
     }
 
-    ~HashTable() {
-        for (int i = 0; i < TABLE_SIZE; i++) {
-            HashEntry* entry = table[i];
-            while (entry) {
-                HashEntry* prev = entry;
-                entry = entry->next;
-                delete prev->value;
-                delete prev;
+    Value* find(const Key& key) const {
+        AvlNode* node = root;
+        while (node) {
+            const Key& nodeKey = KeyOf::get(node->value);
+            if (key < nodeKey) node = node->left;
+            else if (nodeKey < key) node = node->right;
+            else return &node->value;
+        }
+        return nullptr;
+    }
+
+    // smallest value whose key is not less than key
+    Value* lowerBound(const Key& key) const {
+        AvlNode* node = root;
+        AvlNode* best = nullptr;
+        while (node) {
+            if (KeyOf::get(node->value) < key) node = node->right;
+            else {
+                best = node;
+                node = node->left;
             }
         }
-        delete[] table;
+        return best ? &best->value : nullptr;
+    }
+
+    Value* first() const {
+        AvlNode* node = root;
+        while (node && node->left) node = node->left;
+        return node ? &node->value : nullptr;
     }
 
-    void insert(const string& key, File_Meta_data* value) {
-        int hash = hashFunction(key);
-        HashEntry* prev = nullptr;
-        HashEntry* entry = table[hash];
+    Value* last() const {
+        AvlNode* node = root;
+        while (node && node->right) node = node->right;
+        return node ? &node->value : nullptr;
+    }
 
-        while (entry && entry->key != key) {
-            prev = entry;
-            entry = entry->next;
+    // false if a value with the same key is already indexed
+    bool insert(const Value& value) {
+        const Key& key = KeyOf::get(value);
+        AvlNode** path[MAX_DEPTH];
+        int depth = 0;
+        AvlNode** link = &root;
+        while (*link) {
+            path[depth++] = link;
+            const Key& nodeKey = KeyOf::get((*link)->value);
+            if (key < nodeKey) link = &(*link)->left;
+            else if (nodeKey < key) link = &(*link)->right;
+            else return false;
         }
+        *link = new AvlNode{ value, nullptr, nullptr, 1 };
+        count++;
+        rebalancePath(path, depth);
+        return true;
+    }
 
-        if (!entry) {
-            entry = new HashEntry(key, value);
-            if (!prev) {
-                table[hash] = entry;
-            }
-            else {
-                prev->next = entry;
+    bool erase(const Key& key) {
+        AvlNode** path[MAX_DEPTH];
+        int depth = 0;
+        AvlNode** link = &root;
+        while (*link) {
+            const Key& nodeKey = KeyOf::get((*link)->value);
+            if (key < nodeKey) { path[depth++] = link; link = &(*link)->left; }
+            else if (nodeKey < key) { path[depth++] = link; link = &(*link)->right; }
+            else break;
+        }
+        AvlNode* target = *link;
+        if (!target) return false;
+
+        if (target->left && target->right) {
+            // pull the in-order successor's value up and unlink the successor
+            path[depth++] = link;
+            AvlNode** succLink = &target->right;
+            while ((*succLink)->left) {
+                path[depth++] = succLink;
+                succLink = &(*succLink)->left;
             }
+            AvlNode* successor = *succLink;
+            target->value = successor->value;
+            *succLink = successor->right;
+            delete successor;
         }
         else {
-            delete entry->value;
-            entry->value = value;
+            *link = target->left ? target->left : target->right;
+            delete target;
         }
+        count--;
+        rebalancePath(path, depth);
+        return true;
     }
 
-    File_Meta_data* search(const string& key) {
-        int hash = hashFunction(key);
-        HashEntry* entry = table[hash];
-        while (entry) {
-            if (entry->key == key) {
-                return entry->value;
+    // in-order walk without recursion
+    template <typename Visit>
+    void forEach(Visit visit) const {
+        AvlNode* stack[MAX_DEPTH];
+        int top = 0;
+        AvlNode* node = root;
+        while (node || top > 0) {
+            while (node) {
+                stack[top++] = node;
+                node = node->left;
             }
-            entry = entry->next;
+            node = stack[--top];
+            visit(node->value);
+            node = node->right;
         }
-        return nullptr;
     }
+};
 
-    void remove(const string& key) {
-        int hash = hashFunction(key);
-        HashEntry* prev = nullptr;
-        HashEntry* entry = table[hash];
-
-        while (entry && entry->key != key) {
-            prev = entry;
-            entry = entry->next;
-        }
-
-        if (!entry) return;
+// 64-bit hashing for the open-addressing tables: strings are folded eight
+// bytes at a time, then everything goes through the splitmix64 finalizer
+struct Hash64 {
+    static uint64_t mix(uint64_t x) {
+        x ^= x >> 30;
+        x *= 0xBF58476D1CE4E5B9ULL;
+        x ^= x >> 27;
+        x *= 0x94D049BB133111EBULL;
+        x ^= x >> 31;
+        return x;
+    }
 
-        if (!prev) {
-            table[hash] = entry->next;
-        }
-        else {
-            prev->next = entry->next;
+    static uint64_t bytes(const char* data, size_t length, uint64_t seed = 0x9E3779B97F4A7C15ULL) {
+        uint64_t h = seed ^ (length * 0xC2B2AE3D27D4EB4FULL);
+        size_t i = 0;
+        for (; i + 8 <= length; i += 8) {
+            uint64_t word;
+            memcpy(&word, data + i, 8);
+            h = (h ^ mix(word)) * 0x9E3779B97F4A7C15ULL;
+            h = (h << 29) | (h >> 35);
         }
-
-        delete entry->value;
-        delete entry;
+        uint64_t tail = 0;
+        memcpy(&tail, data + i, length - i);
+        return mix(h ^ mix(tail ^ 0x165667B19E3779F9ULL));
     }
+
+    uint64_t operator()(const string& key) const { return bytes(key.data(), key.size()); }
+    uint64_t operator()(uint64_t key) const { return mix(key + 0x9E3779B97F4A7C15ULL); }
 };
 
-// Recycle Bin (Stack)
-class Recycle_Bin {
+// Robin Hood open-addressing hash map.  Grows at 7/8 load into a table twice
+// the size, but moves old entries over a few slots per mutation instead of
+// all at once, so no single insert pays for a full rehash.
+template <typename Key, typename Value, typename Hasher = Hash64>
+class Open_Hash_Map {
 private:
-    struct BinNode {
-        TreeNode* file;
-        string deletionTime;
-        BinNode* next;
+    struct Slot {
+        uint64_t hash;
+        uint32_t probe;     // 0 = empty, otherwise distance from home slot + 1
+        Key key;
+        Value value;
     };
 
-    BinNode* top;
-public:
-    Recycle_Bin() : top(nullptr) {}
+    struct Table {
+        Slot* slots = nullptr;
+        size_t capacity = 0;    // always a power of two
+        size_t count = 0;
+    };
 
-    ~Recycle_Bin() {
-        while (top) {
-            BinNode* temp = top;
-            top = top->next;
-            delete temp;
-        }
+    static const size_t INITIAL_CAPACITY = 16;
+    static const size_t MIGRATE_STEP = 8;   // old slots drained per mutation
+
+    Table active;
+    Table draining;         // previous table while a resize is in progress
+    size_t drainCursor;
+    Hasher hasher;
+
+    static void allocate(Table& table, size_t capacity) {
+        table.slots = new Slot[capacity]();
+        table.capacity = capacity;
+        table.count = 0;
     }
 
-    void push(TreeNode* file) {
-        BinNode* newNode = new BinNode{ file, getCurrentTime(), top };
-        top = newNode;
+    static void release(Table& table) {
+        delete[] table.slots;
+        table = Table();
     }
 
-    TreeNode* pop() {
-        if (!top) return nullptr;
-        BinNode* temp = top;
-        TreeNode* file = temp->file;
-        top = top->next;
-        delete temp;
-        return file;
+    static Slot* lookup(const Table& table, uint64_t hash, const Key& key) {
+        if (!table.count) return nullptr;
+        size_t mask = table.capacity - 1;
+        size_t index = hash & mask;
+        for (uint32_t distance = 1;; distance++) {
+            Slot& slot = table.slots[index];
+            if (slot.probe < distance) return nullptr;     // empty, or we'd have been placed here
+            if (slot.hash == hash && slot.key == key) return &slot;
+            index = (index + 1) & mask;
+        }
     }
 
-    bool isEmpty() const { return top == nullptr; }
+    // caller guarantees the key is absent and there is room
+    static Slot* place(Table& table, uint64_t hash, Key key, Value value) {
+        size_t mask = table.capacity - 1;
+        size_t index = hash & mask;
+        uint32_t probe = 1;
+        Slot* landed = nullptr;
+        while (true) {
+            Slot& slot = table.slots[index];
+            if (!slot.probe) {
+                slot.hash = hash;
+                slot.probe = probe;
+                slot.key = std::move(key);
+                slot.value = std::move(value);
+                table.count++;
+                return landed ? landed : &slot;
+            }
+            if (slot.probe < probe) {
+                // rob the richer entry and keep walking with it
+                swap(slot.hash, hash);
+                swap(slot.probe, probe);
+                swap(slot.key, key);
+                swap(slot.value, value);
+                if (!landed) landed = &slot;
+            }
+            index = (index + 1) & mask;
+            probe++;
+        }
+    }
 
-    void display() const {
-        if (isEmpty()) {
-            cout << "Recycle Bin is empty.\n";
-            return;
+    // backward-shift delete keeps every remaining entry reachable
+    static void removeAt(Table& table, Slot* slot) {
+        size_t mask = table.capacity - 1;
+        size_t index = slot - table.slots;
+        while (true) {
+            size_t next = (index + 1) & mask;
+            Slot& following = table.slots[next];
+            if (following.probe <= 1) break;
+            Slot& current = table.slots[index];
+            current.hash = following.hash;
+            current.probe = following.probe - 1;
+            current.key = std::move(following.key);
+            current.value = std::move(following.value);
+            index = next;
         }
-        cout << "Recycle Bin contents:\n";
-        BinNode* current = top;
-        while (current) {
-            cout << "- " << current->file->name << " (Deleted at: " << current->deletionTime << ")\n";
-            current = current->next;
+        Slot& last = table.slots[index];
+        last.probe = 0;
+        last.key = Key();
+        last.value = Value();
+        table.count--;
+    }
+
+    void migrate(size_t budget) {
+        while (draining.slots && budget > 0) {
+            if (!draining.count || drainCursor >= draining.capacity) {
+                release(draining);
+                return;
+            }
+            Slot& slot = draining.slots[drainCursor];
+            if (slot.probe) {
+                place(active, slot.hash, std::move(slot.key), std::move(slot.value));
+                removeAt(draining, &slot);      // may pull the next entry into this slot
+            }
+            else {
+                drainCursor++;
+            }
+            budget--;
         }
     }
-};
 
-// class to tell which  Files are recently open or closed , and these r stored in form of Queue
-class Recent_Files_Queue {
-private:
-    struct QueueNode {
-        TreeNode* file;
-        QueueNode* next;
-    };
+    void growIfNeeded() {
+        if (!active.slots) {
+            allocate(active, INITIAL_CAPACITY);
+            return;
+        }
+        if ((active.count + 1) * 8 <= active.capacity * 7) return;
 
-    QueueNode* front;
-    QueueNode* rear;
-    int count;
+        migrate((size_t)-1);        // an unfinished resize is folded in first
+        draining = active;
+        drainCursor = 0;
+        allocate(active, draining.capacity * 2);
+    }
 
 public:
-    Recent_Files_Queue() : front(nullptr), rear(nullptr), count(0) {}
+    Open_Hash_Map() : drainCursor(0) {}
 
-    ~Recent_Files_Queue() {
-        // Destructor to clean up all nodes
-        while (front) {
-            QueueNode* temp = front;
-            front = front->next;
-            delete temp;
-        }
+    ~Open_Hash_Map() {
+        release(active);
+        release(draining);
     }
 
-    void enqueue(TreeNode* file) {
-        // Create a new node for the recently accessed file
-        QueueNode* newNode = new QueueNode{ file, nullptr };
+    Open_Hash_Map(const Open_Hash_Map&) = delete;
+    Open_Hash_Map& operator=(const Open_Hash_Map&) = delete;
 
-        // If the queue is empty, new node becomes both front and rear
-        if (!rear) {
-            front = rear = newNode;
-        }
-        else {
-            // Otherwise, add to the rear and update rear pointer
-            rear->next = newNode;
-            rear = newNode;
-        }
+    size_t size() const { return active.count + draining.count; }
+    bool empty() const { return size() == 0; }
+    size_t capacity() const { return active.capacity; }
 
-        count++; // Increment the count of nodes in the queue
+    // makes room for count entries up front, so filling to count never resizes
+    void reserve(size_t count) {
+        size_t wanted = INITIAL_CAPACITY;
+        while (wanted * 7 < count * 8) wanted *= 2;
+        if (wanted <= active.capacity) return;
+
+        migrate((size_t)-1);
+        draining = active;
+        drainCursor = 0;
+        allocate(active, wanted);
+        migrate((size_t)-1);
     }
 
-    void dequeue() {
-       
-        if (!front) return;
-        QueueNode* temp = front;
-        front = front->next;
-        if (!front) rear = nullptr;
-        delete temp;
-        count--;
+    Value* find(const Key& key) const {
+        uint64_t hash = hasher(key);
+        Slot* slot = lookup(active, hash, key);
+        if (!slot) slot = lookup(draining, hash, key);
+        return slot ? &slot->value : nullptr;
     }
-//function to show fle details
-    void display() const {
-        if (!front) {
-            cout << "No recent files\n";
-            return;
+
+    // inserts when absent; returns the stored value and whether it was new
+    pair<Value*, bool> emplace(const Key& key, const Value& value) {
+        migrate(MIGRATE_STEP);
+        uint64_t hash = hasher(key);
+        Slot* slot = lookup(active, hash, key);
+        if (!slot) slot = lookup(draining, hash, key);
+        if (slot) return make_pair(&slot->value, false);
+
+        growIfNeeded();
+        return make_pair(&place(active, hash, key, value)->value, true);
+    }
+
+    // removes the key, handing its value back through removed if asked
+    bool erase(const Key& key, Value* removed = nullptr) {
+        migrate(MIGRATE_STEP);
+        uint64_t hash = hasher(key);
+        Table* table = &active;
+        Slot* slot = lookup(active, hash, key);
+        if (!slot) {
+            table = &draining;
+            slot = lookup(draining, hash, key);
         }
+        if (!slot) return false;
+        if (removed) *removed = std::move(slot->value);
+        removeAt(*table, slot);
+        return true;
+    }
 
-        cout << "Recently Accessed Files:\n";
-        QueueNode* current = front;
-        int index = 1;
-        while (current) {
-            if (current->file) {
-                cout << index++ << ". " << current->file->name << endl;
+    void clear() {
+        release(active);
+        release(draining);
+        drainCursor = 0;
+    }
+
+    template <typename Visit>
+    void forEach(Visit visit) const {
+        const Table* tables[2] = { &draining, &active };
+        for (const Table* table : tables) {
+            for (size_t i = 0; i < table->capacity; i++) {
+                if (table->slots[i].probe) visit(table->slots[i].key, table->slots[i].value);
             }
-            current = current->next;
         }
     }
 };
-// User Graph (Linked List of Users)
-class User_Graph {
-public:
-    struct UserNode {
-        string userId;
-        string password;
-        string securityQuestion;
-        string securityAnswer;
-        string lastLogin;
-        string lastLogout;
-
-        struct SharedFile {
-            string filename;
-            string permission; // "view", "edit"
-            UserNode* sharedWith;
-            SharedFile* next;
-        };
 
-        SharedFile* sharedFiles;
-        UserNode* next;
+// Open_Hash_Map split into shards, each behind its own reader-writer lock,
+// for maps shared between sessions.  Values are copied out, never handed
+// back by pointer, since another thread may move them at any time.
+template <typename Key, typename Value, typename Hasher = Hash64>
+class Sharded_Map {
+private:
+    static constexpr size_t SHARD_BITS = 5;
+    static constexpr size_t SHARDS = (size_t)1 << SHARD_BITS;
+
+    struct Shard {
+        mutable Distributed_Rw_Lock lock;
+        Open_Hash_Map<Key, Value, Hasher> map;
     };
 
-    UserNode* users;
+    unique_ptr<Shard[]> shards;
+    Hasher hasher;
 
-    User_Graph() : users(nullptr) {}
+    // top bits pick the shard; the map inside indexes with the low ones
+    Shard& shardOf(const Key& key) const { return shards[hasher(key) >> (64 - SHARD_BITS)]; }
 
-    ~User_Graph() {
-        UserNode* current = users;
-        while (current) {
-            UserNode* nextUser = current->next;
+public:
+    Sharded_Map() : shards(new Shard[SHARDS]) {}
+
+    bool find(const Key& key, Value& value) const {
+        Shard& shard = shardOf(key);
+        shared_lock<Distributed_Rw_Lock> guard(shard.lock);
+        const Value* found = shard.map.find(key);
+        if (found) value = *found;
+        return found != nullptr;
+    }
 
-            // Delete shared files list
-            UserNode::SharedFile* sf = current->sharedFiles;
-            while (sf) {
-                UserNode::SharedFile* nextSF = sf->next;
-                delete sf;
-                sf = nextSF;
-            }
+    bool contains(const Key& key) const {
+        Shard& shard = shardOf(key);
+        shared_lock<Distributed_Rw_Lock> guard(shard.lock);
+        return shard.map.find(key) != nullptr;
+    }
 
-            delete current;
-            current = nextUser;
-        }
+    // inserts when absent; otherwise hands the current value back through existing
+    bool emplace(const Key& key, const Value& value, Value* existing = nullptr) {
+        Shard& shard = shardOf(key);
+        lock_guard<Distributed_Rw_Lock> guard(shard.lock);
+        pair<Value*, bool> slot = shard.map.emplace(key, value);
+        if (!slot.second && existing) *existing = *slot.first;
+        return slot.second;
     }
 
-    UserNode* findUser(const string& userId) const {
-        UserNode* current = users;
-        while (current) {
-            if (current->userId == userId) {
-                return current;
-            }
-            current = current->next;
+    // stores value under key, handing any value it replaced back through replaced
+    bool assign(const Key& key, const Value& value, Value* replaced = nullptr) {
+        Shard& shard = shardOf(key);
+        lock_guard<Distributed_Rw_Lock> guard(shard.lock);
+        pair<Value*, bool> slot = shard.map.emplace(key, value);
+        if (slot.second) return false;
+        if (replaced) *replaced = *slot.first;
+        *slot.first = value;
+        return true;
+    }
+
+    bool erase(const Key& key, Value* removed = nullptr) {
+        Shard& shard = shardOf(key);
+        lock_guard<Distributed_Rw_Lock> guard(shard.lock);
+        return shard.map.erase(key, removed);
+    }
+
+    size_t size() const {
+        size_t total = 0;
+        for (size_t i = 0; i < SHARDS; i++) {
+            shared_lock<Distributed_Rw_Lock> guard(shards[i].lock);
+            total += shards[i].map.size();
         }
-        return nullptr;
+        return total;
     }
 
-    bool addUser(const string& userId, const string& password, const string& question, const string& answer) {
-        if (findUser(userId)) {
-            return false;
+    size_t capacity() const {
+        size_t total = 0;
+        for (size_t i = 0; i < SHARDS; i++) {
+            shared_lock<Distributed_Rw_Lock> guard(shards[i].lock);
+            total += shards[i].map.capacity();
         }
+        return total;
+    }
 
-        UserNode* newUser = new UserNode{ userId, password, question, answer, "", "", nullptr, users };
-        users = newUser;
-        return true;
+    void reserve(size_t count) {
+        for (size_t i = 0; i < SHARDS; i++) {
+            lock_guard<Distributed_Rw_Lock> guard(shards[i].lock);
+            shards[i].map.reserve(count / SHARDS + 1);
+        }
     }
 
-    UserNode* authenticate(const string& userId, const string& password) {
-        UserNode* user = findUser(userId);
-        if (user && user->password == password) {
-            user->lastLogin = getCurrentTime();
-            return user;
+    void clear() {
+        for (size_t i = 0; i < SHARDS; i++) {
+            lock_guard<Distributed_Rw_Lock> guard(shards[i].lock);
+            shards[i].map.clear();
         }
-        return nullptr;
     }
 
-    bool recoverPassword(const string& userId) {
-        UserNode* user = findUser(userId);
-        if (!user) {
-            cout << "User ID not found.\n";
-            return false;
+    // visits shard by shard; visit must not touch this map
+    template <typename Visit>
+    void forEach(Visit visit) const {
+        for (size_t i = 0; i < SHARDS; i++) {
+            shared_lock<Distributed_Rw_Lock> guard(shards[i].lock);
+            shards[i].map.forEach(visit);
         }
+    }
+};
 
-        cout << "Security Question: " << user->securityQuestion << endl;
-        cout << "Enter your answer: ";
-        string answer;
-        cin.ignore();
-        getline(cin, answer);
+// lowest set bit of a nonzero word
+inline int lowestBit(uint64_t word) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return (int)index;
+#else
+    return __builtin_ctzll(word);
+#endif
+}
+
+// LZ77-family block codec in the LZ4 mould: greedy hash-chained matching on
+// 4-byte sequences, byte-aligned sequences of (literals, 16-bit offset, match
+// length).  Matches are extended eight bytes per step and runs of one byte
+// are caught before the hash lookup.  Frames are
+//   "GDZ1" { [u32 raw size][u32 stored size | RAW_BLOCK][u32 checksum][bytes] }* [u32 0]
+// and the codec keeps its hash table between calls, so a long-lived codec
+// does no allocation per block.
+class Block_Codec {
+private:
+    static constexpr int HASH_BITS = 14;
+    static constexpr size_t MIN_MATCH = 4;
+    static constexpr size_t MAX_OFFSET = 65535;
+    static constexpr uint32_t NO_POSITION = 0xFFFFFFFFu;
+
+    // Positions in the match table are counted from base, which every block
+    // moves past its own end, so entries left by earlier blocks fall below it
+    // and read as empty: the table is only cleared when base would wrap.
+    vector<uint32_t> table;
+    uint32_t base = 0;
+
+    static uint32_t read32(const unsigned char* p) { uint32_t v; memcpy(&v, p, 4); return v; }
+    static uint64_t read64(const unsigned char* p) { uint64_t v; memcpy(&v, p, 8); return v; }
+    static uint32_t hashOf(uint32_t sequence) { return (sequence * 2654435761u) >> (32 - HASH_BITS); }
+
+    static void put32(string& out, uint32_t value) { out.append(reinterpret_cast<const char*>(&value), 4); }
+
+    static size_t matchLength(const unsigned char* a, const unsigned char* b, const unsigned char* end) {
+        const unsigned char* start = a;
+        while (a + 8 <= end) {
+            uint64_t diff = read64(a) ^ read64(b);
+            if (diff) return (a - start) + lowestBit(diff) / 8;
+            a += 8;
+            b += 8;
+        }
+        while (a < end && *a == *b) {
+            a++;
+            b++;
+        }
+        return a - start;
+    }
+
+    static void putLength(string& out, size_t extra) {
+        while (extra >= 255) {
+            out += (char)255;
+            extra -= 255;
+        }
+        out += (char)extra;
+    }
+
+    static void emit(string& out, const unsigned char* literals, size_t literalLength, size_t offset, size_t match) {
+        size_t matchCode = match ? match - MIN_MATCH : 0;
+        out += (char)(((literalLength < 15 ? literalLength : 15) << 4) | (matchCode < 15 ? matchCode : 15));
+        if (literalLength >= 15) putLength(out, literalLength - 15);
+        out.append(reinterpret_cast<const char*>(literals), literalLength);
+        if (!match) return;     // the trailing literals end the block
+        out += (char)(offset & 0xFF);
+        out += (char)(offset >> 8);
+        if (matchCode >= 15) putLength(out, matchCode - 15);
+    }
+
+    void compressBlock(const unsigned char* src, size_t length, string& out) {
+        if (table.empty() || base > 0xFFFFFFFFu - length - 1) {
+            table.assign((size_t)1 << HASH_BITS, 0);
+            base = 1;
+        }
+        size_t anchor = 0, i = 0;
+        while (i + MIN_MATCH <= length) {
+            uint32_t sequence = read32(src + i);
+            size_t candidate = NO_POSITION;
+
+            if (i > 0 && sequence == src[i] * 0x01010101u && src[i - 1] == src[i]) {
+                candidate = i - 1;      // a run: match the previous byte
+            }
+            else {
+                uint32_t& slot = table[hashOf(sequence)];
+                if (slot >= base) {
+                    size_t earlier = slot - base;
+                    if (i - earlier <= MAX_OFFSET && read32(src + earlier) == sequence) candidate = earlier;
+                }
+                slot = base + (uint32_t)i;
+            }
+            if (candidate == NO_POSITION) {
+                i += 1 + ((i - anchor) >> 6);   // skip faster through incompressible stretches
+                continue;
+            }
+
+            size_t match = MIN_MATCH + matchLength(src + i + MIN_MATCH, src + candidate + MIN_MATCH, src + length);
+            while (i > anchor && candidate > 0 && src[i - 1] == src[candidate - 1]) {
+                i--;
+                candidate--;
+                match++;
+            }
+            emit(out, src + anchor, i - anchor, i - candidate, match);
+            i += match;
+            anchor = i;
+            if (i >= 2 && i - 2 + MIN_MATCH <= length) table[hashOf(read32(src + i - 2))] = base + (uint32_t)(i - 2);
+        }
+        emit(out, src + anchor, length - anchor, 0, 0);
+        base += (uint32_t)length + 1;
+    }
+
+    static bool readLength(const unsigned char*& ip, const unsigned char* end, size_t& length) {
+        unsigned char byte;
+        do {
+            if (ip >= end) return false;
+            byte = *ip++;
+            length += byte;
+        } while (byte == 255);
+        return true;
+    }
+
+    static bool decompressBlock(const unsigned char* ip, size_t length, string& out, size_t rawSize) {
+        const unsigned char* end = ip + length;
+        size_t blockStart = out.size();
+        size_t limit = blockStart + rawSize;
+        out.resize(limit);
+        char* base = &out[0];
+        size_t op = blockStart;
+
+        while (ip < end) {
+            unsigned token = *ip++;
+            size_t literals = token >> 4;
+            if (literals == 15 && !readLength(ip, end, literals)) return false;
+            if (literals > (size_t)(end - ip) || literals > limit - op) return false;
+            memcpy(base + op, ip, literals);
+            ip += literals;
+            op += literals;
+            if (ip == end) break;
+
+            if (end - ip < 2) return false;
+            size_t offset = ip[0] | (ip[1] << 8);
+            ip += 2;
+            size_t match = (token & 15);
+            if (match == 15 && !readLength(ip, end, match)) return false;
+            match += MIN_MATCH;
+            if (!offset || offset > op - blockStart || match > limit - op) return false;
+
+            char* dst = base + op;
+            const char* from = dst - offset;
+            if (offset >= 8) {
+                size_t copied = 0;
+                for (; copied + 8 <= match; copied += 8) memcpy(dst + copied, from + copied, 8);
+                for (; copied < match; copied++) dst[copied] = from[copied];
+            }
+            else {
+                for (size_t k = 0; k < match; k++) dst[k] = from[k];     // overlapping run
+            }
+            op += match;
+        }
+        return op == limit;
+    }
+
+public:
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+    static constexpr uint32_t RAW_BLOCK = 0x80000000u;     // block stored uncompressed
+
+    // appends one framed block; incompressible input is stored as is
+    void appendBlock(const char* data, size_t length, string& out) {
+        put32(out, (uint32_t)length);
+        size_t header = out.size();
+        put32(out, 0);
+        put32(out, (uint32_t)Hash64::bytes(data, length));
+        size_t start = out.size();
+        compressBlock(reinterpret_cast<const unsigned char*>(data), length, out);
+        uint32_t stored = (uint32_t)(out.size() - start);
+        if (stored >= length) {
+            out.resize(start);
+            out.append(data, length);
+            stored = (uint32_t)length | RAW_BLOCK;
+        }
+        memcpy(&out[header], &stored, 4);
+    }
+
+    static void beginFrame(string& out) { out.append("GDZ1", 4); }
+    static void endFrame(string& out) { put32(out, 0); }
+
+    // whole buffer -> frame; out is cleared but keeps its capacity
+    void compress(const char* data, size_t length, string& out) {
+        out.clear();
+        beginFrame(out);
+        for (size_t done = 0; done < length; done += BLOCK_SIZE) {
+            appendBlock(data + done, length - done < BLOCK_SIZE ? length - done : BLOCK_SIZE, out);
+        }
+        endFrame(out);
+    }
+
+    // decodes one block record (header + body) onto out; returns the record's
+    // length, or 0 if it is malformed or fails its checksum
+    static size_t appendDecodedBlock(const char* record, size_t length, string& out) {
+        const unsigned char* ip = reinterpret_cast<const unsigned char*>(record);
+        if (length < 12) return 0;
+        uint32_t rawSize = read32(ip), stored = read32(ip + 4), checksum = read32(ip + 8);
+        size_t storedSize = stored & ~RAW_BLOCK;
+        if (!rawSize || rawSize > BLOCK_SIZE || storedSize > length - 12) return 0;
+        ip += 12;
+
+        size_t blockStart = out.size();
+        if (stored & RAW_BLOCK) {
+            if (storedSize != rawSize) return 0;
+            out.append(reinterpret_cast<const char*>(ip), rawSize);
+        }
+        else if (!decompressBlock(ip, storedSize, out, rawSize)) {
+            out.resize(blockStart);
+            return 0;
+        }
+        if ((uint32_t)Hash64::bytes(out.data() + blockStart, rawSize) != checksum) {
+            out.resize(blockStart);
+            return 0;
+        }
+        return 12 + storedSize;
+    }
+
+    // a block record holding data uncompressed (length <= BLOCK_SIZE)
+    static void appendStoredBlock(const char* data, size_t length, string& out) {
+        put32(out, (uint32_t)length);
+        put32(out, (uint32_t)length | RAW_BLOCK);
+        put32(out, (uint32_t)Hash64::bytes(data, length));
+        out.append(data, length);
+    }
+
+    // frame -> bytes; false on a malformed frame or checksum mismatch
+    static bool decompress(const char* frame, size_t length, string& out) {
+        out.clear();
+        if (length < 8 || memcmp(frame, "GDZ1", 4) != 0) return false;
+        size_t at = 4;
+        while (true) {
+            if (length - at < 4) return false;
+            uint32_t rawSize;
+            memcpy(&rawSize, frame + at, 4);
+            if (!rawSize) return at + 4 == length;
+            size_t used = appendDecodedBlock(frame + at, length - at, out);
+            if (!used) return false;
+            at += used;
+        }
+    }
+
+    // logical size recorded in a frame, without decoding it
+    static size_t frameSize(const char* frame, size_t length) {
+        size_t total = 0, at = 4;
+        while (at + 4 <= length) {
+            uint32_t rawSize;
+            memcpy(&rawSize, frame + at, 4);
+            if (!rawSize || at + 12 > length) break;
+            uint32_t stored;
+            memcpy(&stored, frame + at + 4, 4);
+            total += rawSize;
+            at += 12 + (stored & ~RAW_BLOCK);
+        }
+        return total;
+    }
+};
+
+// Streams arbitrary-sized writes into a frame one block at a time
+class Frame_Writer {
+private:
+    Block_Codec& codec;
+    string& out;
+    string pending;
+
+public:
+    Frame_Writer(Block_Codec& blockCodec, string& output) : codec(blockCodec), out(output) {
+        Block_Codec::beginFrame(out);
+    }
+
+    void write(const char* data, size_t length) {
+        if (!pending.empty()) {
+            size_t take = Block_Codec::BLOCK_SIZE - pending.size();
+            if (take > length) take = length;
+            pending.append(data, take);
+            data += take;
+            length -= take;
+            if (pending.size() < Block_Codec::BLOCK_SIZE) return;
+            codec.appendBlock(pending.data(), pending.size(), out);
+            pending.clear();
+        }
+        while (length >= Block_Codec::BLOCK_SIZE) {
+            codec.appendBlock(data, Block_Codec::BLOCK_SIZE, out);
+            data += Block_Codec::BLOCK_SIZE;
+            length -= Block_Codec::BLOCK_SIZE;
+        }
+        pending.append(data, length);
+    }
+
+    void finish() {
+        if (!pending.empty()) codec.appendBlock(pending.data(), pending.size(), out);
+        pending.clear();
+        Block_Codec::endFrame(out);
+    }
+};
+
+// 128-bit content digest: two independently seeded Hash64 passes.  A digest
+// match is still confirmed byte for byte before a chunk is shared.
+struct Chunk_Id {
+    uint64_t hi;
+    uint64_t lo;
+
+    bool operator==(const Chunk_Id& other) const { return hi == other.hi && lo == other.lo; }
+};
+
+struct Chunk_Id_Hash {
+    uint64_t operator()(const Chunk_Id& id) const { return id.lo; }
+};
+
+// a file body as the ordered list of chunks it is made of
+struct Content_Ref {
+    vector<uint32_t> chunks;    // slots in the Chunk_Store
+    size_t length = 0;          // logical size in bytes
+};
+
+// When file bodies are kept compressed in memory.  Files at or above
+// minFileSize always try; smaller ones only if a sample shrinks enough.
+// A chunk is only kept compressed if that actually saves space.
+struct Compression_Policy {
+    bool enabled = true;
+    size_t minFileSize = 4 * 1024;
+    size_t minProbeSize = 256;          // below this, never bother
+    size_t probeBytes = 4 * 1024;
+    double maxProbeRatio = 0.75;        // compressed sample / sample
+};
+
+// Content-addressed, deduplicated chunk store.  Bodies are cut at
+// content-defined boundaries (gear rolling hash) so an edit only changes the
+// chunks around it, and identical chunks are kept once and reference counted.
+// Chunks are never larger than a codec block, so a compressed chunk is kept
+// as exactly one Block_Codec block record and can be served as-is.
+//
+// Sessions share one store.  Writers (store, share, release) serialize on a
+// mutex; readers take no lock at all.  Chunks live in fixed segments that
+// never move, and a chunk is never changed while referenced, so a caller
+// that keeps its Content_Ref alive (by holding its directory lock) can read
+// while others write.
+class Chunk_Store {
+private:
+    struct Chunk {
+        Chunk_Id digest;
+        string bytes;           // the body, or one block record when packed
+        const char* mapped;     // set instead of bytes for chunks still in a snapshot mapping
+        uint32_t rawLength;
+        uint32_t refs;
+        bool packed;
+
+        size_t storedLength() const { return mapped ? rawLength : bytes.size(); }
+    };
+
+    static const size_t MIN_CHUNK = 2 * 1024;
+    static const size_t MAX_CHUNK = Block_Codec::BLOCK_SIZE;
+    static const uint64_t BOUNDARY_MASK = (1ULL << 13) - 1;    // ~8 KiB average
+
+    static constexpr size_t SEGMENT_BITS = 10;         // 1024 chunks per segment
+    static constexpr size_t MAX_SEGMENTS = (size_t)1 << 15;
+
+    vector<unique_ptr<Chunk[]>> segments;      // sized once, so never reallocated
+    size_t slotCount;
+    vector<uint32_t> freeSlots;
+    Open_Hash_Map<Chunk_Id, uint32_t, Chunk_Id_Hash> byDigest;
+    size_t storedBytes;         // heap bytes held, after compression
+    size_t rawBytes;            // the same chunks uncompressed
+    size_t mappedBytes;
+    Compression_Policy policy;
+    Block_Codec codec;
+    string scratch;
+    mutable mutex lock;         // writers only
+
+    Chunk& chunkAt(uint32_t slot) const {
+        return segments[slot >> SEGMENT_BITS][slot & (((size_t)1 << SEGMENT_BITS) - 1)];
+    }
+
+    uint32_t newSlot() {
+        if (!freeSlots.empty()) {
+            uint32_t slot = freeSlots.back();
+            freeSlots.pop_back();
+            return slot;
+        }
+        size_t segment = slotCount >> SEGMENT_BITS;
+        if (segment >= MAX_SEGMENTS) throw length_error("chunk store is full");
+        if (!segments[segment]) segments[segment].reset(new Chunk[(size_t)1 << SEGMENT_BITS]());
+        return (uint32_t)slotCount++;
+    }
+
+    // shared by every store and first used from whichever thread stores
+    // first, so it is a local static that C++ initializes exactly once
+    static const uint64_t* gearTable() {
+        struct Table {
+            uint64_t entries[256];
+            Table() {
+                uint64_t seed = 0x6A09E667F3BCC909ULL;
+                for (int i = 0; i < 256; i++) entries[i] = Hash64::mix(seed += 0x9E3779B97F4A7C15ULL);
+            }
+        };
+        static const Table table;
+        return table.entries;
+    }
+
+    static Chunk_Id digestOf(const char* data, size_t length) {
+        return Chunk_Id{ Hash64::bytes(data, length, 0x243F6A8885A308D3ULL),
+                         Hash64::bytes(data, length, 0x13198A2E03707344ULL) };
+    }
+
+    // end of the chunk starting at begin
+    static size_t cutPoint(const char* data, size_t begin, size_t end) {
+        if (end - begin <= MIN_CHUNK) return end;
+        const uint64_t* gear = gearTable();
+        size_t limit = end - begin > MAX_CHUNK ? begin + MAX_CHUNK : end;
+        uint64_t rolling = 0;
+        for (size_t i = begin; i < limit; i++) {
+            rolling = (rolling << 1) + gear[(unsigned char)data[i]];
+            if (i - begin >= MIN_CHUNK && (rolling & BOUNDARY_MASK) == 0) return i + 1;
+        }
+        return limit;
+    }
+
+    static void appendRaw(const Chunk& chunk, string& out) {
+        if (chunk.mapped) out.append(chunk.mapped, chunk.rawLength);
+        else if (chunk.packed) Block_Codec::appendDecodedBlock(chunk.bytes.data(), chunk.bytes.size(), out);
+        else out += chunk.bytes;
+    }
+
+    bool sameBytes(const Chunk& chunk, const char* data, size_t length) {
+        if (chunk.rawLength != length) return false;
+        if (chunk.mapped) return memcmp(chunk.mapped, data, length) == 0;
+        if (!chunk.packed) return memcmp(chunk.bytes.data(), data, length) == 0;
+        scratch.clear();
+        appendRaw(chunk, scratch);
+        return memcmp(scratch.data(), data, length) == 0;
+    }
+
+    bool worthCompressing(const string& data) {
+        if (!policy.enabled || data.size() < policy.minProbeSize) return false;
+        if (data.size() >= policy.minFileSize) return true;
+        size_t sample = data.size() < policy.probeBytes ? data.size() : policy.probeBytes;
+        codec.compress(data.data(), sample, scratch);
+        return scratch.size() <= sample * policy.maxProbeRatio;
+    }
+
+    uint32_t intern(const char* data, size_t length, bool compress) {
+        Chunk_Id digest = digestOf(data, length);
+        const uint32_t* existing = byDigest.find(digest);
+        if (existing && sameBytes(chunkAt(*existing), data, length)) {
+            chunkAt(*existing).refs++;
+            return *existing;
+        }
+
+        uint32_t slot = newSlot();
+        Chunk& chunk = chunkAt(slot);
+        chunk.digest = digest;
+        chunk.mapped = nullptr;
+        chunk.rawLength = (uint32_t)length;
+        chunk.refs = 1;
+        chunk.packed = false;
+        chunk.bytes.clear();
+        if (compress) {
+            codec.appendBlock(data, length, chunk.bytes);
+            uint32_t stored;
+            memcpy(&stored, chunk.bytes.data() + 4, 4);
+            chunk.packed = !(stored & Block_Codec::RAW_BLOCK);
+        }
+        if (!chunk.packed) chunk.bytes.assign(data, length);
+        chunk.bytes.shrink_to_fit();
+        storedBytes += chunk.bytes.size();
+        rawBytes += length;
+        if (!existing) byDigest.emplace(digest, slot);    // a colliding chunk just isn't shared
+        return slot;
+    }
+
+public:
+    Chunk_Store() : segments(MAX_SEGMENTS), slotCount(0), storedBytes(0), rawBytes(0), mappedBytes(0) {}
+
+    void setPolicy(const Compression_Policy& compression) {
+        lock_guard<mutex> guard(lock);
+        policy = compression;
+    }
+
+    Compression_Policy getPolicy() const {
+        lock_guard<mutex> guard(lock);
+        return policy;
+    }
+
+    Content_Ref store(const string& data) {
+        lock_guard<mutex> guard(lock);
+        Content_Ref ref;
+        ref.length = data.size();
+        bool compress = worthCompressing(data);
+        size_t begin = 0;
+        while (begin < data.size()) {
+            size_t end = cutPoint(data.data(), begin, data.size());
+            ref.chunks.push_back(intern(data.data() + begin, end - begin, compress));
+            begin = end;
+        }
+        return ref;
+    }
+
+    string load(const Content_Ref& ref) const {
+        string data;
+        data.reserve(ref.length);
+        for (uint32_t slot : ref.chunks) appendRaw(chunkAt(slot), data);
+        return data;
+    }
+
+    // the body as a Block_Codec frame, for callers that take compressed data;
+    // packed chunks are copied out without being decoded
+    void loadFrame(const Content_Ref& ref, string& frame) const {
+        frame.clear();
+        Block_Codec::beginFrame(frame);
+        for (uint32_t slot : ref.chunks) {
+            const Chunk& chunk = chunkAt(slot);
+            if (chunk.packed) frame += chunk.bytes;
+            else if (chunk.mapped) Block_Codec::appendStoredBlock(chunk.mapped, chunk.rawLength, frame);
+            else Block_Codec::appendStoredBlock(chunk.bytes.data(), chunk.bytes.size(), frame);
+        }
+        Block_Codec::endFrame(frame);
+    }
+
+    // bytes this body occupies (shared chunks are counted in full)
+    size_t storedSize(const Content_Ref& ref) const {
+        size_t total = 0;
+        for (uint32_t slot : ref.chunks) total += chunkAt(slot).storedLength();
+        return total;
+    }
+
+    // one more reference to a chunk whose bytes stay in a snapshot mapping;
+    // nothing is copied, and nothing is paged in unless a chunk with the same
+    // digest is already held, whose bytes must then match before it is shared
+    uint32_t adoptMapped(const Chunk_Id& digest, const char* data, size_t length) {
+        lock_guard<mutex> guard(lock);
+        const uint32_t* existing = byDigest.find(digest);
+        if (existing && sameBytes(chunkAt(*existing), data, length)) {
+            chunkAt(*existing).refs++;
+            return *existing;
+        }
+        uint32_t slot = newSlot();
+        Chunk& chunk = chunkAt(slot);
+        chunk.digest = digest;
+        chunk.bytes.clear();
+        chunk.mapped = data;
+        chunk.rawLength = (uint32_t)length;
+        chunk.refs = 1;
+        chunk.packed = false;
+        mappedBytes += length;
+        if (!existing) byDigest.emplace(digest, slot);
+        return slot;
+    }
+
+    // copies every still-mapped chunk onto the heap so the mapping can be closed
+    // (with no readers about)
+    void copyMappedChunks() {
+        lock_guard<mutex> guard(lock);
+        for (uint32_t slot = 0; slot < slotCount; slot++) {
+            Chunk& chunk = chunkAt(slot);
+            if (!chunk.mapped) continue;
+            chunk.bytes.assign(chunk.mapped, chunk.rawLength);
+            storedBytes += chunk.rawLength;
+            rawBytes += chunk.rawLength;
+            mappedBytes -= chunk.rawLength;
+            chunk.mapped = nullptr;
+        }
+    }
 
-        if (answer == user->securityAnswer) {
-            cout << "Your password is: " << user->password << endl;
+    const Chunk_Id& digestOf(uint32_t slot) const { return chunkAt(slot).digest; }
+    size_t lengthOf(uint32_t slot) const { return chunkAt(slot).rawLength; }
+
+    // appends the chunk's uncompressed bytes
+    void readChunk(uint32_t slot, string& out) const { appendRaw(chunkAt(slot), out); }
+
+    // another owner for the same body: costs nothing but the refcounts
+    Content_Ref share(const Content_Ref& ref) {
+        lock_guard<mutex> guard(lock);
+        for (uint32_t slot : ref.chunks) chunkAt(slot).refs++;
+        return ref;
+    }
+
+    void release(Content_Ref& ref) {
+        lock_guard<mutex> guard(lock);
+        for (uint32_t slot : ref.chunks) {
+            Chunk& chunk = chunkAt(slot);
+            if (--chunk.refs > 0) continue;
+            const uint32_t* indexed = byDigest.find(chunk.digest);
+            if (indexed && *indexed == slot) byDigest.erase(chunk.digest);
+            if (chunk.mapped) {
+                mappedBytes -= chunk.rawLength;
+            }
+            else {
+                storedBytes -= chunk.bytes.size();
+                rawBytes -= chunk.rawLength;
+            }
+            string().swap(chunk.bytes);
+            chunk.mapped = nullptr;
+            freeSlots.push_back(slot);
+        }
+        ref.chunks.clear();
+        ref.length = 0;
+    }
+
+    size_t uniqueBytes() const {
+        lock_guard<mutex> guard(lock);
+        return storedBytes;
+    }
+
+    size_t uncompressedBytes() const {
+        lock_guard<mutex> guard(lock);
+        return rawBytes;
+    }
+
+    size_t bytesInMapping() const {
+        lock_guard<mutex> guard(lock);
+        return mappedBytes;
+    }
+
+    size_t chunkCount() const {
+        lock_guard<mutex> guard(lock);
+        return slotCount - freeSlots.size();
+    }
+};
+
+struct TreeNode;
+
+struct Node_Name_Key {
+    typedef string Key;
+    static const string& get(const TreeNode* node);
+};
+
+// How a directory indexes its children.  Small folders stay a sorted flat
+// vector (binary search, cache friendly); big ones switch to the AVL index so
+// an insert never has to shift millions of pointers.
+enum Index_Mode { INDEX_AUTO, INDEX_FLAT, INDEX_BALANCED };
+
+class Child_Index {
+private:
+    vector<TreeNode*> flat;                             // sorted by name
+    Balanced_Index<TreeNode*, Node_Name_Key>* tree;     // non-null once promoted
+
+    size_t lowerBound(const string& name) const;
+    void promote();
+
+public:
+    static const size_t FLAT_LIMIT = 1024;     // INDEX_AUTO promotes past this
+
+    Child_Index() : tree(nullptr) {}
+    ~Child_Index() { delete tree; }
+
+    Child_Index(const Child_Index&) = delete;
+    Child_Index& operator=(const Child_Index&) = delete;
+
+    size_t size() const { return tree ? tree->size() : flat.size(); }
+    bool empty() const { return size() == 0; }
+    bool isBalanced() const { return tree != nullptr; }
+
+    TreeNode* find(const string& name) const;
+    bool insert(TreeNode* node, Index_Mode mode);
+    bool erase(TreeNode* node);
+
+    template <typename Visit>
+    void forEach(Visit visit) const {
+        if (tree) {
+            tree->forEach([&](TreeNode* const& node) { visit(node); });
+            return;
+        }
+        for (TreeNode* node : flat) visit(node);
+    }
+};
+
+struct TreeNode {
+    uint64_t id;                    // stable for the node's lifetime, never reused
+    string name;
+    bool isFile;
+    uint32_t slot;                  // index in the tree's Compact_Tree layout while linked
+    Content_Ref content;            // chunk list in the tree's Chunk_Store
+    TreeNode* parent;
+    Child_Index children;           // directories only, ordered by name
+
+    TreeNode(const string& nodeName, bool file = false)
+        : id(0), name(nodeName), isFile(file), slot(UINT32_MAX), parent(nullptr) {
+    }
+
+    static void* operator new(size_t size) { return Node_Pool<TreeNode>::get("TreeNode").allocate(size); }
+    static void operator delete(void* block, size_t size) { Node_Pool<TreeNode>::get("TreeNode").release(block, size); }
+};
+
+const string& Node_Name_Key::get(const TreeNode* node) {
+    return node->name;
+}
+
+size_t Child_Index::lowerBound(const string& name) const {
+    size_t lo = 0, hi = flat.size();
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (flat[mid]->name < name) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+void Child_Index::promote() {
+    tree = new Balanced_Index<TreeNode*, Node_Name_Key>();
+    for (TreeNode* node : flat) tree->insert(node);
+    vector<TreeNode*>().swap(flat);
+}
+
+TreeNode* Child_Index::find(const string& name) const {
+    if (tree) {
+        TreeNode* const* found = tree->find(name);
+        return found ? *found : nullptr;
+    }
+    size_t pos = lowerBound(name);
+    if (pos < flat.size() && flat[pos]->name == name) return flat[pos];
+    return nullptr;
+}
+
+bool Child_Index::insert(TreeNode* node, Index_Mode mode) {
+    if (!tree && (mode == INDEX_BALANCED || (mode == INDEX_AUTO && flat.size() >= FLAT_LIMIT))) {
+        promote();
+    }
+    if (tree) return tree->insert(node);
+
+    size_t pos = lowerBound(node->name);
+    if (pos < flat.size() && flat[pos]->name == node->name) return false;
+    flat.insert(flat.begin() + pos, node);
+    return true;
+}
+
+bool Child_Index::erase(TreeNode* node) {
+    if (tree) {
+        TreeNode* const* found = tree->find(node->name);
+        if (!found || *found != node) return false;
+        return tree->erase(node->name);
+    }
+    size_t pos = lowerBound(node->name);
+    if (pos >= flat.size() || flat[pos] != node) return false;
+    flat.erase(flat.begin() + pos);
+    return true;
+}
+
+// (parent directory id, name) -> node id.  Keying on the parent's id rather
+// than its path means renaming a folder touches exactly one entry, however
+// many descendants it has.
+struct Dentry_Key {
+    uint64_t parentId;
+    string name;
+
+    bool operator==(const Dentry_Key& other) const {
+        return parentId == other.parentId && name == other.name;
+    }
+};
+
+struct Dentry_Hash {
+    uint64_t operator()(const Dentry_Key& key) const {
+        return Hash64::bytes(key.name.data(), key.name.size(), Hash64::mix(key.parentId));
+    }
+};
+
+// Substring and glob search over node names.  Each name is indexed by its
+// trigrams, padded with start and end markers (bytes 1 and 2) so anchored
+// patterns have trigrams of their own.  A query intersects the posting
+// lists of its pattern's two rarest trigrams, screens those candidates by a
+// per-name trigram signature, and runs the compiled pattern over the few
+// left.  ASCII case is folded.  Entries are
+// numbered in insertion order, so lists stay sorted by only appending;
+// removed entries linger as tombstones until a compaction renumbers.
+class Name_Index {
+public:
+    struct Match {
+        uint64_t nodeId;
+        uint64_t parentId;
+    };
+
+    static constexpr size_t COMPACT_AFTER = 4096;   // tombstones tolerated before compacting
+    static constexpr char START = 1;
+    static constexpr char END = 2;
+
+    static string fold(const string& text) {
+        string folded(text);
+        for (char& c : folded) {
+            if (c >= 'A' && c <= 'Z') c = (char)(c + ('a' - 'A'));
+        }
+        return folded;
+    }
+
+    // A glob compiled to the literal runs between its stars; '?' matches any
+    // one character.  Without wildcards it means "contains".
+    class Pattern {
+    private:
+        vector<string> parts;
+        bool anchoredStart;
+        bool anchoredEnd;
+
+        static bool matchAt(const string& name, size_t at, const string& part) {
+            for (size_t i = 0; i < part.size(); i++) {
+                if (part[i] != '?' && part[i] != name[at + i]) return false;
+            }
             return true;
         }
-        else {
-            cout << "Incorrect answer. Cannot recover password.\n";
-            return false;
+
+    public:
+        explicit Pattern(const string& glob) : anchoredStart(false), anchoredEnd(false) {
+            string folded = fold(glob);
+            if (folded.find_first_of("*?") == string::npos) {
+                if (!folded.empty()) parts.push_back(folded);
+                return;
+            }
+            anchoredStart = folded.front() != '*';
+            anchoredEnd = folded.back() != '*';
+            size_t at = 0;
+            while (at <= folded.size()) {
+                size_t star = folded.find('*', at);
+                if (star == string::npos) star = folded.size();
+                if (star > at) parts.push_back(folded.substr(at, star - at));
+                at = star + 1;
+            }
+        }
+
+        bool matches(const string& name) const {
+            size_t at = 0;
+            for (size_t i = 0; i < parts.size(); i++) {
+                const string& part = parts[i];
+                bool last = i + 1 == parts.size();
+                if (i == 0 && anchoredStart) {
+                    if (name.size() < part.size() || !matchAt(name, 0, part)) return false;
+                    at = part.size();
+                    if (last && anchoredEnd) return at == name.size();
+                }
+                else if (last && anchoredEnd) {
+                    return name.size() >= at + part.size() && matchAt(name, name.size() - part.size(), part);
+                }
+                else {
+                    // leftmost fit leaves the most room for the parts after it
+                    while (at + part.size() <= name.size() && !matchAt(name, at, part)) at++;
+                    if (at + part.size() > name.size()) return false;
+                    at += part.size();
+                }
+            }
+            return true;
+        }
+
+        // trigrams every match must contain
+        void trigrams(vector<uint32_t>& out) const {
+            out.clear();
+            for (size_t i = 0; i < parts.size(); i++) {
+                string text = parts[i];
+                if (i == 0 && anchoredStart) text.insert(text.begin(), START);
+                if (i + 1 == parts.size() && anchoredEnd) text.push_back(END);
+                for (size_t at = 0; at + 3 <= text.size(); at++) {
+                    if (text[at] != '?' && text[at + 1] != '?' && text[at + 2] != '?') out.push_back(trigramAt(text, at));
+                }
+            }
+            sort(out.begin(), out.end());
+            out.erase(unique(out.begin(), out.end()), out.end());
+        }
+    };
+
+private:
+    struct Entry {
+        uint64_t nodeId;        // 0 once removed
+        uint64_t parentId;
+        string name;            // folded
+    };
+
+    vector<Entry> entries;
+    vector<uint64_t> signatures;                    // per entry, one hashed bit per trigram
+    Open_Hash_Map<uint64_t, uint32_t> entryOf;      // node id -> its live entry
+    Open_Hash_Map<uint64_t, uint32_t> listOf;       // trigram -> index into lists
+    vector<vector<uint32_t>> lists;                 // entry numbers, ascending
+    size_t deadEntries;
+    mutable Distributed_Rw_Lock lock;
+
+    static uint32_t trigramAt(const string& text, size_t at) {
+        return (uint32_t)(unsigned char)text[at] << 16 | (uint32_t)(unsigned char)text[at + 1] << 8
+            | (unsigned char)text[at + 2];
+    }
+
+    // first element >= value, probing 1, 2, 4 ... ahead before bisecting
+    static const uint32_t* gallop(const uint32_t* from, const uint32_t* end, uint32_t value) {
+        size_t step = 1;
+        while (step < (size_t)(end - from) && from[step] < value) {
+            from += step;
+            step *= 2;
+        }
+        return lower_bound(from, step < (size_t)(end - from) ? from + step : end, value);
+    }
+
+    static uint64_t signatureBit(uint32_t trigram) {
+        return (uint64_t)1 << (Hash64::mix(trigram) & 63);
+    }
+
+    void removeLocked(uint64_t nodeId) {
+        uint32_t entry;
+        if (!entryOf.erase(nodeId, &entry)) return;
+        entries[entry].nodeId = 0;
+        string().swap(entries[entry].name);
+        if (++deadEntries >= COMPACT_AFTER && deadEntries > entryOf.size()) compact();
+    }
+
+    // drops tombstones and renumbers the live entries in order, which keeps
+    // every list sorted
+    void compact() {
+        const uint32_t DEAD = UINT32_MAX;
+        vector<uint32_t> renumbered(entries.size(), DEAD);
+        uint32_t live = 0;
+        for (uint32_t entry = 0; entry < entries.size(); entry++) {
+            if (!entries[entry].nodeId) continue;
+            renumbered[entry] = live;
+            *entryOf.find(entries[entry].nodeId) = live;
+            signatures[live] = signatures[entry];
+            entries[live++] = std::move(entries[entry]);
+        }
+        entries.resize(live);
+        signatures.resize(live);
+        for (vector<uint32_t>& list : lists) {
+            size_t kept = 0;
+            for (uint32_t entry : list) {
+                if (renumbered[entry] != DEAD) list[kept++] = renumbered[entry];
+            }
+            list.resize(kept);
+            list.shrink_to_fit();
+        }
+        deadEntries = 0;
+    }
+
+public:
+    Name_Index() : deadEntries(0) {}
+
+    Name_Index(const Name_Index&) = delete;
+    Name_Index& operator=(const Name_Index&) = delete;
+
+    // adds the node, or re-indexes it under a new name or folder
+    void add(uint64_t nodeId, uint64_t parentId, const string& name) {
+        string folded = fold(name);
+        string padded = START + folded + END;
+        vector<uint32_t> keys;
+        for (size_t at = 0; at + 3 <= padded.size(); at++) keys.push_back(trigramAt(padded, at));
+        sort(keys.begin(), keys.end());
+        keys.erase(unique(keys.begin(), keys.end()), keys.end());
+
+        lock_guard<Distributed_Rw_Lock> guard(lock);
+        removeLocked(nodeId);
+        uint32_t entry = (uint32_t)entries.size();
+        entries.push_back(Entry{ nodeId, parentId, std::move(folded) });
+        signatures.push_back(0);
+        entryOf.emplace(nodeId, entry);
+        for (uint32_t key : keys) {
+            signatures.back() |= signatureBit(key);
+            pair<uint32_t*, bool> list = listOf.emplace(key, (uint32_t)lists.size());
+            if (list.second) lists.emplace_back();
+            lists[*list.first].push_back(entry);
+        }
+    }
+
+    void remove(uint64_t nodeId) {
+        lock_guard<Distributed_Rw_Lock> guard(lock);
+        removeLocked(nodeId);
+    }
+
+    // the folder a linked node was last indexed under
+    bool parentOf(uint64_t nodeId, uint64_t& parentId) const {
+        shared_lock<Distributed_Rw_Lock> guard(lock);
+        const uint32_t* entry = entryOf.find(nodeId);
+        if (!entry) return false;
+        parentId = entries[*entry].parentId;
+        return true;
+    }
+
+    // up to limit nodes whose names match glob, oldest first.  Patterns
+    // without a three-character literal run have no trigrams to narrow by
+    // and scan every name.
+    vector<Match> search(const string& glob, size_t limit) const {
+        Pattern pattern(glob);
+        vector<uint32_t> keys;
+        pattern.trigrams(keys);
+        vector<Match> found;
+
+        shared_lock<Distributed_Rw_Lock> guard(lock);
+        auto check = [&](uint32_t entry) {
+            const Entry& candidate = entries[entry];
+            if (candidate.nodeId && pattern.matches(candidate.name)) found.push_back(Match{ candidate.nodeId, candidate.parentId });
+            return found.size() < limit;
+        };
+        if (keys.empty()) {
+            for (uint32_t entry = 0; entry < entries.size() && check(entry); entry++) {}
+            return found;
+        }
+
+        // Intersect the two rarest lists; the rest are tested against the
+        // candidate's signature, far cheaper than merging lists whose
+        // trigrams mostly occur together anyway ("inv", "nvo", "voi").
+        vector<const vector<uint32_t>*> wanted;
+        uint64_t required = 0;
+        for (uint32_t key : keys) {
+            const uint32_t* list = listOf.find(key);
+            if (!list) return found;
+            wanted.push_back(&lists[*list]);
+            required |= signatureBit(key);
+        }
+        sort(wanted.begin(), wanted.end(),
+            [](const vector<uint32_t>* a, const vector<uint32_t>* b) { return a->size() < b->size(); });
+
+        const uint32_t* other = wanted.size() > 1 ? wanted[1]->data() : nullptr;
+        const uint32_t* otherEnd = other ? other + wanted[1]->size() : nullptr;
+        for (uint32_t entry : *wanted[0]) {
+            if (other) {
+                other = gallop(other, otherEnd, entry);
+                if (other == otherEnd) break;
+                if (*other != entry) continue;
+            }
+            if ((signatures[entry] & required) == required && !check(entry)) break;
+        }
+        return found;
+    }
+
+    size_t size() const {
+        shared_lock<Distributed_Rw_Lock> guard(lock);
+        return entryOf.size();
+    }
+};
+
+// Directory tree packed into parallel arrays and addressed by 32-bit index,
+// for passes over the whole tree.  What a walk or a sibling scan reads (parent,
+// first child, next sibling, a 32-bit name hash and the flags) sits in hot
+// arrays of its own; names live in one shared arena and, like the caller's
+// content handle, are only read when asked for.  pack() renumbers the nodes
+// in walk order, after which a full walk streams through memory.  Lookups
+// compare name hashes along the sibling list until a folder passes
+// SCAN_LIMIT children; its entries then go in a (parent, name) hash map.
+// Not thread safe.
+class Compact_Tree {
+public:
+    typedef uint32_t Index;
+
+    static constexpr Index NONE = 0xffffffff;
+    static constexpr Index ROOT = 0;
+    static constexpr uint32_t SCAN_LIMIT = 32;
+    static constexpr size_t ARENA_LIMIT = 0xffffffff;   // name offsets are 32-bit
+
+private:
+    enum : uint8_t { FLAG_LIVE = 1, FLAG_FILE = 2, FLAG_HASHED = 4 };
+
+    static constexpr size_t COMPACT_NAMES_AFTER = 1 << 16;    // dead arena bytes tolerated
+
+    // hot
+    vector<Index> parents;
+    vector<Index> firstChildren;
+    vector<Index> nextSiblings;
+    vector<uint32_t> nameHashes;
+    vector<uint8_t> flags;
+
+    // cold
+    vector<Index> prevSiblings;         // a first child's points at the last child
+    vector<uint32_t> childCounts;
+    vector<uint32_t> nameOffsets;
+    vector<uint32_t> nameLengths;
+    vector<uint64_t> handles;
+
+    string arena;
+    size_t deadNameBytes;
+    Open_Hash_Map<uint64_t, Index> dentries;    // children of hashed folders
+    size_t dentryCollisions;                    // hashed children whose key was taken; misses rescan while any are left
+    vector<Index> freeSlots;
+    size_t live;
+
+    static uint64_t dentryKey(Index dir, uint64_t nameHash) {
+        return nameHash ^ Hash64::mix((uint64_t)dir + 1);
+    }
+
+    uint64_t hashOf(Index node) const {
+        return Hash64::bytes(arena.data() + nameOffsets[node], nameLengths[node]);
+    }
+
+    bool nameIs(Index node, const string& name) const {
+        return nameLengths[node] == name.size() && memcmp(arena.data() + nameOffsets[node], name.data(), name.size()) == 0;
+    }
+
+    Index allocate() {
+        if (!freeSlots.empty()) {
+            Index node = freeSlots.back();
+            freeSlots.pop_back();
+            return node;
+        }
+        if (parents.size() >= NONE) return NONE;
+        parents.push_back(NONE);
+        firstChildren.push_back(NONE);
+        nextSiblings.push_back(NONE);
+        nameHashes.push_back(0);
+        flags.push_back(0);
+        prevSiblings.push_back(NONE);
+        childCounts.push_back(0);
+        nameOffsets.push_back(0);
+        nameLengths.push_back(0);
+        handles.push_back(0);
+        return (Index)(parents.size() - 1);
+    }
+
+    void release(Index node) {
+        deadNameBytes += nameLengths[node];
+        flags[node] = 0;
+        firstChildren[node] = NONE;
+        freeSlots.push_back(node);
+        live--;
+    }
+
+    bool storeName(Index node, const string& name, uint64_t hash) {
+        if (arena.size() + name.size() > ARENA_LIMIT) compactNames();
+        if (arena.size() + name.size() > ARENA_LIMIT) return false;
+        nameOffsets[node] = (uint32_t)arena.size();
+        nameLengths[node] = (uint32_t)name.size();
+        nameHashes[node] = (uint32_t)hash;
+        arena += name;
+        return true;
+    }
+
+    void addDentry(Index dir, Index node, uint64_t hash) {
+        if (!dentries.emplace(dentryKey(dir, hash), node).second) dentryCollisions++;
+    }
+
+    void eraseDentry(Index dir, Index node) {
+        uint64_t key = dentryKey(dir, hashOf(node));
+        const Index* found = dentries.find(key);
+        if (found && *found == node) dentries.erase(key);
+        else dentryCollisions--;        // node lost its key to another name
+    }
+
+    void hashFolder(Index dir) {
+        flags[dir] |= FLAG_HASHED;
+        for (Index child = firstChildren[dir]; child != NONE; child = nextSiblings[child]) {
+            addDentry(dir, child, hashOf(child));
+        }
+    }
+
+    // appends node to dir's children
+    void link(Index dir, Index node, uint64_t hash) {
+        Index first = firstChildren[dir];
+        parents[node] = dir;
+        nextSiblings[node] = NONE;
+        if (first == NONE) {
+            firstChildren[dir] = node;
+            prevSiblings[node] = node;
+        } else {
+            Index last = prevSiblings[first];
+            nextSiblings[last] = node;
+            prevSiblings[node] = last;
+            prevSiblings[first] = node;
+        }
+        childCounts[dir]++;
+        if (flags[dir] & FLAG_HASHED) addDentry(dir, node, hash);
+        else if (childCounts[dir] > SCAN_LIMIT) hashFolder(dir);
+    }
+
+    void unlink(Index node) {
+        Index dir = parents[node];
+        if (flags[dir] & FLAG_HASHED) eraseDentry(dir, node);
+        Index first = firstChildren[dir];
+        Index next = nextSiblings[node];
+        Index prev = prevSiblings[node];
+        if (node == first) {
+            firstChildren[dir] = next;
+        } else {
+            nextSiblings[prev] = next;
+        }
+        if (next != NONE) prevSiblings[next] = prev;
+        else if (node != first) prevSiblings[first] = prev;
+        childCounts[dir]--;
+        parents[node] = NONE;
+    }
+
+    Index scan(Index dir, uint32_t hash, const string& name) const {
+        for (Index child = firstChildren[dir]; child != NONE; child = nextSiblings[child]) {
+            if (nameHashes[child] == hash && nameIs(child, name)) return child;
+        }
+        return NONE;
+    }
+
+    // column[i] = column[order[i]], one column at a time so each pass streams
+    // through two arrays; renumbered, if given, also maps the values
+    template <typename T>
+    static void permute(vector<T>& column, const vector<Index>& order, const vector<Index>* renumbered) {
+        vector<T> packed(order.size());
+        for (size_t i = 0; i < order.size(); i++) {
+            T value = column[order[i]];
+            if (renumbered && value != (T)NONE) value = (T)(*renumbered)[value];
+            packed[i] = value;
+        }
+        column.swap(packed);
+    }
+
+    // rewrites the arena in index order, dropping renamed and removed names
+    void compactNames() {
+        string packed;
+        packed.reserve(arena.size() - deadNameBytes);
+        for (Index node = 0; node < flags.size(); node++) {
+            if (!(flags[node] & FLAG_LIVE)) continue;
+            uint32_t offset = (uint32_t)packed.size();
+            packed.append(arena, nameOffsets[node], nameLengths[node]);
+            nameOffsets[node] = offset;
+        }
+        arena.swap(packed);
+        deadNameBytes = 0;
+    }
+
+    void maybeCompactNames() {
+        if (deadNameBytes >= COMPACT_NAMES_AFTER && deadNameBytes > arena.size() / 2) compactNames();
+    }
+
+public:
+    explicit Compact_Tree(const string& rootName = "Root", uint64_t rootHandle = 0) {
+        clear(rootName, rootHandle);
+    }
+
+    Compact_Tree(const Compact_Tree&) = delete;
+    Compact_Tree& operator=(const Compact_Tree&) = delete;
+
+    // back to a lone root
+    void clear(const string& rootName = "Root", uint64_t rootHandle = 0) {
+        for (vector<Index>* column : { &parents, &firstChildren, &nextSiblings, &prevSiblings }) column->clear();
+        for (vector<uint32_t>* column : { &nameHashes, &childCounts, &nameOffsets, &nameLengths }) column->clear();
+        flags.clear();
+        handles.clear();
+        arena.clear();
+        deadNameBytes = 0;
+        dentries.clear();
+        dentryCollisions = 0;
+        freeSlots.clear();
+
+        Index root = allocate();
+        storeName(root, rootName, Hash64::bytes(rootName.data(), rootName.size()));
+        flags[root] = FLAG_LIVE;
+        handles[root] = rootHandle;
+        live = 1;
+    }
+
+    void reserve(size_t nodes, size_t nameBytes) {
+        for (vector<Index>* column : { &parents, &firstChildren, &nextSiblings, &prevSiblings }) column->reserve(nodes);
+        for (vector<uint32_t>* column : { &nameHashes, &childCounts, &nameOffsets, &nameLengths }) column->reserve(nodes);
+        flags.reserve(nodes);
+        handles.reserve(nodes);
+        arena.reserve(nameBytes);
+    }
+
+    size_t size() const { return live; }
+
+    bool isLive(Index node) const { return node < flags.size() && (flags[node] & FLAG_LIVE); }
+    bool isFile(Index node) const { return (flags[node] & FLAG_FILE) != 0; }
+    Index parentOf(Index node) const { return parents[node]; }
+    Index firstChildOf(Index node) const { return firstChildren[node]; }
+    Index nextSiblingOf(Index node) const { return nextSiblings[node]; }
+    uint32_t childCount(Index node) const { return childCounts[node]; }
+    uint64_t handleOf(Index node) const { return handles[node]; }
+    string nameOf(Index node) const { return arena.substr(nameOffsets[node], nameLengths[node]); }
+
+    // a direct child by name
+    Index findChild(Index dir, const string& name) const {
+        if (!isLive(dir) || isFile(dir)) return NONE;
+        uint64_t hash = Hash64::bytes(name.data(), name.size());
+        if (flags[dir] & FLAG_HASHED) {
+            const Index* found = dentries.find(dentryKey(dir, hash));
+            if (found && parents[*found] == dir && nameIs(*found, name)) return *found;
+            if (!dentryCollisions) return NONE;
+        }
+        return scan(dir, (uint32_t)hash, name);
+    }
+
+    // a new last child of dir; NONE if dir is no folder or has the name already
+    Index add(Index dir, const string& name, bool file, uint64_t handle) {
+        if (!isLive(dir) || isFile(dir) || findChild(dir, name) != NONE) return NONE;
+        Index node = allocate();
+        if (node == NONE) return NONE;
+        uint64_t hash = Hash64::bytes(name.data(), name.size());
+        if (!storeName(node, name, hash)) {
+            freeSlots.push_back(node);
+            return NONE;
+        }
+        flags[node] = FLAG_LIVE | (file ? FLAG_FILE : 0);
+        firstChildren[node] = NONE;
+        childCounts[node] = 0;
+        handles[node] = handle;
+        live++;
+        link(dir, node, hash);
+        return node;
+    }
+
+    // drops node and everything under it
+    bool remove(Index node) {
+        if (!isLive(node) || node == ROOT) return false;
+        unlink(node);
+        vector<Index> pending{ node };
+        while (!pending.empty()) {
+            Index current = pending.back();
+            pending.pop_back();
+            bool hashed = (flags[current] & FLAG_HASHED) != 0;
+            for (Index child = firstChildren[current]; child != NONE; child = nextSiblings[child]) {
+                if (hashed) eraseDentry(current, child);
+                pending.push_back(child);
+            }
+            release(current);
+        }
+        maybeCompactNames();
+        return true;
+    }
+
+    bool rename(Index node, const string& name) {
+        if (!isLive(node)) return false;
+        Index dir = parents[node];
+        if (dir != NONE) {
+            Index existing = findChild(dir, name);
+            if (existing != NONE) return existing == node;
+        }
+        bool hashed = dir != NONE && (flags[dir] & FLAG_HASHED);
+        if (hashed) eraseDentry(dir, node);
+        // a failed store may still have compacted the arena, moving the old
+        // name, but it leaves the node's offset, length and hash pointing at it
+        uint32_t oldLength = nameLengths[node];
+        uint64_t hash = Hash64::bytes(name.data(), name.size());
+        bool stored = storeName(node, name, hash);
+        if (stored) deadNameBytes += oldLength;
+        else hash = hashOf(node);
+        if (hashed) addDentry(dir, node, hash);
+        maybeCompactNames();
+        return stored;
+    }
+
+    // moves node (and its subtree) to the end of dir's children
+    bool move(Index node, Index dir) {
+        if (!isLive(node) || node == ROOT || !isLive(dir) || isFile(dir)) return false;
+        for (Index above = dir; above != NONE; above = parents[above]) {
+            if (above == node) return false;        // into its own subtree
+        }
+        if (parents[node] == dir) return true;
+        uint64_t hash = hashOf(node);
+        const string name = nameOf(node);
+        if (findChild(dir, name) != NONE) return false;
+        unlink(node);
+        link(dir, node, hash);
+        return true;
+    }
+
+    // "/Root/docs/report.txt"
+    string pathOf(Index node) const {
+        vector<Index> parts;
+        for (; node != NONE; node = parents[node]) parts.push_back(node);
+        string path;
+        for (size_t i = parts.size(); i-- > 0;) {
+            path += '/';
+            path.append(arena, nameOffsets[parts[i]], nameLengths[parts[i]]);
+        }
+        return path;
+    }
+
+    // same rules as FileSystemTree::resolvePath
+    Index resolve(const string& path, Index from = ROOT) const {
+        if (path.empty() || !isLive(from)) return NONE;
+
+        Index node = from;
+        size_t pos = 0;
+        if (path[0] == '/') {
+            node = ROOT;
+            pos = 1;
+            size_t slash = path.find('/', pos);
+            string first = path.substr(pos, slash == string::npos ? string::npos : slash - pos);
+            if (nameIs(ROOT, first)) pos = (slash == string::npos) ? path.size() : slash + 1;
+        }
+
+        while (pos < path.size()) {
+            size_t slash = path.find('/', pos);
+            if (slash == string::npos) slash = path.size();
+            string part = path.substr(pos, slash - pos);
+            pos = slash + 1;
+
+            if (part.empty() || part == ".") continue;
+            if (part == "..") {
+                if (parents[node] != NONE) node = parents[node];
+                continue;
+            }
+            node = findChild(node, part);
+            if (node == NONE) return NONE;
+        }
+        return node;
+    }
+
+    // from and everything under it, parents before their children and
+    // siblings in order.  Needs no stack: it climbs back up through parents.
+    template <typename Visit>
+    void walk(Visit visit, Index from = ROOT) const {
+        if (!isLive(from)) return;
+        Index node = from;
+        while (true) {
+            visit(node);
+            if (firstChildren[node] != NONE) {
+                node = firstChildren[node];
+                continue;
+            }
+            while (node != from && nextSiblings[node] == NONE) node = parents[node];
+            if (node == from) return;
+            node = nextSiblings[node];
+        }
+    }
+
+    // renumbers the live nodes in walk order and rewrites the arena to match;
+    // indices held from before are invalid afterwards
+    void pack() {
+        vector<Index> order;
+        order.reserve(live);
+        walk([&](Index node) { order.push_back(node); });
+
+        vector<Index> renumbered(flags.size(), NONE);
+        for (size_t i = 0; i < order.size(); i++) renumbered[order[i]] = (Index)i;
+
+        for (vector<Index>* column : { &parents, &firstChildren, &nextSiblings, &prevSiblings }) {
+            permute(*column, order, &renumbered);
+        }
+        for (vector<uint32_t>* column : { &nameHashes, &childCounts, &nameLengths }) permute(*column, order, nullptr);
+        permute(flags, order, nullptr);
+        permute(handles, order, nullptr);
+
+        string names;
+        names.reserve(arena.size() - deadNameBytes);
+        vector<uint32_t> offsets(order.size());
+        for (size_t i = 0; i < order.size(); i++) {
+            offsets[i] = (uint32_t)names.size();
+            names.append(arena, nameOffsets[order[i]], nameLengths[i]);
+        }
+        arena.swap(names);
+        nameOffsets.swap(offsets);
+        deadNameBytes = 0;
+        freeSlots.clear();
+
+        dentries.clear();
+        dentryCollisions = 0;
+        for (Index dir = 0; dir < flags.size(); dir++) {
+            if (flags[dir] & FLAG_HASHED) hashFolder(dir);
+        }
+    }
+
+    // resident bytes, arrays and arena included
+    size_t bytes() const {
+        size_t total = arena.capacity() + flags.capacity() + handles.capacity() * sizeof(uint64_t)
+            + freeSlots.capacity() * sizeof(Index);
+        for (const vector<Index>* column : { &parents, &firstChildren, &nextSiblings, &prevSiblings }) {
+            total += column->capacity() * sizeof(Index);
+        }
+        for (const vector<uint32_t>* column : { &nameHashes, &childCounts, &nameOffsets, &nameLengths }) {
+            total += column->capacity() * sizeof(uint32_t);
+        }
+        return total + dentries.capacity() * (2 * sizeof(uint64_t) + 2 * sizeof(uint32_t));
+    }
+};
+
+// Directory tree for the File System
+// every folder owns an ordered child index, so a lookup only searches inside
+// one directory and a path costs O(depth * log fanout)
+// Shared by every session.  Lookups go through the sharded id and dentry
+// maps and need no directory lock.  A directory's lock (striped by id)
+// guards its child list and the bodies and metadata of the files in it:
+// hold it shared to read them and exclusively to change them.  The
+// currentDir calls are the single-user interface.
+// Every link and unlink is mirrored into a Compact_Tree whose handles are
+// the nodes themselves, so whole-tree passes walk its packed arrays rather
+// than chase child indexes node by node.
+class FileSystemTree {
+private:
+    static constexpr size_t DIR_LOCK_STRIPES = 64;
+
+    TreeNode* root;
+    TreeNode* currentDir;
+
+    Index_Mode indexMode;
+    atomic<uint64_t> nextId;
+    Chunk_Store contentStore;
+    Sharded_Map<uint64_t, TreeNode*> nodesById;            // every linked node
+    Sharded_Map<Dentry_Key, uint64_t, Dentry_Hash> pathIndex;
+    Name_Index names;                                       // every linked node but the root
+    Compact_Tree layout;                                    // every linked node; handles are TreeNode*
+    size_t layoutChanges;                                   // links and unlinks since the last pack
+    mutable mutex layoutLock;                               // guards the two above and every node's slot
+    unique_ptr<Distributed_Rw_Lock[]> dirLocks;
+
+    static TreeNode* nodeAt(const Compact_Tree& tree, Compact_Tree::Index index) {
+        return reinterpret_cast<TreeNode*>((uintptr_t)tree.handleOf(index));
+    }
+
+    //   delete the entire tree (iterative so deep trees can't blow the stack)
+    void deleteTree(TreeNode* node) {
+        if (!node) return;
+        vector<TreeNode*> pending{ node };
+        while (!pending.empty()) {
+            TreeNode* current = pending.back();
+            pending.pop_back();
+            current->children.forEach([&](TreeNode* child) { pending.push_back(child); });
+            delete current;
+        }
+    }
+
+    //  to find a direct child of a directory by name (two hash probes)
+    TreeNode* findNode(const TreeNode* dir, const string& name) const {
+        if (!dir || dir->isFile) return nullptr;
+        uint64_t id;
+        return pathIndex.find(Dentry_Key{ dir->id, name }, id) ? findById(id) : nullptr;
+    }
+
+    //  insert a new node into a directory, keeping the children ordered
+    //  (callers hold the directory's lock exclusively from here on)
+    bool insertNode(TreeNode* dir, TreeNode* newNode) {
+        if (!dir->children.insert(newNode, indexMode)) return false;
+        {
+            lock_guard<mutex> guard(layoutLock);
+            newNode->slot = layout.add(dir->slot, newNode->name, newNode->isFile, (uintptr_t)newNode);
+            layoutChanges++;
+        }
+        if (newNode->slot == Compact_Tree::NONE) {
+            dir->children.erase(newNode);       // the layout is out of room
+            return false;
+        }
+        if (!newNode->id) newNode->id = nextId++;
+        newNode->parent = dir;
+        pathIndex.emplace(Dentry_Key{ dir->id, newNode->name }, newNode->id);
+        nodesById.emplace(newNode->id, newNode);
+        names.add(newNode->id, dir->id, newNode->name);
+        return true;
+    }
+
+    //  unlink a node from its parent without deleting it
+    bool detachNode(TreeNode* node) {
+        TreeNode* dir = node->parent;
+        if (!dir || !dir->children.erase(node)) return false;
+        pathIndex.erase(Dentry_Key{ dir->id, node->name });
+        nodesById.erase(node->id);
+        names.remove(node->id);
+        {
+            lock_guard<mutex> guard(layoutLock);
+            layout.remove(node->slot);
+            node->slot = Compact_Tree::NONE;
+            layoutChanges++;
+        }
+        node->parent = nullptr;
+        return true;
+    }
+
+public:
+    FileSystemTree(Index_Mode mode = INDEX_AUTO)
+        : indexMode(mode), nextId(1), layoutChanges(0), dirLocks(new Distributed_Rw_Lock[DIR_LOCK_STRIPES]) {
+        root = new TreeNode("Root");
+        root->id = nextId++;
+        root->slot = Compact_Tree::ROOT;
+        layout.clear(root->name, (uintptr_t)root);
+        nodesById.emplace(root->id, root);
+        currentDir = root;
+    }
+
+    ~FileSystemTree() {
+        deleteTree(root);
+    }
+
+    TreeNode* getCurrentDir() const {
+        return currentDir;
+    }
+
+    // applies to directories as they grow; INDEX_FLAT never promotes
+    void setIndexMode(Index_Mode mode) {
+        indexMode = mode;
+    }
+
+    string getCurrentDirectory() const {
+        return currentDir->name;
+    }
+
+    TreeNode* getRoot() const {
+        return root;
+    }
+
+    // id -> node for anything currently linked into the tree
+    TreeNode* findById(uint64_t id) const {
+        TreeNode* node = nullptr;
+        nodesById.find(id, node);
+        return node;
+    }
+
+    Distributed_Rw_Lock& lockOf(const TreeNode* dir) const {
+        return dirLocks[Hash64::mix(dir->id) % DIR_LOCK_STRIPES];
+    }
+
+    // a direct child by name
+    TreeNode* findChild(const TreeNode* dir, const string& name) const {
+        return findNode(dir, name);
+    }
+
+    // every linked node, parents before their children, walked through the
+    // layout; visit must not link or unlink nodes
+    template <typename Visit>
+    void forEachNode(Visit visit) const {
+        lock_guard<mutex> guard(layoutLock);
+        layout.walk([&](Compact_Tree::Index index) { visit(nodeAt(layout, index)); });
+    }
+
+    // renumbers the layout in walk order, so the next walks stream through
+    // it, once enough has changed since the last time to be worth a pass
+    void packLayout() {
+        lock_guard<mutex> guard(layoutLock);
+        if (layoutChanges < layout.size() / 4) return;
+        layoutChanges = 0;
+        layout.pack();
+        layout.walk([&](Compact_Tree::Index index) { nodeAt(layout, index)->slot = index; });
+    }
+
+    // resident bytes of the layout
+    size_t layoutBytes() const {
+        lock_guard<mutex> guard(layoutLock);
+        return layout.bytes();
+    }
+
+    // rebuild a node with a known id (snapshot load / log replay).  parentId 0
+    // leaves it unlinked, which is how recycle-bin entries come back.
+    TreeNode* adoptNode(uint64_t id, uint64_t parentId, const string& name, bool isFile, const Content_Ref& content) {
+        TreeNode* node = new TreeNode(name, isFile);
+        node->id = id;
+        node->content = content;
+        if (id >= nextId.load()) nextId.store(id + 1);
+        if (parentId) {
+            TreeNode* parent = findById(parentId);
+            if (!parent || parent->isFile || !insertNode(parent, node)) {
+                discardNode(node);
+                return nullptr;
+            }
+        }
+        return node;
+    }
+
+    // "/Root/docs/report.txt"
+    string pathOf(const TreeNode* node) const {
+        vector<const string*> parts;
+        for (; node; node = node->parent) parts.push_back(&node->name);
+        string path;
+        for (size_t i = parts.size(); i-- > 0;) {
+            path += '/';
+            path += *parts[i];
+        }
+        return path;
+    }
+
+    // resolve a path like "docs/2025/report.txt", "../x" or "/Root/docs"
+    // relative paths start at the current directory
+    TreeNode* resolvePath(const string& path) const {
+        return resolvePath(path, currentDir);
+    }
+
+    // ... or at from
+    TreeNode* resolvePath(const string& path, TreeNode* from) const {
+        if (path.empty()) return nullptr;
+
+        TreeNode* node = from;
+        size_t pos = 0;
+        if (path[0] == '/') {
+            node = root;
+            pos = 1;
+            // an absolute path may spell out the root's own name
+            size_t slash = path.find('/', pos);
+            string first = path.substr(pos, slash == string::npos ? string::npos : slash - pos);
+            if (first == root->name) {
+                pos = (slash == string::npos) ? path.size() : slash + 1;
+            }
+        }
+
+        while (pos < path.size()) {
+            size_t slash = path.find('/', pos);
+            if (slash == string::npos) slash = path.size();
+            string part = path.substr(pos, slash - pos);
+            pos = slash + 1;
+
+            if (part.empty() || part == ".") continue;
+            if (part == "..") {
+                if (node->parent) node = node->parent;
+                continue;
+            }
+            node = findNode(node, part);
+            if (!node) return nullptr;
+        }
+        return node;
+    }
+
+    // the directory a path's last component lives in; leaf gets that
+    // component ("" if the path names a directory outright, e.g. "..")
+    TreeNode* resolveParent(const string& path, TreeNode* from, string& leaf) const {
+        size_t slash = path.find_last_of('/');
+        leaf = slash == string::npos ? path : path.substr(slash + 1);
+        if (leaf == "." || leaf == "..") leaf.clear();
+        if (slash == string::npos) return leaf.empty() ? nullptr : from;
+        TreeNode* dir = slash == 0 ? root : resolvePath(path.substr(0, slash), from);
+        return dir && !dir->isFile ? dir : nullptr;
+    }
+
+    // single-user only: renames aren't coordinated with readers
+    bool rename_Directory(const string& oldName, const string& newName) {
+        TreeNode* node = findNode(currentDir, oldName);
+        if (!node || node->isFile || newName.empty()) return false;
+        if (findNode(currentDir, newName)) return false;
+
+        // the name is the sort key, so move the node to its new place; it
+        // keeps its subtree, and its layout slot is renamed in place
+        currentDir->children.erase(node);
+        pathIndex.erase(Dentry_Key{ currentDir->id, node->name });
+        node->name = newName;
+        currentDir->children.insert(node, indexMode);
+        pathIndex.emplace(Dentry_Key{ currentDir->id, newName }, node->id);
+        names.add(node->id, currentDir->id, newName);
+        lock_guard<mutex> guard(layoutLock);
+        layout.rename(node->slot, newName);
+        return true;
+    }
+
+    bool changeDirectory(const string& dirName) {
+        if (dirName == "..") { // Move to parent directory
+            if (currentDir->parent) {
+                currentDir = currentDir->parent;
+                return true;
+            }
+            return false;     // already at the root
+        }
+
+        TreeNode* node = resolvePath(dirName);
+        if (node && !node->isFile) {
+            currentDir = node;
+            return true;
+        }
+        return false;
+    }
+
+    // these return null if the name is empty or already taken in currentDir
+    TreeNode* makeDirectory(const string& dirName) {
+        return makeDirectory(currentDir, dirName);
+    }
+
+    TreeNode* makeDirectory(TreeNode* dir, const string& dirName) {
+        if (dirName.empty() || findNode(dir, dirName)) return nullptr;
+
+        TreeNode* newDir = new TreeNode(dirName, false);
+        insertNode(dir, newDir);
+        return newDir;
+    }
+
+    TreeNode* createFile(const string& fileName, const string& content = "") {
+        return createFile(currentDir, fileName, content);
+    }
+
+    TreeNode* createFile(TreeNode* dir, const string& fileName, const string& content) {
+        if (fileName.empty() || findNode(dir, fileName)) return nullptr;
+
+        TreeNode* newFile = new TreeNode(fileName, true);
+        newFile->content = contentStore.store(content);
+        insertNode(dir, newFile);
+        return newFile;
+    }
+
+    // links an unlinked file (back) into dir under its own id and body
+    bool relinkFile(TreeNode* dir, TreeNode* file) {
+        if (!dir || dir->isFile || !file->isFile || file->parent || findNode(dir, file->name)) return false;
+        return insertNode(dir, file);
+    }
+
+    // a new file with the same body as source, sharing its chunks
+    TreeNode* createFileLike(const string& fileName, const TreeNode* source) {
+        return createFileLike(currentDir, fileName, source);
+    }
+
+    TreeNode* createFileLike(TreeNode* dir, const string& fileName, const TreeNode* source) {
+        if (fileName.empty() || findNode(dir, fileName)) return nullptr;
+
+        TreeNode* newFile = new TreeNode(fileName, true);
+        newFile->content = contentStore.share(source->content);
+        insertNode(dir, newFile);
+        return newFile;
+    }
+
+    string readContent(const TreeNode* file) const {
+        return contentStore.load(file->content);
+    }
+
+    // compressed form of the body, for callers that can take a frame
+    void readCompressed(const TreeNode* file, string& frame) const {
+        contentStore.loadFrame(file->content, frame);
+    }
+
+    size_t storedSizeOf(const TreeNode* file) const {
+        return contentStore.storedSize(file->content);
+    }
+
+    void setCompressionPolicy(const Compression_Policy& policy) {
+        contentStore.setPolicy(policy);
+    }
+
+    void writeContent(TreeNode* file, const string& content) {
+        Content_Ref updated = contentStore.store(content);
+        contentStore.release(file->content);
+        file->content = updated;
+    }
+
+    // frees a node that has already been unlinked (e.g. purged from the bin)
+    void discardNode(TreeNode* node) {
+        if (!node) return;
+        contentStore.release(node->content);
+        delete node;
+    }
+
+    Chunk_Store& getContentStore() {
+        return contentStore;
+    }
+
+    // only walks the children of one directory
+    void listContents(TreeNode* node = nullptr) const {
+        if (!node) node = currentDir;
+
+        node->children.forEach([](const TreeNode* child) {
+            cout << (child->isFile ? "[File] " : "[Folder] ") << child->name << endl;
+        });
+    }
+
+    TreeNode* findFile(const string& fileName) const {
+        return resolvePath(fileName);
+    }
+
+    // files and folders anywhere whose names match a glob or substring
+    vector<Name_Index::Match> findNames(const string& glob, size_t limit) const {
+        return names.search(glob, limit);
+    }
+
+    // id of the folder holding a linked node, read without touching the
+    // node, so callers can lock that folder before they look at it
+    bool parentIdOf(uint64_t id, uint64_t& parentId) const {
+        return names.parentOf(id, parentId);
+    }
+
+    // unlinks the file from its folder; the node itself now belongs to the
+    // caller (the recycle bin), which frees it when the bin is emptied
+    bool removeFile(const string& fileName) {
+        return removeFile(findFile(fileName));
+    }
+
+    bool removeFile(TreeNode* fileToRemove) {
+        if (!fileToRemove || !fileToRemove->isFile)
+            return false;
+
+        return detachNode(fileToRemove);
+    }
+};
+
+// Hash Table for File Metadata
+// Strings that many records repeat (owners, file types), each kept once for
+// the life of the program, so records hold a pointer instead of a copy.
+class Interned_Strings {
+private:
+    Open_Hash_Map<string, const string*> strings;
+    vector<unique_ptr<string>> storage;
+    Distributed_Rw_Lock lock;
+
+    static Interned_Strings& pool() {
+        static Interned_Strings shared;
+        return shared;
+    }
+
+public:
+    static const string* intern(const string& text) {
+        Interned_Strings& interned = pool();
+        {
+            shared_lock<Distributed_Rw_Lock> guard(interned.lock);
+            const string* const* known = interned.strings.find(text);
+            if (known) return *known;
+        }
+        lock_guard<Distributed_Rw_Lock> guard(interned.lock);
+        pair<const string**, bool> slot = interned.strings.emplace(text, nullptr);
+        if (slot.second) {
+            interned.storage.emplace_back(new string(text));
+            *slot.first = interned.storage.back().get();
+        }
+        return *slot.first;
+    }
+};
+
+// 56 bytes per file: the name lives on the node, owner and type are
+// interned, and times stay numeric until they are shown
+class File_Meta_data {
+public:
+    const string* type;
+    const string* owner;
+    size_t size;
+    int64_t created;        // seconds since the epoch
+    int64_t modified;
+    TreeNode* fileNode;
+    size_t storedSize;      // bytes the body takes in memory (size is the logical length)
+};
+
+// Strings numbered in order of first appearance, for columns that repeat a
+// few values over and over (owners, file types).  Not synchronized.
+class String_Dictionary {
+private:
+    vector<string> strings;
+    Open_Hash_Map<string, uint32_t> codes;
+
+public:
+    uint32_t encode(const string& text) {
+        pair<uint32_t*, bool> code = codes.emplace(text, (uint32_t)strings.size());
+        if (code.second) strings.push_back(text);
+        return *code.first;
+    }
+
+    bool find(const string& text, uint32_t& code) const {
+        const uint32_t* found = codes.find(text);
+        if (found) code = *found;
+        return found != nullptr;
+    }
+
+    const string& decode(uint32_t code) const {
+        return strings[code];
+    }
+
+    size_t size() const {
+        return strings.size();
+    }
+};
+
+// What a metadata query keeps; fields left alone keep everything
+struct Metadata_Filter {
+    string owner;                           // empty: any owner
+    string type;                            // empty: any type
+    uint64_t minSize = 0;
+    uint64_t maxSize = UINT64_MAX;
+    int64_t modifiedFrom = INT64_MIN;       // seconds since the epoch, inclusive
+    int64_t modifiedTo = INT64_MAX;
+};
+
+enum Metadata_Order {
+    ORDER_SIZE,
+    ORDER_MODIFIED,
+    ORDER_CREATED
+};
+
+struct Owner_Usage {
+    string owner;
+    size_t files;
+    uint64_t bytes;
+};
+
+// File metadata stored column by column for analytics: one dense array per
+// field, epoch timestamps, and owners and types dictionary-encoded, so a
+// query reads only the columns it tests.  Scans test a block of rows with
+// branch-free compares the compiler turns into SIMD, and large tables are
+// split across a worker pool.  Deleting a row moves the last row into it.
+class Metadata_Columns {
+public:
+    static constexpr size_t BLOCK = 4096;               // rows tested per pass
+    static constexpr size_t PARALLEL_ROWS = 1 << 18;    // smaller scans stay on the caller's thread
+
+private:
+    vector<uint64_t> fileIds;
+    vector<uint64_t> parentIds;
+    vector<uint64_t> sizes;
+    vector<int64_t> created;
+    vector<int64_t> modified;
+    vector<uint32_t> owners;
+    vector<uint32_t> types;
+    Open_Hash_Map<uint64_t, uint32_t> rowOf;
+    String_Dictionary ownerNames;
+    String_Dictionary typeNames;
+    mutable Distributed_Rw_Lock lock;
+    mutable mutex poolLock;
+    mutable unique_ptr<Worker_Pool> pool;       // started by the first scan that wants it
+
+    // A filter resolved against the dictionaries.  Ranges are kept as
+    // offset and width, so one unsigned compare tests both ends.
+    struct Bounds {
+        bool byOwner, byType, bySize, byModified;
+        uint32_t owner, type;
+        uint64_t sizeLow, sizeWidth;
+        uint64_t modifiedLow, modifiedWidth;
+    };
+
+    // timestamps shifted so signed order becomes unsigned order
+    static uint64_t unsignedTime(int64_t when) {
+        return (uint64_t)when ^ ((uint64_t)1 << 63);
+    }
+
+    // false when the filter names an owner or type no row has, or an empty range
+    bool resolve(const Metadata_Filter& filter, Bounds& bounds) const {
+        if (filter.minSize > filter.maxSize || filter.modifiedFrom > filter.modifiedTo) return false;
+        bounds.byOwner = !filter.owner.empty();
+        bounds.byType = !filter.type.empty();
+        bounds.bySize = filter.minSize > 0 || filter.maxSize < UINT64_MAX;
+        bounds.byModified = filter.modifiedFrom > INT64_MIN || filter.modifiedTo < INT64_MAX;
+        if (bounds.byOwner && !ownerNames.find(filter.owner, bounds.owner)) return false;
+        if (bounds.byType && !typeNames.find(filter.type, bounds.type)) return false;
+        bounds.sizeLow = filter.minSize;
+        bounds.sizeWidth = filter.maxSize - filter.minSize;
+        bounds.modifiedLow = unsignedTime(filter.modifiedFrom);
+        bounds.modifiedWidth = unsignedTime(filter.modifiedTo) - bounds.modifiedLow;
+        return true;
+    }
+
+    // keep[i] = 1 if row first + i passes, for count rows.  One simple loop
+    // per column the filter constrains; the others are never read.
+    void test(const Bounds& bounds, size_t first, size_t count, uint8_t* keep) const {
+        memset(keep, 1, count);
+        if (bounds.byOwner) {
+            const uint32_t* owner = owners.data() + first;
+            for (size_t i = 0; i < count; i++) keep[i] &= (uint8_t)(owner[i] == bounds.owner);
+        }
+        if (bounds.byType) {
+            const uint32_t* type = types.data() + first;
+            for (size_t i = 0; i < count; i++) keep[i] &= (uint8_t)(type[i] == bounds.type);
+        }
+        if (bounds.bySize) {
+            const uint64_t* size = sizes.data() + first;
+            for (size_t i = 0; i < count; i++) keep[i] &= (uint8_t)(size[i] - bounds.sizeLow <= bounds.sizeWidth);
+        }
+        if (bounds.byModified) {
+            const int64_t* when = modified.data() + first;
+            for (size_t i = 0; i < count; i++) {
+                keep[i] &= (uint8_t)(unsignedTime(when[i]) - bounds.modifiedLow <= bounds.modifiedWidth);
+            }
+        }
+    }
+
+    // hands visit the rows in [begin, end) that pass, a block at a time
+    template <typename Visit>
+    void select(const Bounds& bounds, size_t begin, size_t end, Visit visit) const {
+        uint8_t keep[BLOCK];
+        uint32_t rows[BLOCK];
+        for (size_t first = begin; first < end; first += BLOCK) {
+            size_t count = end - first < BLOCK ? end - first : BLOCK;
+            test(bounds, first, count, keep);
+            size_t kept = 0;
+            for (size_t i = 0; i < count; i++) {
+                rows[kept] = (uint32_t)(first + i);
+                kept += keep[i];
+            }
+            if (kept) visit(rows, kept);
+        }
+    }
+
+    size_t partsFor(size_t rows) const {
+        if (rows < PARALLEL_ROWS) return 1;
+        lock_guard<mutex> guard(poolLock);
+        if (!pool) pool.reset(new Worker_Pool());
+        size_t parts = rows / (PARALLEL_ROWS / 4);
+        return parts < pool->size() ? parts : pool->size();
+    }
+
+    // body(part, begin, end) over each of parts slices of the rows
+    template <typename Body>
+    void runParts(size_t parts, Body body) const {
+        size_t rows = fileIds.size();
+        if (parts == 1) {
+            body(0, 0, rows);
+            return;
+        }
+        mutex doneLock;
+        condition_variable done;
+        size_t remaining = parts;
+        for (size_t part = 0; part < parts; part++) {
+            pool->submit([&, part] {
+                body(part, rows * part / parts, rows * (part + 1) / parts);
+                lock_guard<mutex> guard(doneLock);
+                if (--remaining == 0) done.notify_one();
+            });
+        }
+        unique_lock<mutex> guard(doneLock);
+        done.wait(guard, [&] { return remaining == 0; });
+    }
+
+    uint64_t keyOf(Metadata_Order order, uint32_t row) const {
+        if (order == ORDER_SIZE) return sizes[row];
+        return unsignedTime(order == ORDER_MODIFIED ? modified[row] : created[row]);
+    }
+
+public:
+    Metadata_Columns() {}
+
+    Metadata_Columns(const Metadata_Columns&) = delete;
+    Metadata_Columns& operator=(const Metadata_Columns&) = delete;
+
+    // adds the file's row or overwrites it
+    void store(uint64_t fileId, const File_Meta_data& meta) {
+        uint64_t parentId = meta.fileNode && meta.fileNode->parent ? meta.fileNode->parent->id : 0;
+
+        lock_guard<Distributed_Rw_Lock> guard(lock);
+        pair<uint32_t*, bool> row = rowOf.emplace(fileId, (uint32_t)fileIds.size());
+        if (row.second) {
+            fileIds.push_back(fileId);
+            parentIds.push_back(0);
+            sizes.push_back(0);
+            created.push_back(0);
+            modified.push_back(0);
+            owners.push_back(0);
+            types.push_back(0);
+        }
+        uint32_t at = *row.first;
+        parentIds[at] = parentId;
+        sizes[at] = meta.size;
+        created[at] = meta.created;
+        modified[at] = meta.modified;
+        owners[at] = ownerNames.encode(*meta.owner);
+        types[at] = typeNames.encode(*meta.type);
+    }
+
+    void erase(uint64_t fileId) {
+        lock_guard<Distributed_Rw_Lock> guard(lock);
+        uint32_t row;
+        if (!rowOf.erase(fileId, &row)) return;
+        uint32_t last = (uint32_t)fileIds.size() - 1;
+        if (row != last) {
+            fileIds[row] = fileIds[last];
+            parentIds[row] = parentIds[last];
+            sizes[row] = sizes[last];
+            created[row] = created[last];
+            modified[row] = modified[last];
+            owners[row] = owners[last];
+            types[row] = types[last];
+            *rowOf.find(fileIds[row]) = row;
+        }
+        fileIds.pop_back();
+        parentIds.pop_back();
+        sizes.pop_back();
+        created.pop_back();
+        modified.pop_back();
+        owners.pop_back();
+        types.pop_back();
+    }
+
+    size_t size() const {
+        shared_lock<Distributed_Rw_Lock> guard(lock);
+        return fileIds.size();
+    }
+
+    size_t count(const Metadata_Filter& filter) const {
+        shared_lock<Distributed_Rw_Lock> guard(lock);
+        Bounds bounds;
+        if (!resolve(filter, bounds)) return 0;
+        size_t parts = partsFor(fileIds.size());
+        vector<size_t> counts(parts);
+        runParts(parts, [&](size_t part, size_t begin, size_t end) {
+            uint8_t keep[BLOCK];
+            size_t total = 0;
+            for (size_t first = begin; first < end; first += BLOCK) {
+                size_t rows = end - first < BLOCK ? end - first : BLOCK;
+                test(bounds, first, rows, keep);
+                for (size_t i = 0; i < rows; i++) total += keep[i];
+            }
+            counts[part] = total;
+        });
+        size_t total = 0;
+        for (size_t part : counts) total += part;
+        return total;
+    }
+
+    // Up to limit (file id, folder id) pairs that pass, ordered by order,
+    // largest or latest first unless ascending.  Each part keeps only its
+    // best limit rows as it goes, so a top-10 over millions stays small.
+    vector<pair<uint64_t, uint64_t>> top(const Metadata_Filter& filter, Metadata_Order order, size_t limit,
+        bool ascending = false) const {
+        vector<pair<uint64_t, uint64_t>> found;
+        shared_lock<Distributed_Rw_Lock> guard(lock);
+        Bounds bounds;
+        if (!limit || !resolve(filter, bounds)) return found;
+
+        // (key, row), keys inverted for descending so smaller always wins
+        typedef pair<uint64_t, uint32_t> Ranked;
+        uint64_t flip = ascending ? 0 : UINT64_MAX;
+        size_t parts = partsFor(fileIds.size());
+        vector<vector<Ranked>> best(parts);
+        auto trim = [&](vector<Ranked>& ranked) {
+            if (ranked.size() <= limit) return;
+            nth_element(ranked.begin(), ranked.begin() + (limit - 1), ranked.end());
+            ranked.resize(limit);
+        };
+        runParts(parts, [&](size_t part, size_t begin, size_t end) {
+            // once a part holds limit rows, later rows (which come after them
+            // and so lose ties) must beat the worst of those to get in
+            vector<Ranked>& ranked = best[part];
+            uint64_t cutoff = UINT64_MAX;
+            select(bounds, begin, end, [&](const uint32_t* rows, size_t count) {
+                for (size_t i = 0; i < count; i++) {
+                    uint64_t key = keyOf(order, rows[i]) ^ flip;
+                    if (key < cutoff) ranked.emplace_back(key, rows[i]);
+                }
+                if (ranked.size() >= 2 * limit + BLOCK) {
+                    trim(ranked);
+                    cutoff = ranked[limit - 1].first;
+                }
+            });
+            trim(ranked);
+        });
+
+        vector<Ranked> merged;
+        for (vector<Ranked>& ranked : best) merged.insert(merged.end(), ranked.begin(), ranked.end());
+        trim(merged);
+        sort(merged.begin(), merged.end());
+        for (const Ranked& ranked : merged) found.emplace_back(fileIds[ranked.second], parentIds[ranked.second]);
+        return found;
+    }
+
+    // files and bytes per owner among the rows that pass, most bytes first
+    vector<Owner_Usage> usageByOwner(const Metadata_Filter& filter) const {
+        vector<Owner_Usage> usage;
+        shared_lock<Distributed_Rw_Lock> guard(lock);
+        Bounds bounds;
+        if (!resolve(filter, bounds)) return usage;
+
+        size_t parts = partsFor(fileIds.size());
+        size_t owned = ownerNames.size();
+        vector<vector<uint64_t>> files(parts, vector<uint64_t>(owned)), bytes(parts, vector<uint64_t>(owned));
+        runParts(parts, [&](size_t part, size_t begin, size_t end) {
+            uint64_t* fileCount = files[part].data();
+            uint64_t* byteCount = bytes[part].data();
+            uint8_t keep[BLOCK];
+            for (size_t first = begin; first < end; first += BLOCK) {
+                size_t rows = end - first < BLOCK ? end - first : BLOCK;
+                test(bounds, first, rows, keep);
+                const uint32_t* owner = owners.data() + first;
+                const uint64_t* size = sizes.data() + first;
+                for (size_t i = 0; i < rows; i++) {
+                    fileCount[owner[i]] += keep[i];
+                    byteCount[owner[i]] += size[i] & (0 - (uint64_t)keep[i]);
+                }
+            }
+        });
+
+        for (uint32_t owner = 0; owner < owned; owner++) {
+            Owner_Usage total{ ownerNames.decode(owner), 0, 0 };
+            for (size_t part = 0; part < parts; part++) {
+                total.files += (size_t)files[part][owner];
+                total.bytes += bytes[part][owner];
+            }
+            if (total.files) usage.push_back(total);
+        }
+        sort(usage.begin(), usage.end(), [](const Owner_Usage& a, const Owner_Usage& b) {
+            return a.bytes != b.bytes ? a.bytes > b.bytes : a.owner < b.owner;
+        });
+        return usage;
+    }
+};
+
+// file metadata table keyed by TreeNode::id, so two "report.txt" files in
+// different folders never share an entry; owns the File_Meta_data it holds
+// Sharded so sessions looking up different files rarely meet on a lock.
+// The records themselves are guarded by their file's directory lock.
+// Every record in the table also has a row in the query columns; callers
+// that change a record in place refresh() it.
+class HashTable {
+private:
+    Sharded_Map<uint64_t, File_Meta_data*> table;
+    Metadata_Columns columns;
+
+public:
+    HashTable() {}
+
+    ~HashTable() {
+        table.forEach([](uint64_t, File_Meta_data* value) { delete value; });
+    }
+
+    void insert(uint64_t key, File_Meta_data* value) {
+        File_Meta_data* replaced = nullptr;
+        if (table.assign(key, value, &replaced)) delete replaced;
+        columns.store(key, *value);
+    }
+
+    // copies a record changed in place into the query columns
+    void refresh(uint64_t key) {
+        File_Meta_data* value = search(key);
+        if (value) columns.store(key, *value);
+    }
+
+    File_Meta_data* search(uint64_t key) const {
+        File_Meta_data* value = nullptr;
+        table.find(key, value);
+        return value;
+    }
+
+    void remove(uint64_t key) {
+        File_Meta_data* value = nullptr;
+        if (table.erase(key, &value)) {
+            columns.erase(key);
+            delete value;
+        }
+    }
+
+    // takes the entry out and hands ownership to the caller
+    File_Meta_data* detach(uint64_t key) {
+        File_Meta_data* value = nullptr;
+        if (table.erase(key, &value)) columns.erase(key);
+        return value;
+    }
+
+    size_t size() const {
+        return table.size();
+    }
+
+    void reserve(size_t count) {
+        table.reserve(count);
+    }
+
+    double loadFactor() const {
+        return table.capacity() ? (double)table.size() / table.capacity() : 0.0;
+    }
+
+    const Metadata_Columns& query() const {
+        return columns;
+    }
+
+    template <typename Visit>
+    void forEach(Visit visit) const {
+        table.forEach([&](uint64_t key, File_Meta_data* value) { visit(key, value); });
+    }
+};
+
+// A file waiting in the recycle bin.  It keeps the unlinked node itself,
+// its metadata and the folder it came from, so restoring it is a relink.
+struct Bin_Entry {
+    TreeNode* file;
+    File_Meta_data* meta;       // null for files binned by older drives
+    uint64_t parentId;          // 0 if unknown: restores into the root
+    int64_t deletedAt;          // seconds since the epoch
+};
+
+// Recycle Bin, indexed three ways: by file id for selective restore, by
+// name (newest deletion first within a name) and by deletion time, oldest
+// first, so retention purges take from the front.  The bin owns the nodes
+// and metadata it holds until they are taken back out.
+class Recycle_Bin {
+private:
+    struct Name_Key {
+        const string* name;     // the file's own name
+        uint64_t order;         // ~sequence, so newer deletions sort first
+
+        bool operator<(const Name_Key& other) const {
+            int cmp = name->compare(*other.name);
+            return cmp ? cmp < 0 : order < other.order;
+        }
+    };
+
+    struct Time_Key {
+        int64_t deletedAt;
+        uint64_t sequence;      // ties go to the earlier deletion
+
+        bool operator<(const Time_Key& other) const {
+            return deletedAt != other.deletedAt ? deletedAt < other.deletedAt : sequence < other.sequence;
+        }
+    };
+
+    struct BinNode {
+        Bin_Entry entry;
+        Name_Key byName;
+        Time_Key byTime;
+
+        static void* operator new(size_t size) { return Node_Pool<BinNode>::get("BinNode").allocate(size); }
+        static void operator delete(void* block, size_t size) { Node_Pool<BinNode>::get("BinNode").release(block, size); }
+    };
+
+    struct By_Name {
+        typedef Name_Key Key;
+        static const Key& get(const BinNode* node) { return node->byName; }
+    };
+
+    struct By_Time {
+        typedef Time_Key Key;
+        static const Key& get(const BinNode* node) { return node->byTime; }
+    };
+
+    Open_Hash_Map<uint64_t, BinNode*> byId;
+    Balanced_Index<BinNode*, By_Name> byName;
+    Balanced_Index<BinNode*, By_Time> byTime;
+    uint64_t nextSequence;
+
+public:
+    Recycle_Bin() : nextSequence(1) {}
+
+    ~Recycle_Bin() {
+        byId.forEach([](uint64_t, BinNode* node) {
+            delete node->entry.meta;
+            delete node->entry.file;
+            delete node;
+        });
+    }
+
+    Recycle_Bin(const Recycle_Bin&) = delete;
+    Recycle_Bin& operator=(const Recycle_Bin&) = delete;
+
+    // takes ownership of file and meta; false if the id is already binned
+    bool push(TreeNode* file, File_Meta_data* meta, uint64_t parentId, int64_t deletedAt) {
+        BinNode* node = new BinNode{ Bin_Entry{ file, meta, parentId, deletedAt },
+            Name_Key{ &file->name, ~nextSequence }, Time_Key{ deletedAt, nextSequence } };
+        if (!byId.emplace(file->id, node).second) {
+            delete node;
+            return false;
+        }
+        nextSequence++;
+        byName.insert(node);
+        byTime.insert(node);
+        return true;
+    }
+
+    const Bin_Entry* find(uint64_t fileId) const {
+        BinNode* const* node = byId.find(fileId);
+        return node ? &(*node)->entry : nullptr;
+    }
+
+    // the most recent deletion of a file with this name
+    const Bin_Entry* newestNamed(const string& name) const {
+        BinNode** node = byName.lowerBound(Name_Key{ &name, 0 });
+        return node && (*node)->entry.file->name == name ? &(*node)->entry : nullptr;
+    }
+
+    const Bin_Entry* newest() const {
+        BinNode** node = byTime.last();
+        return node ? &(*node)->entry : nullptr;
+    }
+
+    const Bin_Entry* oldest() const {
+        BinNode** node = byTime.first();
+        return node ? &(*node)->entry : nullptr;
+    }
+
+    // removes the entry from every index; the node and metadata are the caller's again
+    bool take(uint64_t fileId, Bin_Entry& entry) {
+        BinNode* node = nullptr;
+        if (!byId.erase(fileId, &node)) return false;
+        byName.erase(node->byName);
+        byTime.erase(node->byTime);
+        entry = std::move(node->entry);
+        delete node;
+        return true;
+    }
+
+    size_t size() const { return byId.size(); }
+    bool isEmpty() const { return byId.empty(); }
+
+    // oldest deletion first
+    template <typename Visit>
+    void forEach(Visit visit) const {
+        byTime.forEach([&](const BinNode* node) { visit(node->entry); });
+    }
+
+    void display() const {
+        if (isEmpty()) {
+            cout << "Recycle Bin is empty.\n";
+            return;
+        }
+        cout << "Recycle Bin contents:\n";
+        forEach([](const Bin_Entry& entry) {
+            cout << "- " << entry.file->name << " (Deleted at: " << formatTime(entry.deletedAt) << ")\n";
+        });
+    }
+};
+
+// Files a user touched most recently, newest first.  The list is bounded:
+// touching a listed file moves it to the front, touching a new one when
+// full evicts the oldest.  Entries are keyed by file id and keep a copy of
+// the name, so nothing here points into the tree.
+class Recent_Files_Lru {
+private:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    struct Entry {
+        uint64_t fileId;
+        string name;
+        uint32_t prev;      // toward the newest
+        uint32_t next;      // toward the oldest
+    };
+
+    vector<Entry> entries;                  // never grows past limit
+    Open_Hash_Map<uint64_t, uint32_t> slotOf;
+    uint32_t head;
+    uint32_t tail;
+    size_t limit;
+    mutable mutex lock;     // a user may have several sessions at once
+
+    void unlink(uint32_t slot) {
+        Entry& entry = entries[slot];
+        if (entry.prev != NONE) entries[entry.prev].next = entry.next;
+        else head = entry.next;
+        if (entry.next != NONE) entries[entry.next].prev = entry.prev;
+        else tail = entry.prev;
+    }
+
+    void pushFront(uint32_t slot) {
+        Entry& entry = entries[slot];
+        entry.prev = NONE;
+        entry.next = head;
+        if (head != NONE) entries[head].prev = slot;
+        head = slot;
+        if (tail == NONE) tail = slot;
+    }
+
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 16;
+
+    Recent_Files_Lru() : Recent_Files_Lru(DEFAULT_CAPACITY) {}
+
+    // nothing is allocated until the first touch: most accounts are idle
+    explicit Recent_Files_Lru(size_t capacity)
+        : head(NONE), tail(NONE), limit(capacity ? capacity : 1) {
+    }
+
+    Recent_Files_Lru(const Recent_Files_Lru&) = delete;
+    Recent_Files_Lru& operator=(const Recent_Files_Lru&) = delete;
+
+    void touch(uint64_t fileId, const string& name) {
+        lock_guard<mutex> guard(lock);
+        if (entries.empty()) {
+            entries.reserve(limit);
+            slotOf.reserve(limit);      // sized once, so the map never resizes either
+        }
+        uint32_t slot;
+        uint32_t* found = slotOf.find(fileId);
+        if (found) {
+            slot = *found;
+            unlink(slot);
+        }
+        else if (entries.size() < limit) {
+            slot = (uint32_t)entries.size();
+            entries.push_back(Entry{ fileId, string(), NONE, NONE });
+            slotOf.emplace(fileId, slot);
+        }
+        else {
+            // full: the oldest entry's slot is reused for the new file
+            slot = tail;
+            unlink(slot);
+            slotOf.erase(entries[slot].fileId);
+            entries[slot].fileId = fileId;
+            slotOf.emplace(fileId, slot);
+        }
+        entries[slot].name = name;      // the file may have been renamed since
+        pushFront(slot);
+    }
+
+    // drops the file if listed; the last slot moves into the hole, so the
+    // slots in use stay packed at the front
+    void forget(uint64_t fileId) {
+        lock_guard<mutex> guard(lock);
+        uint32_t slot;
+        if (!slotOf.erase(fileId, &slot)) return;
+        unlink(slot);
+        uint32_t last = (uint32_t)entries.size() - 1;
+        if (slot != last) {
+            Entry& moved = entries[slot];
+            moved = std::move(entries[last]);
+            if (moved.prev != NONE) entries[moved.prev].next = slot;
+            else head = slot;
+            if (moved.next != NONE) entries[moved.next].prev = slot;
+            else tail = slot;
+            *slotOf.find(moved.fileId) = slot;
+        }
+        entries.pop_back();
+    }
+
+    void clear() {
+        lock_guard<mutex> guard(lock);
+        entries.clear();
+        slotOf.clear();
+        head = tail = NONE;
+    }
+
+    size_t size() const {
+        lock_guard<mutex> guard(lock);
+        return entries.size();
+    }
+
+    size_t capacity() const { return limit; }
+
+    // newest first; visit must not touch this list
+    template <typename Visit>
+    void forEach(Visit visit) const {
+        lock_guard<mutex> guard(lock);
+        for (uint32_t slot = head; slot != NONE; slot = entries[slot].next) {
+            visit(entries[slot].fileId, entries[slot].name);
+        }
+    }
+};
+// SHA-256 (FIPS 180-4), for password hashes
+class Sha256 {
+public:
+    static constexpr size_t DIGEST = 32;
+
+private:
+    uint32_t state[8];
+    unsigned char block[64];
+    size_t buffered;
+    uint64_t total;
+
+    static uint32_t rotr(uint32_t x, int bits) { return (x >> bits) | (x << (32 - bits)); }
+
+    void compress(const unsigned char* data) {
+        static const uint32_t K[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2 };
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++) {
+            w[i] = (uint32_t)data[4 * i] << 24 | (uint32_t)data[4 * i + 1] << 16 | (uint32_t)data[4 * i + 2] << 8 | data[4 * i + 3];
+        }
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+
+public:
+    Sha256() : state{ 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 },
+        buffered(0), total(0) {
+    }
+
+    void update(const void* data, size_t length) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        total += length;
+        while (length) {
+            size_t take = 64 - buffered < length ? 64 - buffered : length;
+            memcpy(block + buffered, bytes, take);
+            buffered += take;
+            bytes += take;
+            length -= take;
+            if (buffered == 64) {
+                compress(block);
+                buffered = 0;
+            }
+        }
+    }
+
+    void finish(unsigned char digest[DIGEST]) {
+        uint64_t bits = total * 8;
+        unsigned char pad = 0x80;
+        update(&pad, 1);
+        pad = 0;
+        while (buffered != 56) update(&pad, 1);
+        unsigned char length[8];
+        for (int i = 0; i < 8; i++) length[i] = (unsigned char)(bits >> (56 - 8 * i));
+        update(length, 8);
+        for (int i = 0; i < 8; i++) {
+            for (int j = 0; j < 4; j++) digest[4 * i + j] = (unsigned char)(state[i] >> (24 - 8 * j));
+        }
+    }
+};
+
+// bytes from the operating system's CSPRNG; false if it can't be reached
+bool secureRandom(void* out, size_t length) {
+#ifdef _WIN32
+    return BCryptGenRandom(nullptr, static_cast<PUCHAR>(out), (ULONG)length, BCRYPT_USE_SYSTEM_PREFERRED_RNG) >= 0;
+#else
+    static int source = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    unsigned char* bytes = static_cast<unsigned char*>(out);
+    while (source >= 0 && length) {
+        ssize_t got = read(source, bytes, length);
+        if (got <= 0) return false;
+        bytes += got;
+        length -= (size_t)got;
+    }
+    return source >= 0;
+#endif
+}
+
+// A salted, stretched hash of a password or security answer: the digest is
+// SHA-256 over salt and secret, fed back into itself rounds times.  Only
+// this is kept or written anywhere, never the secret.
+struct Secret_Hash {
+    static constexpr size_t SALT = 16;
+    static constexpr uint32_t DEFAULT_ROUNDS = 4096;
+    static constexpr size_t BYTES = SALT + 4 + Sha256::DIGEST;
+
+    unsigned char salt[SALT];
+    uint32_t rounds;
+    unsigned char digest[Sha256::DIGEST];
+
+    // a fresh random salt; false if the system has no randomness to give
+    static bool make(const string& secret, uint32_t rounds, Secret_Hash& hash) {
+        if (!secureRandom(hash.salt, SALT)) return false;
+        hash.rounds = rounds ? rounds : 1;
+        hash.derive(secret, hash.digest);
+        return true;
+    }
+
+    bool matches(const string& secret) const {
+        unsigned char candidate[Sha256::DIGEST];
+        derive(secret, candidate);
+        unsigned char differ = 0;       // no early exit, so timing doesn't leak a prefix
+        for (size_t i = 0; i < Sha256::DIGEST; i++) differ |= candidate[i] ^ digest[i];
+        return differ == 0;
+    }
+
+    // salt, rounds (little endian), digest: how snapshots and the log hold it
+    string bytes() const {
+        string out((const char*)salt, SALT);
+        for (int i = 0; i < 4; i++) out += (char)(rounds >> (8 * i));
+        out.append((const char*)digest, Sha256::DIGEST);
+        return out;
+    }
+
+    static bool parse(const string& bytes, Secret_Hash& hash) {
+        if (bytes.size() != BYTES) return false;
+        memcpy(hash.salt, bytes.data(), SALT);
+        hash.rounds = 0;
+        for (int i = 0; i < 4; i++) hash.rounds |= (uint32_t)(unsigned char)bytes[SALT + i] << (8 * i);
+        memcpy(hash.digest, bytes.data() + SALT + 4, Sha256::DIGEST);
+        return hash.rounds != 0;
+    }
+
+private:
+    void derive(const string& secret, unsigned char out[Sha256::DIGEST]) const {
+        Sha256 first;
+        first.update(salt, SALT);
+        first.update(secret.data(), secret.size());
+        first.finish(out);
+        for (uint32_t i = 1; i < rounds; i++) {
+            Sha256 next;
+            next.update(out, Sha256::DIGEST);
+            next.update(salt, SALT);
+            next.update(secret.data(), secret.size());
+            next.finish(out);
+        }
+    }
+};
+
+// A session token: 128 bits from the OS CSPRNG, so one can't be guessed or
+// predicted from others.  All zero means "no token".
+struct Session_Token {
+    uint64_t hi = 0;
+    uint64_t lo = 0;
+
+    bool empty() const { return !hi && !lo; }
+    bool operator==(const Session_Token& other) const { return hi == other.hi && lo == other.lo; }
+
+    // 32 hex digits, as batch output shows it
+    string hex() const {
+        char text[33];
+        snprintf(text, sizeof(text), "%016llx%016llx", (unsigned long long)hi, (unsigned long long)lo);
+        return text;
+    }
+
+    // the empty token unless text is exactly 32 hex digits
+    static Session_Token parse(const string& text) {
+        Session_Token token;
+        if (text.size() != 32 || text.find_first_not_of("0123456789abcdefABCDEF") != string::npos) return token;
+        token.hi = strtoull(text.substr(0, 16).c_str(), nullptr, 16);
+        token.lo = strtoull(text.substr(16).c_str(), nullptr, 16);
+        return token;
+    }
+};
+
+struct Session_Token_Hash {
+    uint64_t operator()(const Session_Token& token) const { return Hash64::mix(token.lo ^ Hash64::mix(token.hi)); }
+};
+
+// User directory.  Accounts are kept in uid order (a uid is the account's
+// position and is never reused) behind a sharded hash index on userId, so
+// lookups are O(1) and run concurrently.  A login hands out a token that
+// maps straight back to the account, so later requests skip the password
+// check.  Passwords and security answers are only kept as Secret_Hash.
+// Adding users and resetting passwords are serialized by the caller.
+class User_Graph {
+public:
+    struct UserNode {
+        uint32_t uid;
+        string userId;
+        atomic<const Secret_Hash*> password;    // swapped whole on a reset, so logins need no lock
+        string securityQuestion;
+        Secret_Hash securityAnswer;
+        atomic<int64_t> lastLogin;      // seconds since the epoch, 0 = never
+        atomic<int64_t> lastLogout;
+        Recent_Files_Lru recentFiles;   // shared by all of the user's sessions
+
+        UserNode(uint32_t id, const string& user, const Secret_Hash& pass, const string& question, const Secret_Hash& answer)
+            : uid(id), userId(user), password(new Secret_Hash(pass)), securityQuestion(question), securityAnswer(answer),
+              lastLogin(0), lastLogout(0) {
+        }
+
+        ~UserNode() { delete password.load(); }
+
+        static void* operator new(size_t size) { return Node_Pool<UserNode>::get("UserNode").allocate(size); }
+        static void operator delete(void* block, size_t size) { Node_Pool<UserNode>::get("UserNode").release(block, size); }
+    };
+
+private:
+    vector<UserNode*> users;                    // by uid
+    Sharded_Map<string, UserNode*> byUserId;
+    Sharded_Map<Session_Token, UserNode*, Session_Token_Hash> tokens;     // live session tokens
+    vector<const Secret_Hash*> retired;         // replaced password hashes a login may still be reading
+    uint32_t hashRounds;
+
+public:
+    explicit User_Graph(uint32_t rounds = Secret_Hash::DEFAULT_ROUNDS) : hashRounds(rounds) {}
+
+    ~User_Graph() {
+        for (UserNode* user : users) delete user;
+        for (const Secret_Hash* hash : retired) delete hash;
+    }
+
+    User_Graph(const User_Graph&) = delete;
+    User_Graph& operator=(const User_Graph&) = delete;
+
+    UserNode* findUser(const string& userId) const {
+        UserNode* user = nullptr;
+        byUserId.find(userId, user);
+        return user;
+    }
+
+    size_t userCount() const { return users.size(); }
+
+    // not safe against a concurrent addUser
+    UserNode* userAt(uint32_t uid) const {
+        return uid < users.size() ? users[uid] : nullptr;
+    }
+
+    void reserve(size_t count) {
+        users.reserve(count);
+        byUserId.reserve(count);
+    }
+
+    // oldest account first; not safe against a concurrent addUser
+    template <typename Visit>
+    void forEachUser(Visit visit) const {
+        for (UserNode* user : users) visit(user);
+    }
+
+    // hashes the password and answer; false if the id is taken
+    bool addUser(const string& userId, const string& password, const string& question, const string& answer) {
+        Secret_Hash passwordHash, answerHash;
+        if (findUser(userId) || !Secret_Hash::make(password, hashRounds, passwordHash)
+            || !Secret_Hash::make(answer, hashRounds, answerHash)) {
+            return false;
+        }
+        return addUser(userId, passwordHash, question, answerHash);
+    }
+
+    // an account whose secrets are already hashed (snapshot load, log replay)
+    bool addUser(const string& userId, const Secret_Hash& password, const string& question, const Secret_Hash& answer) {
+        UserNode* newUser = new UserNode((uint32_t)users.size(), userId, password, question, answer);
+        if (!byUserId.emplace(userId, newUser)) {
+            delete newUser;
+            return false;
+        }
+        users.push_back(newUser);
+        return true;
+    }
+
+    UserNode* authenticate(const string& userId, const string& password) {
+        UserNode* user = findUser(userId);
+        if (user && user->password.load()->matches(password)) {
+            user->lastLogin = (int64_t)time(0);
+            return user;
+        }
+        return nullptr;
+    }
+
+    // a new password for the account; hash receives what was stored
+    bool resetPassword(UserNode* user, const string& password, Secret_Hash& hash) {
+        if (!user || !Secret_Hash::make(password, hashRounds, hash)) return false;
+        setPassword(user, hash);
+        return true;
+    }
+
+    void setPassword(UserNode* user, const Secret_Hash& hash) {
+        retired.push_back(user->password.exchange(new Secret_Hash(hash)));
+    }
+
+    // a fresh token for a logged-in user; empty only if the system has no
+    // randomness to give
+    Session_Token issueToken(UserNode* user) {
+        Session_Token token;
+        do {
+            if (!secureRandom(&token, sizeof(token))) return Session_Token();
+        } while (token.empty() || !tokens.emplace(token, user));
+        return token;
+    }
+
+    UserNode* validateToken(const Session_Token& token) const {
+        UserNode* user = nullptr;
+        if (!token.empty()) tokens.find(token, user);
+        return user;
+    }
+
+    void revokeToken(const Session_Token& token) {
+        tokens.erase(token);
+    }
+
+    size_t liveTokens() const { return tokens.size(); }
+
+    void logout(UserNode* user) {
+        if (user) {
+            user->lastLogout = (int64_t)time(0);
+        }
+    }
+};
+
+enum Share_Permission : uint8_t {
+    SHARE_VIEW = 1,
+    SHARE_EDIT = 2,
+    SHARE_MANAGE = 4,       // may change who the node is shared with; never granted, only owned
+};
+
+// "view" or "edit" (which includes view) as permission bits; 0 if neither
+uint8_t parsePermission(const string& text) {
+    if (text == "view") return SHARE_VIEW;
+    if (text == "edit") return SHARE_VIEW | SHARE_EDIT;
+    return 0;
+}
+
+const char* permissionName(uint8_t permissions) {
+    return (permissions & SHARE_EDIT) ? "edit" : "view";
+}
+
+struct Node_User_Key {
+    uint64_t nodeId = 0;
+    uint32_t uid = 0;
+
+    bool operator==(const Node_User_Key& other) const { return nodeId == other.nodeId && uid == other.uid; }
+};
+
+struct Node_User_Hash {
+    uint64_t operator()(const Node_User_Key& key) const {
+        return Hash64::mix(key.nodeId * 0x9E3779B97F4A7C15ULL ^ key.uid);
+    }
+};
+
+// Who may see whose files and folders.  Every grant is an edge (node,
+// granting user, grantee, permission bits) threaded onto three intrusive
+// lists, one per node, per granting user and per grantee, so each side's
+// grants are walked without a scan.  A hash index on (node, grantee) makes
+// lookup, grant and revoke O(1).  Access checks read it on every request, so
+// readers share the lock.
+class Share_Graph {
+public:
+    struct Grant {
+        uint64_t nodeId;
+        uint32_t owner;         // uids; owner is whoever granted it
+        uint32_t grantee;
+        uint8_t permissions;
+    };
+
+private:
+    static constexpr uint32_t NONE = UINT32_MAX;
+    enum { BY_NODE, BY_OWNER, BY_GRANTEE, LISTS };
+
+    struct Edge {
+        Grant grant;
+        uint32_t prev[LISTS];
+        uint32_t next[LISTS];   // next[BY_NODE] also chains free edges
+    };
+
+    vector<Edge> edges;
+    uint32_t freeEdges;
+    size_t count;
+    Open_Hash_Map<Node_User_Key, uint32_t, Node_User_Hash> byPair;
+    Open_Hash_Map<uint64_t, uint32_t> nodeHeads;
+    vector<uint32_t> ownerHeads;        // by uid
+    vector<uint32_t> granteeHeads;
+    mutable Distributed_Rw_Lock lock;
+
+    static uint32_t& slotFor(vector<uint32_t>& heads, uint32_t uid) {
+        if (uid >= heads.size()) heads.resize(uid + 1, NONE);
+        return heads[uid];
+    }
+
+    uint32_t headOf(int list, const Grant& grant) const {
+        if (list == BY_NODE) {
+            const uint32_t* head = nodeHeads.find(grant.nodeId);
+            return head ? *head : NONE;
+        }
+        const vector<uint32_t>& heads = list == BY_OWNER ? ownerHeads : granteeHeads;
+        uint32_t uid = list == BY_OWNER ? grant.owner : grant.grantee;
+        return uid < heads.size() ? heads[uid] : NONE;
+    }
+
+    void setHead(int list, const Grant& grant, uint32_t edge) {
+        if (list == BY_NODE) {
+            if (edge == NONE) nodeHeads.erase(grant.nodeId);
+            else *nodeHeads.emplace(grant.nodeId, edge).first = edge;
+        }
+        else if (list == BY_OWNER) slotFor(ownerHeads, grant.owner) = edge;
+        else slotFor(granteeHeads, grant.grantee) = edge;
+    }
+
+    void link(uint32_t index) {
+        Edge& edge = edges[index];
+        for (int list = 0; list < LISTS; list++) {
+            uint32_t head = headOf(list, edge.grant);
+            edge.prev[list] = NONE;
+            edge.next[list] = head;
+            if (head != NONE) edges[head].prev[list] = index;
+            setHead(list, edge.grant, index);
+        }
+    }
+
+    void unlink(uint32_t index) {
+        Edge& edge = edges[index];
+        for (int list = 0; list < LISTS; list++) {
+            if (edge.prev[list] != NONE) edges[edge.prev[list]].next[list] = edge.next[list];
+            else setHead(list, edge.grant, edge.next[list]);
+            if (edge.next[list] != NONE) edges[edge.next[list]].prev[list] = edge.prev[list];
+        }
+    }
+
+    void release(uint32_t index) {
+        unlink(index);
+        byPair.erase(Node_User_Key{ edges[index].grant.nodeId, edges[index].grant.grantee });
+        edges[index].next[BY_NODE] = freeEdges;
+        freeEdges = index;
+        count--;
+    }
+
+    template <typename Visit>
+    void walk(int list, uint32_t from, Visit visit) const {
+        for (uint32_t index = from; index != NONE; index = edges[index].next[list]) visit(edges[index].grant);
+    }
+
+public:
+    Share_Graph() : freeEdges(NONE), count(0) {}
+
+    Share_Graph(const Share_Graph&) = delete;
+    Share_Graph& operator=(const Share_Graph&) = delete;
+
+    // grants or replaces grantee's permissions on the node
+    void grant(uint64_t nodeId, uint32_t owner, uint32_t grantee, uint8_t permissions) {
+        lock_guard<Distributed_Rw_Lock> guard(lock);
+        pair<uint32_t*, bool> slot = byPair.emplace(Node_User_Key{ nodeId, grantee }, NONE);
+        if (!slot.second) {
+            Grant& existing = edges[*slot.first].grant;
+            existing.permissions = permissions;
+            if (existing.owner != owner) {      // someone else re-granted it: move the edge between owners
+                unlink(*slot.first);
+                existing.owner = owner;
+                link(*slot.first);
+            }
+            return;
+        }
+        uint32_t index = freeEdges;
+        if (index != NONE) freeEdges = edges[index].next[BY_NODE];
+        else {
+            index = (uint32_t)edges.size();
+            edges.emplace_back();
+        }
+        *slot.first = index;
+        edges[index].grant = Grant{ nodeId, owner, grantee, permissions };
+        link(index);
+        count++;
+    }
+
+    bool revoke(uint64_t nodeId, uint32_t grantee) {
+        lock_guard<Distributed_Rw_Lock> guard(lock);
+        const uint32_t* index = byPair.find(Node_User_Key{ nodeId, grantee });
+        if (!index) return false;
+        release(*index);
+        return true;
+    }
+
+    // drops every grant on the node, for nodes that are gone for good
+    size_t revokeNode(uint64_t nodeId) {
+        lock_guard<Distributed_Rw_Lock> guard(lock);
+        size_t revoked = 0;
+        const uint32_t* head;
+        while ((head = nodeHeads.find(nodeId)) != nullptr) {
+            release(*head);
+            revoked++;
+        }
+        return revoked;
+    }
+
+    // grantee's own permission bits on the node, not counting its folders
+    uint8_t permissionsOf(uint64_t nodeId, uint32_t grantee) const {
+        shared_lock<Distributed_Rw_Lock> guard(lock);
+        const uint32_t* index = byPair.find(Node_User_Key{ nodeId, grantee });
+        return index ? edges[*index].grant.permissions : 0;
+    }
+
+    size_t size() const {
+        shared_lock<Distributed_Rw_Lock> guard(lock);
+        return count;
+    }
+
+    // The walks hold the lock shared; visit(const Grant&) must not call back in.
+    template <typename Visit>
+    void forEachOnNode(uint64_t nodeId, Visit visit) const {
+        shared_lock<Distributed_Rw_Lock> guard(lock);
+        const uint32_t* head = nodeHeads.find(nodeId);
+        if (head) walk(BY_NODE, *head, visit);
+    }
+
+    template <typename Visit>
+    void forEachSharedBy(uint32_t owner, Visit visit) const {
+        shared_lock<Distributed_Rw_Lock> guard(lock);
+        if (owner < ownerHeads.size()) walk(BY_OWNER, ownerHeads[owner], visit);
+    }
+
+    template <typename Visit>
+    void forEachSharedWith(uint32_t grantee, Visit visit) const {
+        shared_lock<Distributed_Rw_Lock> guard(lock);
+        if (grantee < granteeHeads.size()) walk(BY_GRANTEE, granteeHeads[grantee], visit);
+    }
+
+    template <typename Visit>
+    void forEach(Visit visit) const {
+        shared_lock<Distributed_Rw_Lock> guard(lock);
+        nodeHeads.forEach([&](uint64_t, uint32_t head) { walk(BY_NODE, head, visit); });
+    }
+};
+
+// Folder ACLs with inheritance.  A user's effective rights on a node are the
+// union of their grants on it and on every folder above it, and creating a
+// folder gives full rights to everything under it.  Resolving walks up to
+// the root, so results are cached per (user, node), stamped with the epoch
+// they were computed in; every ACL change bumps the epoch, which retires the
+// whole cache at once, and a warm check is one hash probe however deep the
+// node sits.  Folders never change parent, so the walk reads parent links
+// without locks; callers keep the node itself from being unlinked.  A file
+// restored from the bin may land under a different folder, so whoever links
+// a node under a new parent calls relinked() to retire what was cached for
+// its old path.
+class Access_Control {
+public:
+    static constexpr uint32_t NO_OWNER = UINT32_MAX;
+    static constexpr size_t CACHE_LIMIT = (size_t)1 << 20;     // entries kept before starting over
+
+private:
+    struct Cached_Rights {
+        uint64_t epoch = 0;
+        uint8_t permissions = 0;
+    };
+
+    Share_Graph grants;
+    Sharded_Map<uint64_t, uint32_t> folderOwners;      // folder id -> creator's uid
+    Sharded_Map<Node_User_Key, Cached_Rights, Node_User_Hash> cache;
+    atomic<uint64_t> epoch;
+    atomic<size_t> cached;
+
+    uint8_t resolve(const TreeNode* node, uint32_t uid) const {
+        uint8_t rights = 0;
+        // unlocked: a parent link only changes when a binned file is
+        // relinked, and that bumps the epoch after the link is visible
+        for (; node; node = node->parent) {
+            uint32_t owner;
+            if (!node->isFile && folderOwners.find(node->id, owner) && owner == uid) {
+                return SHARE_VIEW | SHARE_EDIT | SHARE_MANAGE;
+            }
+            rights |= grants.permissionsOf(node->id, uid);
+        }
+        return rights;
+    }
+
+    // called after the change is visible, so a reader that sees the new
+    // epoch also sees the change
+    void changed() { epoch.fetch_add(1, memory_order_release); }
+
+public:
+    Access_Control() : epoch(1), cached(0) {}
+
+    Access_Control(const Access_Control&) = delete;
+    Access_Control& operator=(const Access_Control&) = delete;
+
+    const Share_Graph& shares() const { return grants; }
+
+    uint8_t effective(const TreeNode* node, uint32_t uid) {
+        uint64_t now = epoch.load(memory_order_acquire);
+        Node_User_Key key{ node->id, uid };
+        Cached_Rights hit;
+        if (cache.find(key, hit) && hit.epoch == now) return hit.permissions;
+
+        Cached_Rights computed;
+        computed.epoch = now;
+        computed.permissions = resolve(node, uid);
+        if (!cache.assign(key, computed) && cached.fetch_add(1) >= CACHE_LIMIT) {
+            cache.clear();
+            cached = 0;
+        }
+        return computed.permissions;
+    }
+
+    // a new folder has nothing cached under it, so this leaves the epoch alone
+    void adoptFolder(uint64_t folderId, uint32_t owner) { folderOwners.assign(folderId, owner); }
+
+    uint32_t folderOwner(uint64_t folderId) const {
+        uint32_t owner = NO_OWNER;
+        folderOwners.find(folderId, owner);
+        return owner;
+    }
+
+    void grant(uint64_t nodeId, uint32_t owner, uint32_t grantee, uint8_t permissions) {
+        grants.grant(nodeId, owner, grantee, permissions);
+        changed();
+    }
+
+    bool revoke(uint64_t nodeId, uint32_t grantee) {
+        if (!grants.revoke(nodeId, grantee)) return false;
+        changed();
+        return true;
+    }
+
+    void forget(uint64_t nodeId) {
+        if (grants.revokeNode(nodeId)) changed();
+    }
+
+    // a node now sits under a different parent, so rights it inherited are stale
+    void relinked() { changed(); }
+
+    size_t cacheSize() const { return cache.size(); }
+
+    template <typename Visit>
+    void forEachFolderOwner(Visit visit) const { folderOwners.forEach(visit); }
+};
+
+enum Access_Op : uint8_t {
+    ACCESS_READ,
+    ACCESS_WRITE,       // created or edited
+    ACCESS_DELETE,
+};
+
+// One file access, as published by the operation that made it.  Users are
+// never freed while the drive runs, so the user pointer stays valid.
+struct Access_Event {
+    uint64_t fileId;
+    User_Graph::UserNode* user;
+    uint64_t timestamp;     // nanoseconds since the epoch
+    Access_Op op;
+};
+
+// Bounded lock-free ring of access events: any number of request threads
+// publish, one consumer drains.  Each cell carries a sequence number that
+// tells producers when it is free and the consumer when it is filled, so a
+// publish is one compare-and-swap on the tail plus two stores.  A full
+// ring drops the event rather than make a request wait.
+class Access_Log {
+private:
+    static constexpr size_t CAPACITY = (size_t)1 << 14;     // power of two
+    static constexpr size_t MASK = CAPACITY - 1;
+
+    struct alignas(64) Cell {
+        atomic<uint64_t> sequence;
+        Access_Event event;
+    };
+
+    unique_ptr<Cell[]> cells;
+    alignas(64) atomic<uint64_t> tail;      // next position to claim
+    alignas(64) uint64_t head;              // consumer only
+    atomic<uint64_t> dropped;
+
+public:
+    Access_Log() : cells(new Cell[CAPACITY]), tail(0), head(0), dropped(0) {
+        for (size_t i = 0; i < CAPACITY; i++) cells[i].sequence.store(i, memory_order_relaxed);
+    }
+
+    Access_Log(const Access_Log&) = delete;
+    Access_Log& operator=(const Access_Log&) = delete;
+
+    bool publish(const Access_Event& event) {
+        uint64_t position = tail.load(memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells[position & MASK];
+            uint64_t sequence = cell.sequence.load(memory_order_acquire);
+            int64_t lag = (int64_t)(sequence - position);
+            if (lag == 0) {
+                if (tail.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+                    cell.event = event;
+                    cell.sequence.store(position + 1, memory_order_release);
+                    return true;
+                }
+            }
+            else if (lag < 0) {
+                dropped.fetch_add(1, memory_order_relaxed);     // the consumer is a lap behind
+                return false;
+            }
+            else {
+                position = tail.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    // consumer side: moves up to limit events into out and frees their cells
+    size_t drain(Access_Event* out, size_t limit) {
+        size_t count = 0;
+        while (count < limit) {
+            Cell& cell = cells[head & MASK];
+            if (cell.sequence.load(memory_order_acquire) != head + 1) break;
+            out[count++] = cell.event;
+            cell.sequence.store(head + CAPACITY, memory_order_release);
+            head++;
+        }
+        return count;
+    }
+
+    // events claimed so far, including ones still being written
+    uint64_t published() const { return tail.load(memory_order_acquire); }
+    uint64_t droppedCount() const { return dropped.load(memory_order_relaxed); }
+};
+
+// What the access log has folded in for one file
+struct File_Access_Counts {
+    uint64_t reads = 0;
+    uint64_t writes = 0;
+    uint64_t lastAccess = 0;    // nanoseconds since the epoch
+};
+
+// LEB128-style variable length integers, used wherever a byte format wants
+// small numbers to stay small
+void appendVarint(string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out += (char)((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out += (char)value;
+}
+
+bool readVarint(const char*& cursor, const char* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; cursor < end && shift < 64; shift += 7) {
+        unsigned char byte = (unsigned char)*cursor++;
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+// Binary delta between two versions: a list of COPY(offset, length) from the
+// base and INSERT(bytes) ops.  Matches are found by indexing the base in
+// 16-byte blocks and extending each hit in both directions.
+class Delta_Codec {
+private:
+    static const size_t BLOCK = 16;
+    enum Op { OP_COPY = 0, OP_INSERT = 1 };
+
+    static void flushInsert(string& delta, const string& target, size_t from, size_t to) {
+        if (from >= to) return;
+        appendVarint(delta, OP_INSERT);
+        appendVarint(delta, to - from);
+        delta.append(target, from, to - from);
+    }
+
+public:
+    static string encode(const string& base, const string& target) {
+        string delta;
+        appendVarint(delta, target.size());
+
+        Open_Hash_Map<uint64_t, uint32_t> blocks;
+        for (size_t offset = 0; offset + BLOCK <= base.size(); offset += BLOCK) {
+            blocks.emplace(Hash64::bytes(base.data() + offset, BLOCK), (uint32_t)offset);
+        }
+
+        size_t pending = 0;     // start of bytes not yet covered by an op
+        size_t i = 0;
+        while (i + BLOCK <= target.size()) {
+            const uint32_t* hit = blocks.find(Hash64::bytes(target.data() + i, BLOCK));
+            if (!hit || memcmp(base.data() + *hit, target.data() + i, BLOCK) != 0) {
+                i++;
+                continue;
+            }
+
+            size_t baseStart = *hit, targetStart = i;
+            while (baseStart > 0 && targetStart > pending && base[baseStart - 1] == target[targetStart - 1]) {
+                baseStart--;
+                targetStart--;
+            }
+            size_t length = i + BLOCK - targetStart;
+            while (baseStart + length < base.size() && targetStart + length < target.size()
+                && base[baseStart + length] == target[targetStart + length]) {
+                length++;
+            }
+
+            flushInsert(delta, target, pending, targetStart);
+            appendVarint(delta, OP_COPY);
+            appendVarint(delta, baseStart);
+            appendVarint(delta, length);
+            pending = i = targetStart + length;
+        }
+        flushInsert(delta, target, pending, target.size());
+        return delta;
+    }
+
+    static bool apply(const string& base, const string& delta, string& target) {
+        const char* cursor = delta.data();
+        const char* end = cursor + delta.size();
+        uint64_t length, op, a, b;
+        if (!readVarint(cursor, end, length)) return false;
+
+        target.clear();
+        target.reserve(length);
+        while (cursor < end) {
+            if (!readVarint(cursor, end, op)) return false;
+            if (op == OP_COPY) {
+                if (!readVarint(cursor, end, a) || !readVarint(cursor, end, b) || a + b > base.size()) return false;
+                target.append(base, a, b);
+            }
+            else {
+                if (!readVarint(cursor, end, a) || a > (uint64_t)(end - cursor)) return false;
+                target.append(cursor, a);
+                cursor += a;
+            }
+        }
+        return target.size() == length;
+    }
+};
+
+// one entry of a file's history, for listing it
+struct Version_Info {
+    size_t size;
+    int64_t modifiedAt;         // seconds since the epoch
+    bool snapshot;
+};
+
+// File Versioning System
+// every SNAPSHOT_INTERVAL-th version is a full snapshot (kept in the chunk
+// store, so unchanged chunks are shared with the live file); the ones in
+// between are deltas against their predecessor.  Versions sit in an index
+// array, so rebuilding any of them applies fewer than SNAPSHOT_INTERVAL deltas.
+// The newest body is only a shared reference to the live file's chunks, so
+// history costs the deltas and the snapshots' changed chunks, nothing more.
+class File_Version_List {
+private:
+    struct VersionNode {
+        Content_Ref snapshot;       // set on snapshot versions
+        string delta;               // set on the others
+        size_t size;
+        int64_t modifiedAt;         // seconds since the epoch
+    };
+
+    static const int SNAPSHOT_INTERVAL = 8;
+
+    Chunk_Store* store;
+    vector<VersionNode> versions;   // versions[i] is version i + 1
+    Content_Ref latest;             // the newest version, shared with the live file
+
+    static bool isSnapshot(size_t index) { return index % SNAPSHOT_INTERVAL == 0; }
+
+public:
+    explicit File_Version_List(Chunk_Store* chunkStore) : store(chunkStore) {}
+
+    ~File_Version_List() {
+        for (VersionNode& version : versions) store->release(version.snapshot);
+        store->release(latest);
+    }
+
+    File_Version_List(const File_Version_List&) = delete;
+    File_Version_List& operator=(const File_Version_List&) = delete;
+
+    // content is the new body and body the store's copy of it (the live
+    // file's Content_Ref); the previous version is read back from the store
+    void addVersion(const string& content, const Content_Ref& body) {
+        VersionNode version;
+        version.size = content.size();
+        version.modifiedAt = Coarse_Clock::now();
+        if (isSnapshot(versions.size())) {
+            version.snapshot = store->share(body);
+        }
+        else {
+            version.delta = Delta_Codec::encode(store->load(latest), content);
+        }
+        versions.push_back(std::move(version));
+        store->release(latest);
+        latest = store->share(body);
+    }
+
+    int count() const {
+        return (int)versions.size();
+    }
+
+    bool hasVersion(int versionNumber) const {
+        return versionNumber >= 1 && versionNumber <= count();
+    }
+
+    string getVersion(int versionNumber) const {
+        if (!hasVersion(versionNumber)) return "";
+        if (versionNumber == count()) return store->load(latest);
+
+        size_t target = versionNumber - 1;
+        size_t index = target - target % SNAPSHOT_INTERVAL;
+        string content = store->load(versions[index].snapshot);
+        string next;
+        while (index++ < target) {
+            if (!Delta_Codec::apply(content, versions[index].delta, next)) return "";
+            content.swap(next);
+        }
+        return content;
+    }
+
+    // bytes spent on history: deltas plus snapshot bodies before dedup
+    size_t storedBytes() const {
+        size_t total = 0;
+        for (const VersionNode& version : versions) {
+            total += version.delta.size() + version.snapshot.length;
+        }
+        return total;
+    }
+
+    // what a snapshot keeps: visit(snapshot body, delta, size, modifiedAt)
+    // for each version, oldest first, plus the newest body
+    template <typename Visit>
+    void forEachVersion(Visit visit) const {
+        for (const VersionNode& version : versions) visit(version.snapshot, version.delta, version.size, version.modifiedAt);
+    }
+
+    const Content_Ref& latestBody() const { return latest; }
+
+    // rebuilding from a snapshot, oldest version first; the list takes over
+    // the store references in snapshot and body
+    void restoreVersion(Content_Ref snapshot, string delta, size_t size, int64_t modifiedAt) {
+        versions.push_back(VersionNode{ std::move(snapshot), std::move(delta), size, modifiedAt });
+    }
+
+    void restoreLatest(Content_Ref body) {
+        store->release(latest);
+        latest = std::move(body);
+    }
+
+    vector<Version_Info> history() const {
+        vector<Version_Info> entries;
+        entries.reserve(versions.size());
+        for (size_t i = 0; i < versions.size(); i++) {
+            entries.push_back(Version_Info{ versions[i].size, versions[i].modifiedAt, isSnapshot(i) });
+        }
+        return entries;
+    }
+};
+
+// Full-text search over file bodies.  Text splits into lowercase words, and
+// each word's posting list holds, per document, the gap from the previous
+// document number and the word's frequency, with the gaps between its
+// positions in a second stream that only phrases read; all are varints.
+// Lists are cut into blocks of POSTING_BLOCK documents with a skip entry
+// each, so an AND leaps over most of a common word's list.
+// Document numbers are handed out in order, so lists only ever append:
+// re-indexing a file gives it a new number and leaves the old one dead
+// until a compaction drops dead postings and renumbers the rest.  Matches are ranked by BM25, and
+// each block remembers its highest frequency and shortest document, which
+// bound what any document in it can score: once the top results are
+// better than that, the whole block is skipped unread.
+class Text_Index {
+public:
+    struct Hit {
+        uint64_t fileId;
+        uint64_t parentId;      // folder the file was indexed in
+        double score;
+    };
+
+    static constexpr size_t MAX_TERM = 32;          // longer words are cut short
+    static constexpr size_t POSTING_BLOCK = 128;
+    static constexpr size_t COMPACT_AFTER = 4096;   // dead documents tolerated before compacting
+    static constexpr double K1 = 1.2;
+    static constexpr double B = 0.75;
+
+private:
+    struct Skip {
+        uint32_t base;          // document number the block's first gap counts from
+        uint32_t lastDoc;
+        uint32_t offset;        // into bytes
+        uint32_t positionOffset;
+        uint32_t maxFrequency;
+        uint32_t minLength;
+    };
+
+    struct Posting_List {
+        string bytes;           // document gaps and frequencies
+        string positions;       // position gaps
+        vector<Skip> skips;
+        uint32_t lastDoc = 0;
+        uint32_t inBlock = 0;   // documents in the last block
+        uint32_t live = 0;      // live documents containing the word
+    };
+
+    struct Document {
+        uint64_t fileId;
+        uint64_t parentId;
+        string terms;           // distinct term ids, delta varints
+    };
+
+    // walks one posting list in document order
+    class Cursor {
+    private:
+        const Posting_List* list;
+        size_t block;
+        const char* at;
+        const char* blockEnd;
+        const char* positionsAt;
+        uint32_t positionsBehind;   // positions of earlier postings not yet stepped over
+        bool started;
+        bool done;
+
+        void enterBlock(size_t index) {
+            const Skip& skip = list->skips[index];
+            block = index;
+            at = list->bytes.data() + skip.offset;
+            blockEnd = index + 1 < list->skips.size() ? list->bytes.data() + list->skips[index + 1].offset
+                : list->bytes.data() + list->bytes.size();
+            positionsAt = list->positions.data() + skip.positionOffset;
+            positionsBehind = 0;
+            doc = skip.base;
+            frequency = 0;
+            started = false;
+        }
+
+    public:
+        uint32_t doc;
+        uint32_t frequency;
+
+        const Skip& currentBlock() const { return list->skips[block]; }
+
+        explicit Cursor(const Posting_List& postings)
+            : list(&postings), block(0), at(nullptr), blockEnd(nullptr), positionsAt(nullptr), positionsBehind(0),
+              started(false), done(postings.skips.empty()), doc(0), frequency(0) {
+            if (!done) enterBlock(0);
+        }
+
+        bool next() {
+            if (done) return false;
+            if (at == blockEnd) {
+                if (block + 1 == list->skips.size()) {
+                    done = true;
+                    return false;
+                }
+                enterBlock(block + 1);
+            }
+            uint64_t gap, count;
+            readVarint(at, blockEnd, gap);
+            readVarint(at, blockEnd, count);
+            positionsBehind += frequency;
+            doc += (uint32_t)gap;
+            frequency = (uint32_t)count;
+            started = true;
+            return true;
+        }
+
+        // to the first posting at or after target
+        bool seek(uint32_t target) {
+            if (done) return false;
+            if (started && doc >= target) return true;
+            if (list->skips[block].lastDoc < target) {
+                auto later = lower_bound(list->skips.begin() + block + 1, list->skips.end(), target,
+                    [](const Skip& skip, uint32_t wanted) { return skip.lastDoc < wanted; });
+                if (later == list->skips.end()) {
+                    done = true;
+                    return false;
+                }
+                enterBlock(later - list->skips.begin());
+            }
+            while (next()) {
+                if (doc >= target) return true;
+            }
+            return false;
+        }
+
+        void readPositions(vector<uint32_t>& out) {
+            for (; positionsBehind; positionsBehind--) {
+                while (*positionsAt++ & 0x80) {}
+            }
+            out.clear();
+            const char* cursor = positionsAt;
+            const char* end = list->positions.data() + list->positions.size();
+            uint64_t gap;
+            uint32_t position = 0;
+            for (uint32_t i = 0; i < frequency; i++) {
+                readVarint(cursor, end, gap);
+                position += (uint32_t)gap;
+                out.push_back(position);
+            }
+        }
+    };
+
+    Open_Hash_Map<string, uint32_t> termIds;
+    vector<Posting_List> lists;                     // by term id
+    vector<Document> documents;                     // by document number; 0 is never used
+    vector<uint32_t> lengths;                       // words per document, 0 once dead
+    Open_Hash_Map<uint64_t, uint32_t> documentOf;   // file id -> its live document
+    uint64_t liveWords;
+    size_t liveDocuments;
+    size_t deadDocuments;                           // since the last compaction
+    mutable Distributed_Rw_Lock lock;
+
+    static void append(Posting_List& list, uint32_t doc, uint32_t length, const uint32_t* positions, size_t count) {
+        if (list.skips.empty() || list.inBlock == POSTING_BLOCK) {
+            list.skips.push_back(Skip{ list.lastDoc, doc, (uint32_t)list.bytes.size(), (uint32_t)list.positions.size(),
+                0, UINT32_MAX });
+            list.inBlock = 0;
+        }
+        Skip& skip = list.skips.back();
+        if (count > skip.maxFrequency) skip.maxFrequency = (uint32_t)count;
+        if (length < skip.minLength) skip.minLength = length;
+        appendVarint(list.bytes, doc - list.lastDoc);
+        appendVarint(list.bytes, count);
+        uint32_t previous = 0;
+        for (size_t i = 0; i < count; i++) {
+            appendVarint(list.positions, positions[i] - previous);
+            previous = positions[i];
+        }
+        list.lastDoc = doc;
+        skip.lastDoc = doc;
+        list.inBlock++;
+        list.live++;
+    }
+
+    void removeLocked(uint64_t fileId) {
+        uint32_t doc;
+        if (!documentOf.erase(fileId, &doc)) return;
+        Document& document = documents[doc];
+        const char* cursor = document.terms.data();
+        const char* end = cursor + document.terms.size();
+        uint64_t gap, term = 0;
+        while (readVarint(cursor, end, gap)) {
+            term += gap;
+            lists[term].live--;
+        }
+        string().swap(document.terms);
+        liveWords -= lengths[doc];
+        lengths[doc] = 0;
+        liveDocuments--;
+        if (++deadDocuments >= COMPACT_AFTER && deadDocuments > liveDocuments) compact();
+    }
+
+    // drops dead documents and renumbers the live ones in order, then
+    // re-encodes every list to match; the order is kept, so lists stay sorted
+    // and the document table only ever holds about twice the live files
+    void compact() {
+        vector<uint32_t> renumbered(documents.size(), 0);      // 0: dead
+        uint32_t live = 1;
+        for (uint32_t doc = 1; doc < documents.size(); doc++) {
+            uint32_t* current = documentOf.find(documents[doc].fileId);
+            if (!current || *current != doc) continue;
+            renumbered[doc] = live;
+            *current = live;
+            if (live != doc) {
+                lengths[live] = lengths[doc];
+                documents[live] = std::move(documents[doc]);
+            }
+            live++;
+        }
+        documents.resize(live);
+        documents.shrink_to_fit();
+        lengths.resize(live);
+        lengths.shrink_to_fit();
+
+        vector<uint32_t> positions;
+        for (Posting_List& list : lists) {
+            Posting_List kept;
+            Cursor cursor(list);
+            while (cursor.next()) {
+                uint32_t doc = renumbered[cursor.doc];
+                if (!doc) continue;
+                cursor.readPositions(positions);
+                append(kept, doc, lengths[doc], positions.data(), positions.size());
+            }
+            kept.bytes.shrink_to_fit();
+            kept.positions.shrink_to_fit();
+            list = std::move(kept);
+        }
+        deadDocuments = 0;
+    }
+
+    // one required piece of a clause: a word, or a phrase of several
+    struct Phrase {
+        vector<size_t> terms;   // indexes into the clause's cursors, in phrase order
+    };
+
+    bool phraseMatches(const Phrase& phrase, vector<Cursor>& cursors, vector<vector<uint32_t>>& scratch) const {
+        scratch.resize(phrase.terms.size());
+        for (size_t i = 0; i < phrase.terms.size(); i++) cursors[phrase.terms[i]].readPositions(scratch[i]);
+        for (uint32_t start : scratch[0]) {
+            size_t i = 1;
+            while (i < phrase.terms.size() && binary_search(scratch[i].begin(), scratch[i].end(), start + (uint32_t)i)) i++;
+            if (i == phrase.terms.size()) return true;
+        }
+        return false;
+    }
+
+    // visit(doc, score) for every live document matching all of clause that
+    // could score above *floor (every one, if floor is null)
+    template <typename Visit>
+    void matchClause(const vector<vector<string>>& clause, Visit visit, const double* floor) const {
+        vector<uint32_t> termOf;        // cursor index -> term id
+        vector<Phrase> phrases;
+        for (const vector<string>& words : clause) {
+            Phrase phrase;
+            for (const string& word : words) {
+                const uint32_t* term = termIds.find(word);
+                if (!term || !lists[*term].live) return;
+                size_t index = find(termOf.begin(), termOf.end(), *term) - termOf.begin();
+                if (index == termOf.size()) termOf.push_back(*term);
+                phrase.terms.push_back(index);
+            }
+            if (phrase.terms.size() > 1) phrases.push_back(std::move(phrase));
+        }
+
+        // rarest word first: it proposes documents, the rest seek to them
+        vector<size_t> order(termOf.size());
+        for (size_t i = 0; i < order.size(); i++) order[i] = i;
+        sort(order.begin(), order.end(), [&](size_t a, size_t b) { return lists[termOf[a]].live < lists[termOf[b]].live; });
+        vector<Cursor> cursors;
+        vector<double> idf;
+        for (uint32_t term : termOf) {
+            cursors.emplace_back(lists[term]);
+            double df = lists[term].live;
+            idf.push_back(log(1.0 + (liveDocuments - df + 0.5) / (df + 0.5)));
+        }
+        double averageLength = (double)liveWords / liveDocuments;
+        vector<vector<uint32_t>> scratch;
+        auto termScore = [&](size_t k, double tf, double length) {
+            return idf[k] * tf * (K1 + 1.0) / (tf + K1 * (1.0 - B + B * length / averageLength));
+        };
+
+        Cursor& lead = cursors[order[0]];
+        if (!lead.next()) return;
+        uint32_t target = lead.doc;
+        double bound = 0;
+        uint32_t boundEnd = 0;      // the bound holds for targets up to here
+        while (true) {
+            bool aligned = true;
+            for (size_t k : order) {
+                if (!cursors[k].seek(target)) return;
+                if (cursors[k].doc > target) {
+                    target = cursors[k].doc;
+                    aligned = false;
+                    break;
+                }
+            }
+            if (!aligned) continue;
+
+            if (floor) {
+                // can anything before the first of the current blocks ends beat the floor?
+                if (target > boundEnd) {
+                    bound = 0;
+                    boundEnd = UINT32_MAX;
+                    for (size_t k = 0; k < cursors.size(); k++) {
+                        const Skip& skip = cursors[k].currentBlock();
+                        bound += termScore(k, skip.maxFrequency, skip.minLength);
+                        boundEnd = min(boundEnd, skip.lastDoc);
+                    }
+                }
+                if (bound <= *floor) {
+                    if (boundEnd == UINT32_MAX || !lead.seek(boundEnd + 1)) return;
+                    target = lead.doc;
+                    continue;
+                }
+            }
+
+            uint32_t length = lengths[target];
+            bool matched = length != 0;
+            for (size_t i = 0; matched && i < phrases.size(); i++) matched = phraseMatches(phrases[i], cursors, scratch);
+            if (matched) {
+                double score = 0;
+                for (size_t k = 0; k < cursors.size(); k++) score += termScore(k, cursors[k].frequency, length);
+                visit(target, score);
+            }
+            if (!lead.next()) return;
+            target = lead.doc;
+        }
+    }
+
+public:
+    Text_Index() : liveWords(0), liveDocuments(0), deadDocuments(0) {
+        documents.push_back(Document{ 0, 0, string() });
+        lengths.push_back(0);
+    }
+
+    Text_Index(const Text_Index&) = delete;
+    Text_Index& operator=(const Text_Index&) = delete;
+
+    // emit(word, position) for each run of letters, digits and non-ASCII
+    // bytes, with ASCII folded to lowercase
+    template <typename Emit>
+    static void tokenize(const char* text, size_t length, Emit emit) {
+        string word;
+        uint32_t position = 0;
+        for (size_t i = 0; i <= length; i++) {
+            unsigned char c = i < length ? (unsigned char)text[i] : ' ';
+            bool inWord = (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || c >= 0x80;
+            if (inWord) {
+                if (word.size() < MAX_TERM) word += (c >= 'A' && c <= 'Z') ? (char)(c + ('a' - 'A')) : (char)c;
+            }
+            else if (!word.empty()) {
+                emit(word, position++);
+                word.clear();
+            }
+        }
+    }
+
+    // Words separated by spaces must all appear; "quoted words" must appear
+    // in that order; OR separates alternatives.  Returns the clauses, each a
+    // list of phrases (a lone word is a phrase of one).
+    static vector<vector<vector<string>>> parse(const string& query) {
+        vector<vector<vector<string>>> clauses(1);
+        size_t at = 0;
+        while (at < query.size()) {
+            if (query[at] == ' ' || query[at] == '\t') {
+                at++;
+                continue;
+            }
+            size_t end;
+            string piece;
+            bool quoted = query[at] == '"';
+            if (quoted) {
+                end = query.find('"', at + 1);
+                if (end == string::npos) end = query.size();
+                piece = query.substr(at + 1, end - at - 1);
+                at = end + 1;
+            }
+            else {
+                end = query.find_first_of(" \t", at);
+                if (end == string::npos) end = query.size();
+                piece = query.substr(at, end - at);
+                at = end;
+            }
+            if (!quoted && piece == "OR") {
+                if (!clauses.back().empty()) clauses.emplace_back();
+                continue;
+            }
+            vector<string> words;
+            tokenize(piece.data(), piece.size(), [&](const string& word, uint32_t) { words.push_back(word); });
+            if (!words.empty()) clauses.back().push_back(std::move(words));
+        }
+        if (clauses.back().empty()) clauses.pop_back();
+        return clauses;
+    }
+
+    // adds the file, or replaces what was indexed for it
+    void index(uint64_t fileId, uint64_t parentId, const string& content) {
+        // the words are gathered and sorted before taking the lock
+        vector<pair<string, uint32_t>> words;
+        tokenize(content.data(), content.size(), [&](const string& word, uint32_t position) {
+            words.emplace_back(word, position);
+        });
+        stable_sort(words.begin(), words.end(),
+            [](const pair<string, uint32_t>& a, const pair<string, uint32_t>& b) { return a.first < b.first; });
+
+        lock_guard<Distributed_Rw_Lock> guard(lock);
+        removeLocked(fileId);
+        uint32_t doc = (uint32_t)documents.size();
+        uint32_t length = (uint32_t)words.size();
+        documents.push_back(Document{ fileId, parentId, string() });
+        lengths.push_back(length);
+        vector<uint32_t> terms, positions;
+        for (size_t i = 0; i < words.size();) {
+            positions.clear();
+            size_t j = i;
+            for (; j < words.size() && words[j].first == words[i].first; j++) positions.push_back(words[j].second);
+            pair<uint32_t*, bool> term = termIds.emplace(words[i].first, (uint32_t)lists.size());
+            if (term.second) lists.emplace_back();
+            append(lists[*term.first], doc, length, positions.data(), positions.size());
+            terms.push_back(*term.first);
+            i = j;
+        }
+        sort(terms.begin(), terms.end());
+        uint32_t previous = 0;
+        for (uint32_t term : terms) {
+            appendVarint(documents[doc].terms, term - previous);
+            previous = term;
+        }
+        documentOf.emplace(fileId, doc);
+        liveWords += words.size();
+        liveDocuments++;
+    }
+
+    void remove(uint64_t fileId) {
+        lock_guard<Distributed_Rw_Lock> guard(lock);
+        removeLocked(fileId);
+    }
+
+    void clear() {
+        lock_guard<Distributed_Rw_Lock> guard(lock);
+        termIds.clear();
+        lists.clear();
+        documents.resize(1);
+        lengths.resize(1);
+        documentOf.clear();
+        liveWords = 0;
+        liveDocuments = 0;
+        deadDocuments = 0;
+    }
+
+    // the best limit matches, highest score first
+    vector<Hit> search(const string& query, size_t limit) const {
+        vector<vector<vector<string>>> clauses = parse(query);
+        vector<Hit> hits;
+        if (clauses.empty() || !limit) return hits;
+
+        shared_lock<Distributed_Rw_Lock> guard(lock);
+        if (!liveDocuments) return hits;
+        vector<pair<double, uint32_t>> best;        // min-heap on score
+        double floor = -1.0;                        // what a document must beat to get in
+        auto offer = [&](uint32_t doc, double score) {
+            if (best.size() < limit) {
+                best.emplace_back(score, doc);
+                push_heap(best.begin(), best.end(), greater<pair<double, uint32_t>>());
+            }
+            else if (score > best.front().first) {
+                pop_heap(best.begin(), best.end(), greater<pair<double, uint32_t>>());
+                best.back() = make_pair(score, doc);
+                push_heap(best.begin(), best.end(), greater<pair<double, uint32_t>>());
+            }
+            if (best.size() == limit) floor = best.front().first;
+        };
+        if (clauses.size() == 1) {
+            matchClause(clauses[0], offer, &floor);
+        }
+        else {
+            // a document matching several alternatives scores for each; the
+            // sums go in a per-thread array by document number
+            thread_local vector<double> sums;
+            thread_local vector<uint32_t> touched;
+            if (sums.size() < documents.size()) sums.resize(documents.size(), 0.0);
+            for (const vector<vector<string>>& clause : clauses) {
+                matchClause(clause, [&](uint32_t doc, double score) {
+                    if (sums[doc] == 0.0) touched.push_back(doc);
+                    sums[doc] += score;
+                }, nullptr);
+            }
+            for (uint32_t doc : touched) {
+                offer(doc, sums[doc]);
+                sums[doc] = 0.0;
+            }
+            touched.clear();
+        }
+
+        sort(best.begin(), best.end(), greater<pair<double, uint32_t>>());
+        for (const pair<double, uint32_t>& entry : best) {
+            const Document& document = documents[entry.second];
+            hits.push_back(Hit{ document.fileId, document.parentId, entry.first });
+        }
+        return hits;
+    }
+
+    size_t size() const {
+        shared_lock<Distributed_Rw_Lock> guard(lock);
+        return liveDocuments;
+    }
+
+    size_t termCount() const {
+        shared_lock<Distributed_Rw_Lock> guard(lock);
+        return termIds.size();
+    }
+
+    size_t postingBytes() const {
+        shared_lock<Distributed_Rw_Lock> guard(lock);
+        size_t total = 0;
+        for (const Posting_List& list : lists) total += list.bytes.size() + list.skips.size() * sizeof(Skip);
+        return total;
+    }
+};
+
+// Read-only memory mapping of a whole file; pages are faulted in by the OS
+// only when something actually touches them
+class Mapped_File {
+private:
+    const char* base;
+    size_t length;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+
+public:
+    Mapped_File() : base(nullptr), length(0) {
+#ifdef _WIN32
+        file = INVALID_HANDLE_VALUE;
+        mapping = nullptr;
+#endif
+    }
+
+    ~Mapped_File() { close(); }
+
+    Mapped_File(const Mapped_File&) = delete;
+    Mapped_File& operator=(const Mapped_File&) = delete;
+
+    bool open(const string& path) {
+        close();
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+            close();
+            return false;
+        }
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping) {
+            close();
+            return false;
+        }
+        base = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        length = (size_t)fileSize.QuadPart;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+        void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (view == MAP_FAILED) return false;
+        base = static_cast<const char*>(view);
+        length = (size_t)info.st_size;
+#endif
+        if (!base) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (base) UnmapViewOfFile(base);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (base) munmap(const_cast<char*>(base), length);
+#endif
+        base = nullptr;
+        length = 0;
+    }
+
+    const char* data() const { return base; }
+    size_t size() const { return length; }
+};
+
+// On-disk snapshot of the whole drive (format version 7, little endian).
+// A header and section table are followed by 8-byte aligned sections of
+// fixed-size records.  Records refer to each other and to the string and
+// blob sections by offset or index, never by pointer, so the file can be
+// mapped anywhere and read in place.  Version 6 changed the user record:
+// passwords and security answers are salted Secret_Hash bytes, never text.
+// Version 7 added file version histories.
+enum Snapshot_Kind {
+    SNAP_STRINGS = 1,   // raw bytes referenced by Snap_String
+    SNAP_BLOBS,         // chunk bodies
+    SNAP_CHUNKS,        // Snap_Chunk
+    SNAP_CHUNK_REFS,    // uint32 chunk indexes, one run per node
+    SNAP_NODES,         // Snap_Node, parents before children
+    SNAP_META,          // Snap_Meta
+    SNAP_USERS,         // Snap_User, oldest account first
+    SNAP_SHARES,        // Snap_Share
+    SNAP_BIN,           // Snap_Bin, oldest deletion first (newest first in version 1)
+    SNAP_FOLDERS,       // Snap_Folder, since version 4
+    SNAP_HISTORIES,     // Snap_History, since version 7
+    SNAP_VERSIONS,      // Snap_Version, one run per history
+    SNAP_KIND_COUNT
+};
+
+struct Snapshot_Header {
+    char magic[8];              // "GDRVSNAP"
+    uint32_t formatVersion;
+    uint32_t sectionCount;
+    uint64_t fileSize;
+};
+
+struct Snapshot_Section {
+    uint32_t kind;
+    uint32_t recordSize;
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct Snap_String {
+    uint64_t offset;
+    uint64_t length;
+};
+
+struct Snap_Chunk {
+    uint64_t digestHi;
+    uint64_t digestLo;
+    uint64_t offset;            // into SNAP_BLOBS
+    uint64_t length;
+};
+
+enum Snap_Node_Flags { SNAP_NODE_FILE = 1, SNAP_NODE_RECYCLED = 2 };
+
+struct Snap_Node {
+    uint64_t id;
+    uint64_t parentId;          // 0 for the root and for recycled files
+    Snap_String name;
+    uint64_t firstChunkRef;     // into SNAP_CHUNK_REFS
+    uint64_t length;
+    uint32_t chunkCount;
+    uint32_t flags;
+};
+
+struct Snap_Meta {
+    uint64_t fileId;
+    uint64_t size;
+    Snap_String type;
+    Snap_String owner;
+    int64_t created;            // seconds since the epoch
+    int64_t modified;
+};
+
+// formats 1 to 4 kept the dates as text
+struct Snap_Meta_V4 {
+    uint64_t fileId;
+    uint64_t size;
+    Snap_String type;
+    Snap_String owner;
+    Snap_String creationDate;
+    Snap_String lastModified;
+};
+
+// from format 6 on, password and securityAnswer hold Secret_Hash::bytes()
+// (salt, round count and digest) and are parsed back with Secret_Hash::parse;
+// formats 1 to 5 stored them as plain text, which loading hashes
+struct Snap_User {
+    Snap_String userId;
+    Snap_String password;
+    Snap_String securityQuestion;
+    Snap_String securityAnswer;
+    Snap_String lastLogin;
+    Snap_String lastLogout;
+};
+
+struct Snap_Share {
+    uint64_t nodeId;
+    uint32_t owner;             // index into SNAP_USERS
+    uint32_t grantee;
+    uint32_t permissions;       // Share_Permission bits
+    uint32_t reserved;
+};
+
+// formats 1 and 2 shared by bare file name
+struct Snap_Share_V1 {
+    uint64_t owner;
+    uint64_t sharedWith;
+    Snap_String filename;
+    Snap_String permission;
+};
+
+struct Snap_Bin {
+    uint64_t node;              // index into SNAP_NODES
+    Snap_String deletionTime;   // empty since version 5, which goes by deletedAt
+    uint64_t parentId;          // folder the file was deleted from
+    int64_t deletedAt;
+    uint64_t meta;              // index into SNAP_META, or SNAP_NONE
+};
+
+struct Snap_Bin_V1 {
+    uint64_t node;
+    Snap_String deletionTime;
+};
+
+struct Snap_Folder {
+    uint64_t folderId;
+    uint32_t owner;             // index into SNAP_USERS
+    uint32_t reserved;
+};
+
+// one file's versions, live or binned, and the body of the newest
+struct Snap_History {
+    uint64_t fileId;
+    uint64_t firstVersion;      // into SNAP_VERSIONS
+    uint64_t versionCount;
+    uint64_t firstChunkRef;     // newest body, into SNAP_CHUNK_REFS
+    uint64_t length;
+    uint32_t chunkCount;
+    uint32_t reserved;
+};
+
+// a snapshot version keeps its body as chunk refs, the others a delta
+// against the version before them
+struct Snap_Version {
+    uint64_t size;
+    int64_t modifiedAt;
+    uint64_t firstChunkRef;     // into SNAP_CHUNK_REFS
+    uint64_t length;
+    uint32_t chunkCount;
+    uint32_t reserved;
+    uint64_t deltaOffset;       // into SNAP_BLOBS
+    uint64_t deltaLength;
+};
+
+static const uint64_t SNAP_NONE = ~0ull;
+
+static const char SNAPSHOT_MAGIC[8] = { 'G', 'D', 'R', 'V', 'S', 'N', 'A', 'P' };
+static const uint32_t SNAPSHOT_FORMAT_VERSION = 7;      // versions 1 to 6 are still read
+
+class Snapshot_Writer {
+private:
+    string sections[SNAP_KIND_COUNT];
+    uint32_t recordSizes[SNAP_KIND_COUNT];
+    Open_Hash_Map<string, Snap_String> interned;    // owners and types repeat a lot
+
+public:
+    Snapshot_Writer() {
+        for (int i = 0; i < SNAP_KIND_COUNT; i++) recordSizes[i] = 1;
+        recordSizes[SNAP_CHUNKS] = sizeof(Snap_Chunk);
+        recordSizes[SNAP_CHUNK_REFS] = sizeof(uint32_t);
+        recordSizes[SNAP_NODES] = sizeof(Snap_Node);
+        recordSizes[SNAP_META] = sizeof(Snap_Meta);
+        recordSizes[SNAP_USERS] = sizeof(Snap_User);
+        recordSizes[SNAP_SHARES] = sizeof(Snap_Share);
+        recordSizes[SNAP_BIN] = sizeof(Snap_Bin);
+        recordSizes[SNAP_FOLDERS] = sizeof(Snap_Folder);
+        recordSizes[SNAP_HISTORIES] = sizeof(Snap_History);
+        recordSizes[SNAP_VERSIONS] = sizeof(Snap_Version);
+    }
+
+    Snap_String addString(const string& text) {
+        Snap_String* known = interned.find(text);
+        if (known) return *known;
+        Snap_String ref{ sections[SNAP_STRINGS].size(), text.size() };
+        sections[SNAP_STRINGS] += text;
+        interned.emplace(text, ref);
+        return ref;
+    }
+
+    uint64_t addBlob(const char* data, size_t length) {
+        uint64_t offset = sections[SNAP_BLOBS].size();
+        sections[SNAP_BLOBS].append(data, length);
+        return offset;
+    }
+
+    // appends one record and returns its index within the section
+    template <typename Record>
+    uint64_t add(Snapshot_Kind kind, const Record& record) {
+        string& section = sections[kind];
+        uint64_t index = section.size() / sizeof(Record);
+        section.append(reinterpret_cast<const char*>(&record), sizeof(Record));
+        return index;
+    }
+
+    uint64_t count(Snapshot_Kind kind) const {
+        return sections[kind].size() / recordSizes[kind];
+    }
+
+    // writes to path + ".tmp" and renames over path, so a crash mid-write
+    // leaves the previous snapshot intact
+    bool write(const string& path) const {
+        const uint32_t sectionCount = SNAP_KIND_COUNT - 1;
+        Snapshot_Section table[SNAP_KIND_COUNT - 1];
+        uint64_t offset = sizeof(Snapshot_Header) + sizeof(table);
+        for (uint32_t kind = 1; kind < SNAP_KIND_COUNT; kind++) {
+            offset = (offset + 7) & ~(uint64_t)7;
+            table[kind - 1] = Snapshot_Section{ kind, recordSizes[kind], offset, sections[kind].size() };
+            offset += sections[kind].size();
+        }
+
+        Snapshot_Header header;
+        memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+        header.formatVersion = SNAPSHOT_FORMAT_VERSION;
+        header.sectionCount = sectionCount;
+        header.fileSize = offset;
+
+        string tempPath = path + ".tmp";
+        FILE* out = fopen(tempPath.c_str(), "wb");
+        if (!out) return false;
+        bool ok = fwrite(&header, sizeof(header), 1, out) == 1
+            && fwrite(table, sizeof(table), 1, out) == 1;
+        uint64_t written = sizeof(header) + sizeof(table);
+        static const char padding[8] = {};
+        for (uint32_t i = 0; ok && i < sectionCount; i++) {
+            ok = fwrite(padding, 1, table[i].offset - written, out) == table[i].offset - written;
+            const string& body = sections[table[i].kind];
+            ok = ok && (body.empty() || fwrite(body.data(), body.size(), 1, out) == 1);
+            written = table[i].offset + body.size();
+        }
+        // the body must be on disk before the rename can expose it
+        ok = ok && fflush(out) == 0 && syncFile(fileno(out));
+        ok = (fclose(out) == 0) && ok;
+        if (!ok) {
+            remove(tempPath.c_str());
+            return false;
+        }
+#ifdef _WIN32
+        return MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+        // ... and the rename itself lives in the directory
+        return rename(tempPath.c_str(), path.c_str()) == 0 && syncDirectoryOf(path);
+#endif
+    }
+
+private:
+    static bool syncFile(int file) {
+#ifdef _WIN32
+        return _commit(file) == 0;
+#else
+        return fsync(file) == 0;
+#endif
+    }
+
+#ifndef _WIN32
+    static bool syncDirectoryOf(const string& path) {
+        size_t slash = path.find_last_of('/');
+        string dir = slash == string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+        int fd = open(dir.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        bool ok = fsync(fd) == 0;
+        close(fd);
+        return ok;
+    }
+#endif
+};
+
+// Validated view over a mapped snapshot.  Opening only checks the header and
+// section table; records are read in place when asked for.
+class Snapshot_Reader {
+private:
+    const char* base;
+    const Snapshot_Section* sections[SNAP_KIND_COUNT];
+    uint32_t formatVersion;
+
+public:
+    Snapshot_Reader() : base(nullptr), formatVersion(0) {
+        for (int i = 0; i < SNAP_KIND_COUNT; i++) sections[i] = nullptr;
+    }
+
+    bool open(const Mapped_File& file) {
+        base = file.data();
+        if (!base || file.size() < sizeof(Snapshot_Header)) return false;
+
+        const Snapshot_Header* header = reinterpret_cast<const Snapshot_Header*>(base);
+        if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0) return false;
+        if (header->formatVersion < 1 || header->formatVersion > SNAPSHOT_FORMAT_VERSION
+            || header->fileSize != file.size()) return false;
+        formatVersion = header->formatVersion;
+        if (header->sectionCount > 64
+            || sizeof(Snapshot_Header) + header->sectionCount * sizeof(Snapshot_Section) > file.size()) return false;
+
+        const Snapshot_Section* table = reinterpret_cast<const Snapshot_Section*>(base + sizeof(Snapshot_Header));
+        for (uint32_t i = 0; i < header->sectionCount; i++) {
+            const Snapshot_Section& section = table[i];
+            if (section.offset % 8 || section.offset > file.size() || section.size > file.size() - section.offset) return false;
+            if (!section.recordSize || section.size % section.recordSize) return false;
+            if (section.kind > 0 && section.kind < SNAP_KIND_COUNT) sections[section.kind] = &section;
+        }
+        for (int kind = 1; kind < SNAP_KIND_COUNT; kind++) {
+            bool added = (kind == SNAP_FOLDERS && formatVersion < 4) || (kind >= SNAP_HISTORIES && formatVersion < 7);
+            if (!sections[kind] && !added) return false;
+        }
+        return sections[SNAP_NODES]->recordSize == sizeof(Snap_Node)
+            && sections[SNAP_CHUNKS]->recordSize == sizeof(Snap_Chunk)
+            && sections[SNAP_META]->recordSize == (formatVersion < 5 ? sizeof(Snap_Meta_V4) : sizeof(Snap_Meta))
+            && sections[SNAP_USERS]->recordSize == sizeof(Snap_User)
+            && sections[SNAP_SHARES]->recordSize == (formatVersion < 3 ? sizeof(Snap_Share_V1) : sizeof(Snap_Share))
+            && sections[SNAP_BIN]->recordSize == (formatVersion == 1 ? sizeof(Snap_Bin_V1) : sizeof(Snap_Bin))
+            && sections[SNAP_CHUNK_REFS]->recordSize == sizeof(uint32_t)
+            && (!sections[SNAP_FOLDERS] || sections[SNAP_FOLDERS]->recordSize == sizeof(Snap_Folder))
+            && (!sections[SNAP_HISTORIES] || sections[SNAP_HISTORIES]->recordSize == sizeof(Snap_History))
+            && (!sections[SNAP_VERSIONS] || sections[SNAP_VERSIONS]->recordSize == sizeof(Snap_Version));
+    }
+
+    uint32_t version() const { return formatVersion; }
+
+    // sections older formats lack count as empty
+    uint64_t count(Snapshot_Kind kind) const {
+        return sections[kind] ? sections[kind]->size / sections[kind]->recordSize : 0;
+    }
+
+    template <typename Record>
+    const Record& at(Snapshot_Kind kind, uint64_t index) const {
+        return reinterpret_cast<const Record*>(base + sections[kind]->offset)[index];
+    }
+
+    bool valid(const Snap_String& ref) const {
+        const Snapshot_Section* strings = sections[SNAP_STRINGS];
+        return ref.offset <= strings->size && ref.length <= strings->size - ref.offset;
+    }
+
+    string text(const Snap_String& ref) const {
+        if (!valid(ref)) return "";
+        return string(base + sections[SNAP_STRINGS]->offset + ref.offset, ref.length);
+    }
+
+    const char* blob(uint64_t offset, uint64_t length) const {
+        const Snapshot_Section* blobs = sections[SNAP_BLOBS];
+        if (offset > blobs->size || length > blobs->size - offset) return nullptr;
+        return base + blobs->offset + offset;
+    }
+};
+
+// CRC-32 (IEEE, reflected) for log records
+uint32_t crc32(const char* data, size_t length, uint32_t crc = 0) {
+    // built once, on first use; appenders call this outside the log mutex,
+    // so the table is a local static that C++ initializes thread-safely
+    struct Table {
+        uint32_t entries[256];
+        Table() {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                entries[i] = c;
+            }
+        }
+    };
+    static const Table table;
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) crc = table.entries[(crc ^ (unsigned char)data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+// Drive mutations as they appear in the write-ahead log
+enum Log_Type {
+    LOG_MKDIR = 1,      // parent id, id, name, owner (newer logs only)
+    LOG_CREATE,         // parent id, id, name, content, type, owner, created, modified (older logs only)
+    LOG_EDIT,           // id, content, modified (older logs only)
+    LOG_RECYCLE,        // id, deletion time (empty in newer logs), deleted at: unlink the file and bin it
+    LOG_RESTORE,        // recycled id, parent id, new id, owner, time (older logs only)
+    LOG_PURGE,          // empty the recycle bin (older logs only)
+    LOG_ADD_USER,       // user id, password, question, answer (older logs only)
+    LOG_SHARE,          // owner, target, file name, permission (older logs only)
+    LOG_UNRECYCLE,      // id, parent id, owner: relink a binned file as it was
+    LOG_PURGE_FILE,     // id: free one binned file
+    LOG_GRANT,          // node id, granting user, grantee, permission bits
+    LOG_REVOKE,         // node id, grantee
+    LOG_UPLOAD,         // parent id, id, name, content, type, owner, created at
+    LOG_REWRITE,        // id, content, modified at
+    LOG_REGISTER,       // user id, password hash, question, answer hash (Secret_Hash bytes)
+    LOG_SET_PASSWORD    // user id, password hash
+};
+
+// builds one record payload: a type byte followed by varints and
+// length-prefixed strings
+class Log_Record {
+private:
+    string payload;
+
+public:
+    explicit Log_Record(Log_Type type) { payload += (char)type; }
+
+    Log_Record& number(uint64_t value) {
+        appendVarint(payload, value);
+        return *this;
+    }
+
+    Log_Record& text(const string& value) {
+        appendVarint(payload, value.size());
+        payload += value;
+        return *this;
+    }
+
+    const string& bytes() const { return payload; }
+};
+
+class Log_Reader {
+private:
+    const char* cursor;
+    const char* end;
+
+public:
+    Log_Reader(const char* begin, const char* finish) : cursor(begin), end(finish) {}
+
+    bool number(uint64_t& value) { return readVarint(cursor, end, value); }
+
+    bool text(string& value) {
+        uint64_t length;
+        if (!readVarint(cursor, end, length) || length > (uint64_t)(end - cursor)) return false;
+        value.assign(cursor, length);
+        cursor += length;
+        return true;
+    }
+};
+
+// how hard the log tries to share one fsync between writers
+struct Group_Commit_Policy {
+    size_t maxBatch = 512;          // flush as soon as this many records are waiting
+    long maxDelayMicros = 100;      // otherwise wait at most this long for company
+};
+
+// Append-only redo log.  Each record is framed as
+//   [u32 payload length][u32 crc32 of payload][payload]
+// Writers append to an in-memory batch and block in waitDurable(); a single
+// flusher thread writes the batch and issues one fsync for all of them.
+class Write_Ahead_Log {
+private:
+    int fd;
+    Group_Commit_Policy policy;
+    mutex lock;
+    condition_variable wakeFlusher;
+    condition_variable wakeWriters;
+    string batch;
+    size_t batchRecords;
+    uint64_t lastLsn;           // lsn of the newest appended record
+    uint64_t durableLsn;        // everything up to here is on disk
+    uint64_t syncCount;
+    bool stopping;
+    bool failed;
+    thread flusher;
+
+    static bool writeAll(int file, const string& data) {
+        size_t done = 0;
+        while (done < data.size()) {
+#ifdef _WIN32
+            int wrote = _write(file, data.data() + done, (unsigned)(data.size() - done));
+#else
+            ssize_t wrote = ::write(file, data.data() + done, data.size() - done);
+#endif
+            if (wrote <= 0) return false;
+            done += (size_t)wrote;
+        }
+        return true;
+    }
+
+    static bool syncFile(int file) {
+#ifdef _WIN32
+        return _commit(file) == 0;
+#else
+        return fsync(file) == 0;
+#endif
+    }
+
+    void flushLoop() {
+        unique_lock<mutex> guard(lock);
+        while (true) {
+            wakeFlusher.wait(guard, [&] { return stopping || batchRecords > 0; });
+            if (!batchRecords) break;       // stopping with nothing left to write
+
+            // give concurrent writers a moment to join this fsync
+            if (batchRecords < policy.maxBatch && !stopping && policy.maxDelayMicros > 0) {
+                wakeFlusher.wait_for(guard, chrono::microseconds(policy.maxDelayMicros),
+                    [&] { return stopping || batchRecords >= policy.maxBatch; });
+            }
+
+            string writing;
+            writing.swap(batch);
+            batchRecords = 0;
+            uint64_t upTo = lastLsn;
+            guard.unlock();
+            bool ok = writeAll(fd, writing) && syncFile(fd);
+            guard.lock();
+
+            if (!ok) failed = true;
+            durableLsn = upTo;
+            syncCount++;
+            wakeWriters.notify_all();
+        }
+    }
+
+public:
+    Write_Ahead_Log() : fd(-1), batchRecords(0), lastLsn(0), durableLsn(0), syncCount(0),
+        stopping(false), failed(false) {}
+
+    ~Write_Ahead_Log() { close(); }
+
+    Write_Ahead_Log(const Write_Ahead_Log&) = delete;
+    Write_Ahead_Log& operator=(const Write_Ahead_Log&) = delete;
+
+    // Reads every intact record of a log file, oldest first.  Stops at the
+    // first torn or corrupt record and returns the length of the good prefix.
+    template <typename Apply>
+    static uint64_t replay(const string& path, Apply apply) {
+        Mapped_File file;
+        if (!file.open(path)) return 0;
+        const char* data = file.data();
+        uint64_t offset = 0;
+        while (file.size() - offset >= 8) {
+            uint32_t length, checksum;
+            memcpy(&length, data + offset, 4);
+            memcpy(&checksum, data + offset + 4, 4);
+            if (length == 0 || length > file.size() - offset - 8) break;
+            const char* payload = data + offset + 8;
+            if (crc32(payload, length) != checksum) break;
+            apply((Log_Type)(unsigned char)payload[0], Log_Reader(payload + 1, payload + length));
+            offset += 8 + length;
+        }
+        return offset;
+    }
+
+    // opens for appending, cutting off anything past validLength (a torn tail)
+    bool open(const string& path, uint64_t validLength, const Group_Commit_Policy& commitPolicy = Group_Commit_Policy()) {
+        close();
+        policy = commitPolicy;
+#ifdef _WIN32
+        fd = _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_BINARY | _O_APPEND, _S_IREAD | _S_IWRITE);
+        if (fd >= 0 && _chsize_s(fd, (long long)validLength) != 0) {
+#else
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd >= 0 && ftruncate(fd, (off_t)validLength) != 0) {
+#endif
+            close();
+            return false;
+        }
+        if (fd < 0) return false;
+        stopping = failed = false;
+        flusher = thread(&Write_Ahead_Log::flushLoop, this);
+        return true;
+    }
+
+    void close() {
+        if (flusher.joinable()) {
+            {
+                lock_guard<mutex> guard(lock);
+                stopping = true;
+            }
+            wakeFlusher.notify_one();
+            flusher.join();
+        }
+        if (fd >= 0) {
+#ifdef _WIN32
+            _close(fd);
+#else
+            ::close(fd);
+#endif
+        }
+        fd = -1;
+    }
+
+    bool isOpen() const { return fd >= 0; }
+
+    // queues a record and returns its lsn; it is durable once waitDurable(lsn) returns
+    uint64_t append(const Log_Record& record) {
+        const string& payload = record.bytes();
+        uint32_t length = (uint32_t)payload.size();
+        uint32_t checksum = crc32(payload.data(), payload.size());
+
+        lock_guard<mutex> guard(lock);
+        batch.append(reinterpret_cast<const char*>(&length), 4);
+        batch.append(reinterpret_cast<const char*>(&checksum), 4);
+        batch += payload;
+        batchRecords++;
+        if (batchRecords == 1 || batchRecords >= policy.maxBatch) wakeFlusher.notify_one();
+        return ++lastLsn;
+    }
+
+    bool waitDurable(uint64_t lsn) {
+        unique_lock<mutex> guard(lock);
+        wakeWriters.wait(guard, [&] { return durableLsn >= lsn || fd < 0; });
+        return !failed && durableLsn >= lsn;
+    }
+
+    bool commit(const Log_Record& record) {
+        if (!isOpen()) return false;
+        return waitDurable(append(record));
+    }
+
+    // empties the log once a snapshot covers everything in it
+    bool truncate() {
+        unique_lock<mutex> guard(lock);
+        wakeWriters.wait(guard, [&] { return durableLsn >= lastLsn; });
+#ifdef _WIN32
+        return _chsize_s(fd, 0) == 0;
+#else
+        return ftruncate(fd, 0) == 0;
+#endif
+    }
+
+    uint64_t fsyncs() const { return syncCount; }
+};
+
+// One user's connection to the drive: who they are and where they are.
+// Sessions share nothing with each other, so each can run on its own thread.
+struct Drive_Session {
+    User_Graph::UserNode* user = nullptr;
+    Session_Token token;            // lets another session resume this login
+    bool resumed = false;           // joined through resume() rather than a password
+    TreeNode* cwd = nullptr;        // directories are never freed while the drive runs
+    bool deferSync = false;         // batch mode: wait once per batch instead of per mutation
+    uint64_t unsyncedLsn = 0;
+};
+
+// Outcome of a drive operation.  The menus turn these into messages and
+// batch mode prints statusName() as the first field of each result line.
+enum Drive_Status {
+    DRIVE_OK,
+    DRIVE_NO_SESSION,       // nobody is logged in
+    DRIVE_LOGGED_IN,        // someone already is
+    DRIVE_BAD_LOGIN,
+    DRIVE_NOT_FOUND,
+    DRIVE_UNKNOWN_USER,
+    DRIVE_EXISTS,
+    DRIVE_DENIED,
+    DRIVE_EMPTY,
+    DRIVE_FAILED,
+    DRIVE_BAD_COMMAND
+};
+
+inline const char* statusName(Drive_Status status) {
+    static const char* const names[] = { "ok", "no-session", "logged-in", "bad-login", "not-found",
+        "unknown-user", "exists", "denied", "empty", "failed", "bad-command" };
+    return names[status];
+}
+
+// Fields in batch scripts and results are tab separated, one record per
+// line, so tabs, newlines and backslashes inside a field are escaped.
+inline void appendEscaped(string& out, const string& field) {
+    for (char c : field) {
+        if (c == '\\') out += "\\\\";
+        else if (c == '\n') out += "\\n";
+        else if (c == '\t') out += "\\t";
+        else if (c == '\r') out += "\\r";
+        else out += c;
+    }
+}
+
+inline string unescapeField(const char* text, size_t length) {
+    string field;
+    field.reserve(length);
+    for (size_t i = 0; i < length; i++) {
+        if (text[i] != '\\' || i + 1 == length) {
+            field += text[i];
+            continue;
+        }
+        char c = text[++i];
+        field += c == 'n' ? '\n' : c == 't' ? '\t' : c == 'r' ? '\r' : c;
+    }
+    return field;
+}
+
+// The Google Drive System
+static const char* const SNAPSHOT_FILE = "drive.snapshot";
+
+class Google_Drive_System {
+private:
+    FileSystemTree fileSystem;
+    HashTable fileMetadata;
+    Recycle_Bin recycleBin;
+    User_Graph userGraph;
+    Access_Control acl;             // shares and folder owners, by node id and uid
+    Text_Index textIndex;           // linked files only; rebuilt at startup
+    Drive_Session console;          // the interactive menus' session
+    Open_Hash_Map<uint64_t, File_Version_List*> fileVersions;     // by file id
+    string snapshotPath;
+    Mapped_File snapshotFile;       // stays mapped: restored file bodies point into it
+    Write_Ahead_Log journal;        // every mutation since the last snapshot
+    Block_Codec codec;              // reused so its buffers are too
+
+    // Locking, outermost first: engineLock (shared by every operation,
+    // exclusive for checkpoints), then one directory lock, then binLock,
+    // usersLock or versionsLock; the ACL's own locks are innermost of all.  Log records are appended while the locks
+    // that ordered the change are still held, so replay sees the same order.
+    Distributed_Rw_Lock engineLock;
+    mutex binLock;
+    mutex usersLock;
+    mutex versionsLock;
+    mutex outputLock;               // result lines from concurrent scripts
+
+    // Accesses reach the recent-files lists and per-file counters through
+    // accessLog, folded in by accessFolder, so requests never wait on them
+    Access_Log accessLog;
+    Open_Hash_Map<uint64_t, File_Access_Counts> accessCounts;     // by file id
+    mutex accessLock;
+    atomic<uint64_t> foldedEvents;
+    atomic<bool> stopFolding;
+    thread accessFolder;
+
+    // binSweeper purges files that outlived binRetention, a few at a time
+    Drive_Session sweeper;
+    atomic<int64_t> binRetention;   // seconds; 0 keeps binned files forever
+    bool stopSweeping;
+    mutex sweepLock;
+    condition_variable sweepWake;
+    thread binSweeper;
+
+    static const uint64_t CHECKPOINT_BYTES = 64ull * 1024 * 1024;
+    static const int64_t DEFAULT_BIN_RETENTION = 30 * 24 * 3600;
+    static const size_t PURGE_STEP = 256;          // binned files freed per hold of binLock
+    static const size_t SCRIPT_BATCH = 4096;       // commands per durability wait in batch mode
+    static const size_t SEARCH_PAGE = 10;          // hits per search
+    static const size_t FIND_PAGE = 100;           // names per find
+    static const size_t QUERY_PAGE = 20;           // files per metadata query
+    atomic<uint64_t> journalBytes;
+
+    // makes a mutation durable before the caller reports success; in batch
+    // mode that happens in syncBatch(), before the batch's results go out
+    void logMutation(Drive_Session& session, const Log_Record& record) {
+        if (!journal.isOpen()) return;
+        if (session.deferSync) {
+            session.unsyncedLsn = journal.append(record);
+        }
+        else if (!journal.commit(record)) {
+            cout << "Warning: the change could not be written to the journal.\n";
+        }
+        journalBytes += record.bytes().size() + 8;
+    }
+
+    bool syncBatch(Drive_Session& session) {
+        if (!session.unsyncedLsn) return true;
+        bool durable = journal.waitDurable(session.unsyncedLsn);
+        session.unsyncedLsn = 0;
+        return durable;
+    }
+
+    // called between commands, with no locks held
+    void maybeCheckpoint() {
+        if (journalBytes >= CHECKPOINT_BYTES) checkpoint();
+    }
+
+    // Re-applies one logged mutation on top of the snapshot.  Records name
+    // nodes by id, and anything the snapshot already reflects (a crash
+    // between writing a snapshot and truncating the log) is skipped.
+    void replayMutation(Log_Type type, Log_Reader in) {
+        uint64_t id = 0, parentId = 0, newId = 0;
+        string name, content, fileType, owner, created, modified, extra;
+        Chunk_Store& store = fileSystem.getContentStore();
+
+        if (type == LOG_MKDIR && in.number(parentId) && in.number(id) && in.text(name)) {
+            if (!fileSystem.findById(id)) fileSystem.adoptNode(id, parentId, name, false, Content_Ref());
+            User_Graph::UserNode* creator = in.text(owner) ? userGraph.findUser(owner) : nullptr;
+            if (creator) acl.adoptFolder(id, creator->uid);
+        }
+        else if ((type == LOG_UPLOAD || type == LOG_CREATE) && in.number(parentId) && in.number(id) && in.text(name)
+            && in.text(content) && in.text(fileType) && in.text(owner)) {
+            int64_t createdAt, modifiedAt;
+            if (type == LOG_UPLOAD) {
+                uint64_t at;
+                if (!in.number(at)) return;
+                createdAt = modifiedAt = (int64_t)at;
+            }
+            else {
+                if (!in.text(created) || !in.text(modified)) return;
+                createdAt = parseTime(created);
+                modifiedAt = parseTime(modified);
+            }
+            if (fileSystem.findById(id)) return;
+            TreeNode* file = fileSystem.adoptNode(id, parentId, name, true, store.store(content));
+            if (!file) return;
+            File_Meta_data* meta = new File_Meta_data{ Interned_Strings::intern(fileType), Interned_Strings::intern(owner),
+                content.size(), createdAt, modifiedAt, file, fileSystem.storedSizeOf(file) };
+            fileMetadata.insert(id, meta);
+            versionsFor(id)->addVersion(content, file->content);
+        }
+        else if ((type == LOG_REWRITE || type == LOG_EDIT) && in.number(id) && in.text(content)) {
+            uint64_t at = 0;
+            if (type == LOG_REWRITE ? !in.number(at) : !in.text(modified)) return;
+            TreeNode* file = fileSystem.findById(id);
+            File_Meta_data* meta = fileMetadata.search(id);
+            if (!file || !meta) return;
+            fileSystem.writeContent(file, content);
+            meta->size = content.size();
+            meta->storedSize = fileSystem.storedSizeOf(file);
+            meta->modified = type == LOG_REWRITE ? (int64_t)at : parseTime(modified);
+            fileMetadata.refresh(id);
+            versionsFor(id)->addVersion(content, file->content);
+        }
+        else if (type == LOG_RECYCLE && in.number(id) && in.text(extra)) {
+            uint64_t deletedAt;
+            if (!in.number(deletedAt)) deletedAt = (uint64_t)time(nullptr);
+            TreeNode* file = fileSystem.findById(id);
+            if (!file || !file->parent) return;
+            parentId = file->parent->id;
+            if (!fileSystem.removeFile(file)) return;
+            recycleBin.push(file, fileMetadata.detach(id), parentId, (int64_t)deletedAt);
+        }
+        else if (type == LOG_UNRECYCLE && in.number(id) && in.number(parentId) && in.text(owner)) {
+            relinkRecycled(id, fileSystem.findById(parentId), id, owner);
+        }
+        else if (type == LOG_RESTORE && in.number(id) && in.number(parentId) && in.number(newId)
+            && in.text(owner) && in.text(extra)) {
+            // older drives restored into a fresh node, owned by whoever restored it
+            if (fileSystem.findById(newId) || !relinkRecycled(id, fileSystem.findById(parentId), newId, owner)) return;
+            File_Meta_data* meta = fileMetadata.search(newId);
+            meta->owner = Interned_Strings::intern(owner);
+            meta->created = meta->modified = parseTime(extra);
+            fileMetadata.refresh(newId);
+        }
+        else if (type == LOG_PURGE_FILE && in.number(id)) {
+            Bin_Entry entry;
+            if (recycleBin.take(id, entry)) purgeEntry(entry);
+        }
+        else if (type == LOG_PURGE) {
+            Bin_Entry entry;
+            while (const Bin_Entry* oldest = recycleBin.oldest()) {
+                recycleBin.take(oldest->file->id, entry);
+                purgeEntry(entry);
+            }
+        }
+        else if (type == LOG_ADD_USER && in.text(name) && in.text(content) && in.text(created) && in.text(extra)) {
+            userGraph.addUser(name, content, created, extra);
+        }
+        else if (type == LOG_REGISTER && in.text(name) && in.text(content) && in.text(created) && in.text(extra)) {
+            Secret_Hash password, answer;
+            if (Secret_Hash::parse(content, password) && Secret_Hash::parse(extra, answer)) {
+                userGraph.addUser(name, password, created, answer);
+            }
+        }
+        else if (type == LOG_SET_PASSWORD && in.text(name) && in.text(content)) {
+            User_Graph::UserNode* user = userGraph.findUser(name);
+            Secret_Hash password;
+            if (user && Secret_Hash::parse(content, password)) userGraph.setPassword(user, password);
+        }
+        else if (type == LOG_SHARE && in.text(owner) && in.text(extra) && in.text(name) && in.text(content)) {
+            User_Graph::UserNode* from = userGraph.findUser(owner);
+            User_Graph::UserNode* to = userGraph.findUser(extra);
+            TreeNode* file = fileSystem.resolvePath(name, fileSystem.getRoot());
+            if (from && to && file && file->isFile && parsePermission(content)) {
+                acl.grant(file->id, from->uid, to->uid, parsePermission(content));
+            }
+        }
+        else if (type == LOG_GRANT && in.number(id) && in.text(owner) && in.text(extra) && in.number(newId)) {
+            User_Graph::UserNode* from = userGraph.findUser(owner);
+            User_Graph::UserNode* to = userGraph.findUser(extra);
+            if (from && to) acl.grant(id, from->uid, to->uid, (uint8_t)newId);
+        }
+        else if (type == LOG_REVOKE && in.number(id) && in.text(extra)) {
+            User_Graph::UserNode* to = userGraph.findUser(extra);
+            if (to) acl.revoke(id, to->uid);
         }
     }
 
-    void logout(UserNode* user) {
-        if (user) {
-            user->lastLogout = getCurrentTime();
+    string journalPath() const {
+        return snapshotPath + ".wal";
+    }
+
+    File_Version_List* versionsFor(uint64_t fileId) {
+        lock_guard<mutex> guard(versionsLock);
+        File_Version_List** versions = fileVersions.find(fileId);
+        if (versions) return *versions;
+        File_Version_List* created = new File_Version_List(&fileSystem.getContentStore());
+        fileVersions.emplace(fileId, created);
+        return created;
+    }
+
+    void dropVersions(uint64_t fileId) {
+        lock_guard<mutex> guard(versionsLock);
+        File_Version_List* versions = nullptr;
+        if (fileVersions.erase(fileId, &versions)) delete versions;
+    }
+
+    // history follows a restored file to its new node
+    void moveVersions(uint64_t fromId, uint64_t toId) {
+        lock_guard<mutex> guard(versionsLock);
+        File_Version_List* history = nullptr;
+        if (fileVersions.erase(fromId, &history)) fileVersions.emplace(toId, history);
+    }
+
+    void recordAccess(Drive_Session& session, uint64_t fileId, Access_Op op) {
+        uint64_t now = (uint64_t)chrono::duration_cast<chrono::nanoseconds>(
+            chrono::system_clock::now().time_since_epoch()).count();
+        accessLog.publish(Access_Event{ fileId, session.user, now, op });
+    }
+
+    // consumer thread: folds published accesses in, a batch at a time
+    void foldAccesses() {
+        const size_t BATCH = 1024;
+        vector<Access_Event> batch(BATCH);
+        while (true) {
+            bool stopping = stopFolding.load();     // read first, so a final pass follows it
+            size_t count = accessLog.drain(batch.data(), BATCH);
+            if (!count) {
+                if (stopping) return;
+                this_thread::sleep_for(chrono::milliseconds(1));
+                continue;
+            }
+            {
+                // names are read from the tree; nodes are only freed under binLock
+                shared_lock<Distributed_Rw_Lock> engine(engineLock);
+                lock_guard<mutex> bin(binLock);
+                lock_guard<mutex> guard(accessLock);
+                for (size_t i = 0; i < count; i++) {
+                    const Access_Event& event = batch[i];
+                    Recent_Files_Lru& recent = event.user->recentFiles;
+                    File_Access_Counts& counts = *accessCounts.emplace(event.fileId, File_Access_Counts()).first;
+                    if (event.op == ACCESS_READ) counts.reads++;
+                    else counts.writes++;
+                    counts.lastAccess = event.timestamp;
+
+                    TreeNode* file = event.op == ACCESS_DELETE ? nullptr : fileSystem.findById(event.fileId);
+                    if (file) recent.touch(event.fileId, file->name);
+                    else recent.forget(event.fileId);
+                }
+            }
+            foldedEvents.fetch_add(count, memory_order_release);
         }
     }
 
-    bool shareFile(UserNode* owner, const string& targetUserId, const string& filename, const string& permission) {
-        UserNode* target = findUser(targetUserId);
-        if (!target)
-            return false;
+    // waits until every access published before the call has been folded in
+    void catchUpAccesses() {
+        uint64_t target = accessLog.published();
+        while (foldedEvents.load(memory_order_acquire) < target) this_thread::yield();
+    }
+
+    // frees a file taken out of the bin for good
+    void purgeEntry(Bin_Entry& entry) {
+        acl.forget(entry.file->id);
+        dropVersions(entry.file->id);
+        dropAccessCounts(entry.file->id);
+        delete entry.meta;
+        fileSystem.discardNode(entry.file);
+    }
 
-        UserNode::SharedFile* newShare = new UserNode::SharedFile{
-            filename, permission, target, owner->sharedFiles };
-        owner->sharedFiles = newShare;
+    // Links a binned file back into dir as it was: same node, body and
+    // metadata, nothing copied.  newId renames it for older logs; owner
+    // only fills in metadata that older bins didn't keep.  Callers hold
+    // dir's lock and binLock.
+    bool relinkRecycled(uint64_t fileId, TreeNode* dir, uint64_t newId, const string& owner) {
+        const Bin_Entry* binned = recycleBin.find(fileId);
+        if (!dir || !binned || fileSystem.findChild(dir, binned->file->name)) return false;
+
+        Bin_Entry entry;
+        recycleBin.take(fileId, entry);
+        if (newId != fileId) {
+            entry.file->id = newId;
+            moveVersions(fileId, newId);
+            moveAccessCounts(fileId, newId);
+        }
+        fileSystem.relinkFile(dir, entry.file);
+        acl.relinked();
+        textIndex.index(newId, dir->id, fileSystem.readContent(entry.file));
+        if (!entry.meta) {
+            int64_t now = Coarse_Clock::now();
+            entry.meta = new File_Meta_data{ Interned_Strings::intern("txt"), Interned_Strings::intern(owner),
+                entry.file->content.length, now, now, entry.file, 0 };
+        }
+        entry.meta->fileNode = entry.file;
+        entry.meta->storedSize = fileSystem.storedSizeOf(entry.file);
+        fileMetadata.insert(newId, entry.meta);
         return true;
     }
 
-    void displaySharedFiles(UserNode* user) const {
-        if (!user || !user->sharedFiles) {
-            cout << "No files shared\n";
-            return;
+    // Frees up to limit of the oldest binned files deleted before cutoff and
+    // returns how many went.  Callers loop, so the bin is never held for long.
+    size_t purgeOldest(Drive_Session& session, int64_t cutoff, size_t limit) {
+        shared_lock<Distributed_Rw_Lock> engine(engineLock);
+        lock_guard<mutex> bin(binLock);
+        size_t purged = 0;
+        Bin_Entry entry;
+        while (purged < limit) {
+            const Bin_Entry* oldest = recycleBin.oldest();
+            if (!oldest || oldest->deletedAt >= cutoff) break;
+            recycleBin.take(oldest->file->id, entry);
+            logMutation(session, Log_Record(LOG_PURGE_FILE).number(entry.file->id));
+            purgeEntry(entry);
+            purged++;
         }
+        return purged;
+    }
 
-        cout << "Files shared by " << user->userId << ":\n";
-        UserNode::SharedFile* sf = user->sharedFiles;
-        while (sf) {
-            cout << "- " << sf->filename << " with " << sf->sharedWith->userId
-                << " (" << sf->permission << " access)\n";
-            sf = sf->next;
+    // sweeper thread: applies the retention policy about once a second
+    void sweepBin() {
+        unique_lock<mutex> guard(sweepLock);
+        while (!sweepWake.wait_for(guard, chrono::seconds(1), [&] { return stopSweeping; })) {
+            int64_t retention = binRetention.load();
+            if (retention <= 0) continue;
+            guard.unlock();
+            int64_t cutoff = (int64_t)time(nullptr) - retention;
+            while (purgeOldest(sweeper, cutoff, PURGE_STEP) == PURGE_STEP) syncBatch(sweeper);
+            syncBatch(sweeper);
+            guard.lock();
         }
     }
-};
 
-// File Versioning System
-class File_Version_List {
-private:
-    struct VersionNode {
-        int versionNumber;
-        string content;
-        string modificationTime;
-        VersionNode* prev;
-        VersionNode* next;
-    };
+    void dropAccessCounts(uint64_t fileId) {
+        lock_guard<mutex> guard(accessLock);
+        accessCounts.erase(fileId);
+    }
 
-    VersionNode* head;
-    VersionNode* tail;
-    int currentVersion;
+    // counts follow a restored file to its new node, like its history
+    void moveAccessCounts(uint64_t fromId, uint64_t toId) {
+        lock_guard<mutex> guard(accessLock);
+        File_Access_Counts counts;
+        if (accessCounts.erase(fromId, &counts)) accessCounts.emplace(toId, counts);
+    }
 
 public:
-    File_Version_List() : head(nullptr), tail(nullptr), currentVersion(0) {}
+    // an empty path runs the drive purely in memory
+    Google_Drive_System(const string& snapshot = SNAPSHOT_FILE, const Group_Commit_Policy& commitPolicy = Group_Commit_Policy())
+        : snapshotPath(snapshot), foldedEvents(0), stopFolding(false), binRetention(DEFAULT_BIN_RETENTION),
+          stopSweeping(false), journalBytes(0) {
+        console.cwd = fileSystem.getRoot();
+        sweeper.deferSync = true;       // one durability wait per purge step
+        accessFolder = thread(&Google_Drive_System::foldAccesses, this);
+        if (snapshotPath.empty() || !loadSnapshot(snapshotPath)) {
+            // Initialize with admin user
+            userGraph.addUser("admin", "password", "Favorite color?", "blue");
+        }
+        if (!snapshotPath.empty()) {
+            journalBytes = Write_Ahead_Log::replay(journalPath(),
+                [&](Log_Type type, Log_Reader in) { replayMutation(type, in); });
+            if (!journal.open(journalPath(), journalBytes, commitPolicy)) {
+                cout << "Warning: journal '" << journalPath() << "' could not be opened; changes are not durable.\n";
+            }
+        }
+        fileSystem.packLayout();
+        indexAllFiles();
+        binSweeper = thread(&Google_Drive_System::sweepBin, this);
+    }
 
-    ~File_Version_List() {
-        VersionNode* current = head;
-        while (current) {
-            VersionNode* next = current->next;
-            delete current;
-            current = next;
+    // The text index isn't saved; it is rebuilt from the tree once the
+    // snapshot and log are in, then kept current by every write.
+    void indexAllFiles() {
+        textIndex.clear();
+        fileSystem.forEachNode([&](TreeNode* node) {
+            if (node->isFile) textIndex.index(node->id, node->parent->id, fileSystem.readContent(node));
+        });
+    }
+
+    // how long deleted files stay in the bin, in seconds; 0 keeps them forever
+    void setBinRetention(int64_t seconds) {
+        binRetention = seconds;
+    }
+
+    // writes a fresh snapshot, after which the log it covers can go; waits
+    // for running operations and holds off new ones while it writes.  The log
+    // is only cut once the snapshot, and its rename, are durable.
+    bool checkpoint() {
+        lock_guard<Distributed_Rw_Lock> quiesce(engineLock);
+        fileSystem.packLayout();
+        if (snapshotPath.empty() || !saveSnapshot(snapshotPath)) return false;
+        if (journal.isOpen() && !journal.truncate()) return false;
+        journalBytes = 0;
+        return true;
+    }
+
+    // Writes the whole drive (tree, file bodies, metadata, users, shares,
+    // recycle bin and version histories) as a snapshot.
+    bool saveSnapshot(const string& path) {
+        Snapshot_Writer writer;
+        Open_Hash_Map<uint32_t, uint64_t> chunkIndex;      // store slot -> Snap_Chunk index
+        Open_Hash_Map<uint64_t, uint64_t> nodeIndex;       // node id -> Snap_Node index
+        Chunk_Store& store = fileSystem.getContentStore();
+        string chunkBytes;
+
+        // a body's run of chunk refs, each chunk written once however many bodies share it
+        auto addChunks = [&](const Content_Ref& content) {
+            uint64_t first = writer.count(SNAP_CHUNK_REFS);
+            for (uint32_t slot : content.chunks) {
+                pair<uint64_t*, bool> known = chunkIndex.emplace(slot, writer.count(SNAP_CHUNKS));
+                if (known.second) {
+                    const Chunk_Id& digest = store.digestOf(slot);
+                    chunkBytes.clear();
+                    store.readChunk(slot, chunkBytes);
+                    Snap_Chunk chunk = { digest.hi, digest.lo,
+                        writer.addBlob(chunkBytes.data(), chunkBytes.size()), chunkBytes.size() };
+                    writer.add(SNAP_CHUNKS, chunk);
+                }
+                writer.add(SNAP_CHUNK_REFS, (uint32_t)*known.first);
+            }
+            return first;
+        };
+
+        auto addNode = [&](const TreeNode* node, uint64_t parentId, uint32_t flags) {
+            Snap_Node record = {};
+            record.id = node->id;
+            record.parentId = parentId;
+            record.name = writer.addString(node->name);
+            record.firstChunkRef = addChunks(node->content);
+            record.length = node->content.length;
+            record.chunkCount = (uint32_t)node->content.chunks.size();
+            record.flags = flags | (node->isFile ? SNAP_NODE_FILE : 0);
+            nodeIndex.emplace(node->id, writer.add(SNAP_NODES, record));
+        };
+
+        fileSystem.forEachNode([&](const TreeNode* node) {
+            addNode(node, node->parent ? node->parent->id : 0, 0);
+        });
+
+        fileMetadata.forEach([&](uint64_t fileId, const File_Meta_data* meta) {
+            Snap_Meta record = { fileId, meta->size, writer.addString(*meta->type), writer.addString(*meta->owner),
+                meta->created, meta->modified };
+            writer.add(SNAP_META, record);
+        });
+
+        recycleBin.forEach([&](const Bin_Entry& entry) {
+            addNode(entry.file, 0, SNAP_NODE_RECYCLED);
+            uint64_t metaIndex = SNAP_NONE;
+            if (entry.meta) {
+                const File_Meta_data* meta = entry.meta;
+                Snap_Meta record = { entry.file->id, meta->size, writer.addString(*meta->type),
+                    writer.addString(*meta->owner), meta->created, meta->modified };
+                metaIndex = writer.add(SNAP_META, record);
+            }
+            Snap_Bin record = { *nodeIndex.find(entry.file->id), Snap_String{ 0, 0 },
+                entry.parentId, entry.deletedAt, metaIndex };
+            writer.add(SNAP_BIN, record);
+        });
+
+        // users are written in uid order, so a uid is also the Snap_User index
+        userGraph.forEachUser([&](const User_Graph::UserNode* user) {
+            Snap_User record = { writer.addString(user->userId), writer.addString(user->password.load()->bytes()),
+                writer.addString(user->securityQuestion), writer.addString(user->securityAnswer.bytes()),
+                writer.addString(formatTime(user->lastLogin)), writer.addString(formatTime(user->lastLogout)) };
+            writer.add(SNAP_USERS, record);
+        });
+        acl.shares().forEach([&](const Share_Graph::Grant& grant) {
+            Snap_Share record = { grant.nodeId, grant.owner, grant.grantee, grant.permissions, 0 };
+            writer.add(SNAP_SHARES, record);
+        });
+        acl.forEachFolderOwner([&](uint64_t folderId, uint32_t owner) {
+            Snap_Folder record = { folderId, owner, 0 };
+            writer.add(SNAP_FOLDERS, record);
+        });
+
+        fileVersions.forEach([&](uint64_t fileId, const File_Version_List* versions) {
+            if (!versions->count()) return;
+            const Content_Ref& latest = versions->latestBody();
+            Snap_History history = { fileId, writer.count(SNAP_VERSIONS), (uint64_t)versions->count(),
+                addChunks(latest), latest.length, (uint32_t)latest.chunks.size(), 0 };
+            versions->forEachVersion([&](const Content_Ref& snapshot, const string& delta, size_t size, int64_t modifiedAt) {
+                Snap_Version record = { size, modifiedAt, addChunks(snapshot), snapshot.length,
+                    (uint32_t)snapshot.chunks.size(), 0, writer.addBlob(delta.data(), delta.size()), delta.size() };
+                writer.add(SNAP_VERSIONS, record);
+            });
+            writer.add(SNAP_HISTORIES, history);
+        });
+
+#ifdef _WIN32
+        // Windows refuses to replace a file that is still mapped
+        if (snapshotFile.data()) {
+            store.copyMappedChunks();
+            snapshotFile.close();
         }
+#endif
+        return writer.write(path);
     }
 
-    void addVersion(const string& content) {
-        currentVersion++;
-        VersionNode* newNode = new VersionNode{
-            currentVersion,
-            content,
-            getCurrentTime(),
-            tail,
-            nullptr
+    // Maps a snapshot and rebuilds the drive from it.  The tree, metadata and
+    // users are rebuilt in one sequential pass over fixed-size records; file
+    // bodies are left in the mapping and only paged in when a file is read.
+    bool loadSnapshot(const string& path) {
+        if (!snapshotFile.open(path)) return false;
+        Snapshot_Reader reader;
+        if (!reader.open(snapshotFile)) {
+            cout << "Ignoring unreadable snapshot '" << path << "'.\n";
+            snapshotFile.close();
+            return false;
+        }
+
+        Chunk_Store& store = fileSystem.getContentStore();
+        uint64_t chunkCount = reader.count(SNAP_CHUNKS);
+        uint64_t refCount = reader.count(SNAP_CHUNK_REFS);
+        vector<TreeNode*> nodes(reader.count(SNAP_NODES), nullptr);
+
+        // a body left in the mapping; false if its run of refs is out of range
+        auto contentAt = [&](uint64_t firstChunkRef, uint32_t count, uint64_t length, Content_Ref& content) {
+            content.length = length;
+            if (firstChunkRef > refCount || count > refCount - firstChunkRef) return false;
+            for (uint32_t c = 0; c < count; c++) {
+                uint32_t chunkAt = reader.at<uint32_t>(SNAP_CHUNK_REFS, firstChunkRef + c);
+                if (chunkAt >= chunkCount) break;
+                const Snap_Chunk& chunk = reader.at<Snap_Chunk>(SNAP_CHUNKS, chunkAt);
+                const char* bytes = reader.blob(chunk.offset, chunk.length);
+                if (!bytes) break;
+                content.chunks.push_back(store.adoptMapped(Chunk_Id{ chunk.digestHi, chunk.digestLo }, bytes, chunk.length));
+            }
+            return true;
+        };
+
+        for (uint64_t i = 0; i < nodes.size(); i++) {
+            const Snap_Node& record = reader.at<Snap_Node>(SNAP_NODES, i);
+            if (!record.parentId && !(record.flags & SNAP_NODE_RECYCLED)) continue;     // the root
+
+            Content_Ref content;
+            if (!contentAt(record.firstChunkRef, record.chunkCount, record.length, content)) continue;
+            nodes[i] = fileSystem.adoptNode(record.id, record.parentId, reader.text(record.name),
+                (record.flags & SNAP_NODE_FILE) != 0, content);
+        }
+
+        auto metaOf = [&](uint64_t index, TreeNode* file) {
+            File_Meta_data* meta = new File_Meta_data();
+            if (reader.version() < 5) {
+                const Snap_Meta_V4& record = reader.at<Snap_Meta_V4>(SNAP_META, index);
+                *meta = File_Meta_data{ Interned_Strings::intern(reader.text(record.type)),
+                    Interned_Strings::intern(reader.text(record.owner)), record.size,
+                    parseTime(reader.text(record.creationDate)), parseTime(reader.text(record.lastModified)), file, 0 };
+            }
+            else {
+                const Snap_Meta& record = reader.at<Snap_Meta>(SNAP_META, index);
+                *meta = File_Meta_data{ Interned_Strings::intern(reader.text(record.type)),
+                    Interned_Strings::intern(reader.text(record.owner)), record.size, record.created, record.modified, file, 0 };
+            }
+            meta->storedSize = fileSystem.storedSizeOf(file);
+            return meta;
         };
+        // binned files aren't linked, so their records are only reached from SNAP_BIN
+        for (uint64_t i = 0; i < reader.count(SNAP_META); i++) {
+            uint64_t fileId = reader.version() < 5 ? reader.at<Snap_Meta_V4>(SNAP_META, i).fileId
+                : reader.at<Snap_Meta>(SNAP_META, i).fileId;
+            TreeNode* file = fileSystem.findById(fileId);
+            if (file) fileMetadata.insert(file->id, metaOf(i, file));
+        }
 
-        if (tail) {
-            tail->next = newNode;
+        if (reader.version() == 1) {
+            // newest first, and without the folder or metadata
+            int64_t now = (int64_t)time(nullptr);
+            for (uint64_t i = reader.count(SNAP_BIN); i-- > 0;) {
+                const Snap_Bin_V1& record = reader.at<Snap_Bin_V1>(SNAP_BIN, i);
+                int64_t deletedAt = parseTime(reader.text(record.deletionTime));
+                if (record.node < nodes.size() && nodes[record.node]) {
+                    recycleBin.push(nodes[record.node], nullptr, 0, deletedAt ? deletedAt : now);
+                }
+            }
         }
         else {
-            head = newNode;
+            for (uint64_t i = 0; i < reader.count(SNAP_BIN); i++) {
+                const Snap_Bin& record = reader.at<Snap_Bin>(SNAP_BIN, i);
+                if (record.node >= nodes.size() || !nodes[record.node]) continue;
+                TreeNode* file = nodes[record.node];
+                File_Meta_data* meta = record.meta < reader.count(SNAP_META) ? metaOf(record.meta, file) : nullptr;
+                recycleBin.push(file, meta, record.parentId, record.deletedAt);
+            }
+        }
+
+        vector<User_Graph::UserNode*> users(reader.count(SNAP_USERS), nullptr);
+        userGraph.reserve(users.size());
+        for (uint64_t i = 0; i < users.size(); i++) {
+            const Snap_User& record = reader.at<Snap_User>(SNAP_USERS, i);
+            string userId = reader.text(record.userId);
+            if (reader.version() < 6) {
+                userGraph.addUser(userId, reader.text(record.password),
+                    reader.text(record.securityQuestion), reader.text(record.securityAnswer));
+            }
+            else {
+                Secret_Hash password, answer;
+                if (Secret_Hash::parse(reader.text(record.password), password)
+                    && Secret_Hash::parse(reader.text(record.securityAnswer), answer)) {
+                    userGraph.addUser(userId, password, reader.text(record.securityQuestion), answer);
+                }
+            }
+            users[i] = userGraph.findUser(userId);
+            if (!users[i]) continue;
+            users[i]->lastLogin = parseTime(reader.text(record.lastLogin));
+            users[i]->lastLogout = parseTime(reader.text(record.lastLogout));
+        }
+        for (uint64_t i = 0; i < reader.count(SNAP_SHARES); i++) {
+            uint64_t nodeId, owner, grantee;
+            uint8_t permissions;
+            if (reader.version() < 3) {
+                // names were relative to wherever the owner was, usually the root
+                const Snap_Share_V1& record = reader.at<Snap_Share_V1>(SNAP_SHARES, i);
+                TreeNode* file = fileSystem.resolvePath(reader.text(record.filename), fileSystem.getRoot());
+                if (!file || !file->isFile) continue;
+                nodeId = file->id;
+                owner = record.owner;
+                grantee = record.sharedWith;
+                permissions = parsePermission(reader.text(record.permission));
+            }
+            else {
+                const Snap_Share& record = reader.at<Snap_Share>(SNAP_SHARES, i);
+                nodeId = record.nodeId;
+                owner = record.owner;
+                grantee = record.grantee;
+                permissions = (uint8_t)record.permissions;
+            }
+            if (owner >= users.size() || grantee >= users.size() || !users[owner] || !users[grantee]) continue;
+            if (permissions) acl.grant(nodeId, users[owner]->uid, users[grantee]->uid, permissions);
+        }
+        for (uint64_t i = 0; i < reader.count(SNAP_FOLDERS); i++) {
+            const Snap_Folder& record = reader.at<Snap_Folder>(SNAP_FOLDERS, i);
+            if (record.owner < users.size() && users[record.owner]) acl.adoptFolder(record.folderId, users[record.owner]->uid);
+        }
+
+        uint64_t versionCount = reader.count(SNAP_VERSIONS);
+        for (uint64_t i = 0; i < reader.count(SNAP_HISTORIES); i++) {
+            const Snap_History& record = reader.at<Snap_History>(SNAP_HISTORIES, i);
+            if (record.firstVersion > versionCount || record.versionCount > versionCount - record.firstVersion) continue;
+            Content_Ref latest;
+            if (!contentAt(record.firstChunkRef, record.chunkCount, record.length, latest)) continue;
+            File_Version_List* versions = new File_Version_List(&store);
+            versions->restoreLatest(std::move(latest));
+            for (uint64_t v = record.firstVersion; v < record.firstVersion + record.versionCount; v++) {
+                const Snap_Version& version = reader.at<Snap_Version>(SNAP_VERSIONS, v);
+                Content_Ref snapshot;
+                contentAt(version.firstChunkRef, version.chunkCount, version.length, snapshot);
+                const char* delta = reader.blob(version.deltaOffset, version.deltaLength);
+                versions->restoreVersion(std::move(snapshot), delta ? string(delta, version.deltaLength) : string(),
+                    version.size, version.modifiedAt);
+            }
+            File_Version_List* previous = nullptr;
+            if (fileVersions.erase(record.fileId, &previous)) delete previous;
+            fileVersions.emplace(record.fileId, versions);
         }
-        tail = newNode;
+        return userGraph.userCount() > 0;
     }
 
-    string getVersion(int versionNumber) const {
-        VersionNode* current = head;
-        while (current) {
-            if (current->versionNumber == versionNumber) {
-                return current->content;
+    ~Google_Drive_System() {
+        {
+            lock_guard<mutex> guard(sweepLock);
+            stopSweeping = true;
+        }
+        sweepWake.notify_all();
+        binSweeper.join();
+        stopFolding = true;
+        accessFolder.join();
+        if (console.user) {
+            userGraph.logout(console.user);
+        }
+        fileVersions.forEach([](uint64_t, File_Version_List* versions) { delete versions; });
+    }
+
+    // owners may do anything; everyone else needs every bit of needed,
+    // granted on the file or on a folder above it
+    bool mayAccess(const Drive_Session& session, const File_Meta_data* meta, const TreeNode* file, uint8_t needed) {
+        if (*meta->owner == session.user->userId) return true;
+        return (acl.effective(file, session.user->uid) & needed) == needed;
+    }
+
+    // Files are managed by their owner.  Folders by whoever created them or a
+    // folder above them, and by the admin, who also looks after folders from
+    // before creators were recorded.
+    Drive_Status checkManage(const Drive_Session& session, const TreeNode* node) {
+        if (node->isFile) {
+            File_Meta_data* meta = fileMetadata.search(node->id);
+            if (!meta) return DRIVE_NOT_FOUND;
+            return *meta->owner == session.user->userId ? DRIVE_OK : DRIVE_DENIED;
+        }
+        if (session.user->userId == "admin") return DRIVE_OK;
+        return (acl.effective(node, session.user->uid) & SHARE_MANAGE) ? DRIVE_OK : DRIVE_DENIED;
+    }
+
+    // ---- drive operations, shared by the menus and batch mode ----
+    //
+    // Every operation runs on behalf of a session and may run concurrently
+    // with operations of other sessions.  Paths are relative to the
+    // session's directory.
+
+    // logins only read the user directory, so they don't take usersLock
+    Drive_Status login(Drive_Session& session, const string& userId, const string& password) {
+        if (session.user) return DRIVE_LOGGED_IN;
+        session.user = userGraph.authenticate(userId, password);
+        if (!session.user) return DRIVE_BAD_LOGIN;
+        session.token = userGraph.issueToken(session.user);
+        if (session.token.empty()) {
+            session.user = nullptr;
+            return DRIVE_FAILED;
+        }
+        if (!session.cwd) session.cwd = fileSystem.getRoot();
+        return DRIVE_OK;
+    }
+
+    // joins the login behind a token another session was given, without the password
+    Drive_Status resume(Drive_Session& session, const Session_Token& token) {
+        if (session.user) return DRIVE_LOGGED_IN;
+        session.user = userGraph.validateToken(token);
+        if (!session.user) return DRIVE_BAD_LOGIN;
+        session.token = token;
+        session.resumed = true;
+        if (!session.cwd) session.cwd = fileSystem.getRoot();
+        return DRIVE_OK;
+    }
+
+    // the token is revoked, so no session can resume this login any more
+    Drive_Status logout(Drive_Session& session) {
+        if (!session.user) return DRIVE_NO_SESSION;
+        userGraph.revokeToken(session.token);
+        userGraph.logout(session.user);
+        session.user = nullptr;
+        session.token = Session_Token();
+        session.resumed = false;
+        return DRIVE_OK;
+    }
+
+    Drive_Status createDirectory(Drive_Session& session, const string& path) {
+        if (!session.user) return DRIVE_NO_SESSION;
+        shared_lock<Distributed_Rw_Lock> engine(engineLock);
+        string leaf;
+        TreeNode* dir = fileSystem.resolveParent(path, session.cwd, leaf);
+        if (!dir || leaf.empty()) return DRIVE_NOT_FOUND;
+
+        lock_guard<Distributed_Rw_Lock> guard(fileSystem.lockOf(dir));
+        if (fileSystem.findChild(dir, leaf)) return DRIVE_EXISTS;
+        TreeNode* newDir = fileSystem.makeDirectory(dir, leaf);
+        if (!newDir) return DRIVE_FAILED;
+        acl.adoptFolder(newDir->id, session.user->uid);
+        logMutation(session, Log_Record(LOG_MKDIR).number(dir->id).number(newDir->id).text(leaf)
+            .text(session.user->userId));
+        return DRIVE_OK;
+    }
+
+    Drive_Status changeDirectory(Drive_Session& session, const string& path) {
+        if (!session.user) return DRIVE_NO_SESSION;
+        shared_lock<Distributed_Rw_Lock> engine(engineLock);
+        TreeNode* dir = fileSystem.resolvePath(path, session.cwd);
+        if (!dir || dir->isFile) return DRIVE_NOT_FOUND;
+        session.cwd = dir;
+        return DRIVE_OK;
+    }
+
+    Drive_Status uploadFile(Drive_Session& session, const string& path, const string& content) {
+        if (!session.user) return DRIVE_NO_SESSION;
+        shared_lock<Distributed_Rw_Lock> engine(engineLock);
+        string leaf;
+        TreeNode* dir = fileSystem.resolveParent(path, session.cwd, leaf);
+        if (!dir || leaf.empty()) return DRIVE_NOT_FOUND;
+
+        lock_guard<Distributed_Rw_Lock> guard(fileSystem.lockOf(dir));
+        if (fileSystem.findChild(dir, leaf)) return DRIVE_EXISTS;
+        TreeNode* newFile = fileSystem.createFile(dir, leaf, content);
+        if (!newFile) return DRIVE_FAILED;
+
+        File_Meta_data* metaData = new File_Meta_data();
+        metaData->type = Interned_Strings::intern("txt");
+        metaData->size = content.size();
+        metaData->owner = Interned_Strings::intern(session.user->userId);
+        metaData->created = Coarse_Clock::now();
+        metaData->modified = metaData->created;
+        metaData->fileNode = newFile;
+        metaData->storedSize = fileSystem.storedSizeOf(newFile);
+
+        fileMetadata.insert(newFile->id, metaData);
+        versionsFor(newFile->id)->addVersion(content, newFile->content);
+        textIndex.index(newFile->id, dir->id, content);
+        logMutation(session, Log_Record(LOG_UPLOAD).number(dir->id).number(newFile->id).text(leaf)
+            .text(content).text(*metaData->type).text(*metaData->owner).number((uint64_t)metaData->created));
+        recordAccess(session, newFile->id, ACCESS_WRITE);
+        return DRIVE_OK;
+    }
+
+    // content receives the body; meta (optional) a copy of the file's metadata
+    Drive_Status downloadFile(Drive_Session& session, const string& path, string& content, File_Meta_data* meta = nullptr) {
+        if (!session.user) return DRIVE_NO_SESSION;
+        shared_lock<Distributed_Rw_Lock> engine(engineLock);
+        string leaf;
+        TreeNode* dir = fileSystem.resolveParent(path, session.cwd, leaf);
+        if (!dir || leaf.empty()) return DRIVE_NOT_FOUND;
+
+        shared_lock<Distributed_Rw_Lock> guard(fileSystem.lockOf(dir));
+        TreeNode* file = fileSystem.findChild(dir, leaf);
+        File_Meta_data* found = file && file->isFile ? fileMetadata.search(file->id) : nullptr;
+        if (!found) return DRIVE_NOT_FOUND;
+        if (!mayAccess(session, found, file, SHARE_VIEW)) return DRIVE_DENIED;
+        content = fileSystem.readContent(file);
+        if (meta) *meta = *found;
+        recordAccess(session, file->id, ACCESS_READ);
+        return DRIVE_OK;
+    }
+
+    // whether editFile would be allowed, before the caller collects the new content
+    Drive_Status checkEditable(Drive_Session& session, const string& path) {
+        if (!session.user) return DRIVE_NO_SESSION;
+        shared_lock<Distributed_Rw_Lock> engine(engineLock);
+        string leaf;
+        TreeNode* dir = fileSystem.resolveParent(path, session.cwd, leaf);
+        if (!dir || leaf.empty()) return DRIVE_NOT_FOUND;
+
+        shared_lock<Distributed_Rw_Lock> guard(fileSystem.lockOf(dir));
+        TreeNode* file = fileSystem.findChild(dir, leaf);
+        File_Meta_data* meta = file && file->isFile ? fileMetadata.search(file->id) : nullptr;
+        if (!meta) return DRIVE_NOT_FOUND;
+        return mayAccess(session, meta, file, SHARE_EDIT) ? DRIVE_OK : DRIVE_DENIED;
+    }
+
+    // the file's recorded versions, oldest first; viewing them needs SHARE_VIEW
+    Drive_Status versionHistory(Drive_Session& session, const string& path, vector<Version_Info>& history) {
+        if (!session.user) return DRIVE_NO_SESSION;
+        shared_lock<Distributed_Rw_Lock> engine(engineLock);
+        string leaf;
+        TreeNode* dir = fileSystem.resolveParent(path, session.cwd, leaf);
+        if (!dir || leaf.empty()) return DRIVE_NOT_FOUND;
+
+        shared_lock<Distributed_Rw_Lock> guard(fileSystem.lockOf(dir));
+        TreeNode* file = fileSystem.findChild(dir, leaf);
+        File_Meta_data* meta = file && file->isFile ? fileMetadata.search(file->id) : nullptr;
+        if (!meta) return DRIVE_NOT_FOUND;
+        if (!mayAccess(session, meta, file, SHARE_VIEW)) return DRIVE_DENIED;
+        history = versionsFor(file->id)->history();
+        return DRIVE_OK;
+    }
+
+    // the body of one version (1 = oldest)
+    Drive_Status readVersion(Drive_Session& session, const string& path, int versionNumber, string& content) {
+        if (!session.user) return DRIVE_NO_SESSION;
+        shared_lock<Distributed_Rw_Lock> engine(engineLock);
+        string leaf;
+        TreeNode* dir = fileSystem.resolveParent(path, session.cwd, leaf);
+        if (!dir || leaf.empty()) return DRIVE_NOT_FOUND;
+
+        shared_lock<Distributed_Rw_Lock> guard(fileSystem.lockOf(dir));
+        TreeNode* file = fileSystem.findChild(dir, leaf);
+        File_Meta_data* meta = file && file->isFile ? fileMetadata.search(file->id) : nullptr;
+        if (!meta) return DRIVE_NOT_FOUND;
+        if (!mayAccess(session, meta, file, SHARE_VIEW)) return DRIVE_DENIED;
+        File_Version_List* versions = versionsFor(file->id);
+        if (!versions->hasVersion(versionNumber)) return DRIVE_EMPTY;
+        content = versions->getVersion(versionNumber);
+        recordAccess(session, file->id, ACCESS_READ);
+        return DRIVE_OK;
+    }
+
+    Drive_Status editFile(Drive_Session& session, const string& path, const string& newContent) {
+        if (!session.user) return DRIVE_NO_SESSION;
+        shared_lock<Distributed_Rw_Lock> engine(engineLock);
+        string leaf;
+        TreeNode* dir = fileSystem.resolveParent(path, session.cwd, leaf);
+        if (!dir || leaf.empty()) return DRIVE_NOT_FOUND;
+
+        lock_guard<Distributed_Rw_Lock> guard(fileSystem.lockOf(dir));
+        TreeNode* file = fileSystem.findChild(dir, leaf);
+        File_Meta_data* meta = file && file->isFile ? fileMetadata.search(file->id) : nullptr;
+        if (!meta) return DRIVE_NOT_FOUND;
+        if (!mayAccess(session, meta, file, SHARE_EDIT)) return DRIVE_DENIED;
+
+        fileSystem.writeContent(file, newContent);
+        meta->size = newContent.size();
+        meta->storedSize = fileSystem.storedSizeOf(file);
+        meta->modified = Coarse_Clock::now();
+        fileMetadata.refresh(file->id);
+        versionsFor(file->id)->addVersion(newContent, file->content);
+        textIndex.index(file->id, dir->id, newContent);
+        logMutation(session, Log_Record(LOG_REWRITE).number(file->id).text(newContent).number((uint64_t)meta->modified));
+        recordAccess(session, file->id, ACCESS_WRITE);
+        return DRIVE_OK;
+    }
+
+    // moves the file to the recycle bin
+    Drive_Status deleteFile(Drive_Session& session, const string& path) {
+        if (!session.user) return DRIVE_NO_SESSION;
+        shared_lock<Distributed_Rw_Lock> engine(engineLock);
+        string leaf;
+        TreeNode* dir = fileSystem.resolveParent(path, session.cwd, leaf);
+        if (!dir || leaf.empty()) return DRIVE_NOT_FOUND;
+
+        lock_guard<Distributed_Rw_Lock> guard(fileSystem.lockOf(dir));
+        TreeNode* fileToDelete = fileSystem.findChild(dir, leaf);
+        if (!fileToDelete || !fileToDelete->isFile) return DRIVE_NOT_FOUND;
+        File_Meta_data* meta = fileMetadata.search(fileToDelete->id);
+        if (!meta) return DRIVE_FAILED;
+        if (*meta->owner != session.user->userId) return DRIVE_DENIED;
+        if (!fileSystem.removeFile(fileToDelete)) return DRIVE_FAILED;
+
+        fileMetadata.detach(fileToDelete->id);      // travels with the file
+        textIndex.remove(fileToDelete->id);
+        {
+            lock_guard<mutex> bin(binLock);
+            int64_t deletedAt = Coarse_Clock::now();
+            recycleBin.push(fileToDelete, meta, dir->id, deletedAt);
+            logMutation(session, Log_Record(LOG_RECYCLE).number(fileToDelete->id).text(string())
+                .number((uint64_t)deletedAt));
+            recordAccess(session, fileToDelete->id, ACCESS_DELETE);     // the bin may free it once we let go
+        }
+        return DRIVE_OK;
+    }
+
+    // Restores one binned file into the folder it was deleted from, as it
+    // was: same id, body, metadata and history.  Only its owner may.
+    Drive_Status restoreById(Drive_Session& session, uint64_t fileId, string* restoredName = nullptr) {
+        if (!session.user) return DRIVE_NO_SESSION;
+        shared_lock<Distributed_Rw_Lock> engine(engineLock);
+        uint64_t parentId;
+        {
+            lock_guard<mutex> bin(binLock);
+            const Bin_Entry* entry = recycleBin.find(fileId);
+            if (!entry) return DRIVE_NOT_FOUND;
+            parentId = entry->parentId;
+        }
+        TreeNode* dir = parentId ? fileSystem.findById(parentId) : nullptr;
+        if (!dir) dir = fileSystem.getRoot();       // folders are never freed; only older bins lack one
+
+        lock_guard<Distributed_Rw_Lock> guard(fileSystem.lockOf(dir));
+        lock_guard<mutex> bin(binLock);
+        const Bin_Entry* entry = recycleBin.find(fileId);
+        if (!entry || entry->parentId != parentId) return DRIVE_NOT_FOUND;     // restored meanwhile
+        if (restoredName) *restoredName = entry->file->name;
+        if (entry->meta && *entry->meta->owner != session.user->userId) return DRIVE_DENIED;
+        if (!relinkRecycled(fileId, dir, fileId, session.user->userId)) {
+            return fileSystem.findChild(dir, entry->file->name) ? DRIVE_EXISTS : DRIVE_FAILED;
+        }
+        logMutation(session, Log_Record(LOG_UNRECYCLE).number(fileId).number(dir->id).text(session.user->userId));
+        recordAccess(session, fileId, ACCESS_WRITE);
+        return DRIVE_OK;
+    }
+
+    // restores the most recently deleted file, or the most recently deleted one called name
+    Drive_Status restoreFile(Drive_Session& session, string* restoredName = nullptr, const string& name = "") {
+        if (!session.user) return DRIVE_NO_SESSION;
+        uint64_t fileId;
+        {
+            shared_lock<Distributed_Rw_Lock> engine(engineLock);
+            lock_guard<mutex> bin(binLock);
+            const Bin_Entry* entry = name.empty() ? recycleBin.newest() : recycleBin.newestNamed(name);
+            if (!entry) return name.empty() ? DRIVE_EMPTY : DRIVE_NOT_FOUND;
+            fileId = entry->file->id;
+        }
+        return restoreById(session, fileId, restoredName);
+    }
+
+    // restores every file of the session's user that is in the bin; restored
+    // counts them.  Files whose name is taken again stay binned.
+    Drive_Status restoreAll(Drive_Session& session, size_t* restored = nullptr) {
+        if (!session.user) return DRIVE_NO_SESSION;
+        vector<uint64_t> mine;
+        {
+            shared_lock<Distributed_Rw_Lock> engine(engineLock);
+            lock_guard<mutex> bin(binLock);
+            recycleBin.forEach([&](const Bin_Entry& entry) {
+                if (!entry.meta || *entry.meta->owner == session.user->userId) mine.push_back(entry.file->id);
+            });
+        }
+        if (mine.empty()) return DRIVE_EMPTY;
+
+        size_t count = 0;
+        Drive_Status status = DRIVE_OK;
+        for (uint64_t fileId : mine) {
+            Drive_Status one = restoreById(session, fileId);
+            if (one == DRIVE_OK) count++;
+            else if (one != DRIVE_NOT_FOUND) status = one;      // gone already is fine
+        }
+        if (restored) *restored = count;
+        return status;
+    }
+
+    // frees everything in the bin, a step at a time, so other sessions
+    // keep deleting and restoring while it runs
+    Drive_Status emptyRecycleBin(Drive_Session& session) {
+        if (!session.user) return DRIVE_NO_SESSION;
+        int64_t cutoff = (int64_t)time(nullptr) + 1;       // not what gets deleted after we're done
+        while (purgeOldest(session, cutoff, PURGE_STEP) == PURGE_STEP) {}
+        return DRIVE_OK;
+    }
+
+    // Full-text search: found gets up to limit (path, score) pairs, best
+    // first, among the files the session's user may view.  Hits they can't
+    // see are dropped after ranking, so short pages ask the index for more.
+    Drive_Status searchFiles(Drive_Session& session, const string& query, size_t limit,
+        vector<pair<string, double>>& found) {
+        if (!session.user) return DRIVE_NO_SESSION;
+        found.clear();
+        if (!limit) return DRIVE_OK;
+        shared_lock<Distributed_Rw_Lock> engine(engineLock);
+        for (size_t wanted = limit;; wanted *= 4) {
+            vector<Text_Index::Hit> hits = textIndex.search(query, wanted);
+            found.clear();
+            for (const Text_Index::Hit& hit : hits) {
+                if (found.size() == limit) break;
+                TreeNode* dir = fileSystem.findById(hit.parentId);
+                if (!dir) continue;
+                // the folder's lock keeps the file where the index saw it
+                shared_lock<Distributed_Rw_Lock> guard(fileSystem.lockOf(dir));
+                TreeNode* file = fileSystem.findById(hit.fileId);
+                File_Meta_data* meta = file && file->parent == dir ? fileMetadata.search(file->id) : nullptr;
+                if (meta && mayAccess(session, meta, file, SHARE_VIEW)) found.emplace_back(fileSystem.pathOf(file), hit.score);
             }
-            current = current->next;
+            if (found.size() == limit || hits.size() < wanted) return DRIVE_OK;
         }
-        return "";
     }
 
-    void display_Versions() const {
-        if (!head) {
-            cout << "No versions available\n";
-            return;
+    // Up to limit files the session may view that pass filter, with their
+    // paths, ordered by size or date (largest or latest first unless
+    // ascending).  The columns propose; the tree and shares have the last word.
+    Drive_Status queryFiles(Drive_Session& session, const Metadata_Filter& filter, Metadata_Order order, bool ascending,
+        size_t limit, vector<pair<string, File_Meta_data>>& found) {
+        if (!session.user) return DRIVE_NO_SESSION;
+        found.clear();
+        if (!limit) return DRIVE_OK;
+        shared_lock<Distributed_Rw_Lock> engine(engineLock);
+        for (size_t wanted = limit;; wanted *= 4) {
+            vector<pair<uint64_t, uint64_t>> rows = fileMetadata.query().top(filter, order, wanted, ascending);
+            found.clear();
+            for (const pair<uint64_t, uint64_t>& row : rows) {
+                if (found.size() == limit) break;
+                TreeNode* dir = fileSystem.findById(row.second);
+                if (!dir) continue;
+                shared_lock<Distributed_Rw_Lock> guard(fileSystem.lockOf(dir));
+                TreeNode* file = fileSystem.findById(row.first);
+                File_Meta_data* meta = file && file->parent == dir ? fileMetadata.search(file->id) : nullptr;
+                if (meta && mayAccess(session, meta, file, SHARE_VIEW)) found.emplace_back(fileSystem.pathOf(file), *meta);
+            }
+            if (found.size() == limit || rows.size() < wanted) return DRIVE_OK;
         }
+    }
 
-        cout << "File Version History:\n";
-        VersionNode* current = head;
-        while (current) {
-            cout << "Version " << current->versionNumber << " ("
-                << current->modificationTime << ")\n";
-            current = current->next;
+    // files and bytes per owner across the drive; admin only
+    Drive_Status usageByOwner(Drive_Session& session, const Metadata_Filter& filter, vector<Owner_Usage>& usage) {
+        if (!session.user) return DRIVE_NO_SESSION;
+        if (session.user->userId != "admin") return DRIVE_DENIED;
+        shared_lock<Distributed_Rw_Lock> engine(engineLock);
+        usage = fileMetadata.query().usageByOwner(filter);
+        return DRIVE_OK;
+    }
+
+    // Paths of up to limit files and folders whose names match glob ("*"
+    // and "?" wildcards, or a plain substring); folders end in '/'.  Names
+    // are listed for everyone, as ls does.
+    Drive_Status findNames(Drive_Session& session, const string& glob, size_t limit, vector<string>& paths) {
+        if (!session.user) return DRIVE_NO_SESSION;
+        paths.clear();
+        shared_lock<Distributed_Rw_Lock> engine(engineLock);
+        for (const Name_Index::Match& match : fileSystem.findNames(glob, limit)) {
+            TreeNode* dir = fileSystem.findById(match.parentId);
+            if (!dir) continue;
+            shared_lock<Distributed_Rw_Lock> guard(fileSystem.lockOf(dir));
+            TreeNode* node = fileSystem.findById(match.nodeId);
+            if (node && node->parent == dir) paths.push_back(fileSystem.pathOf(node) + (node->isFile ? "" : "/"));
         }
+        return DRIVE_OK;
     }
-};
 
-// The Google Drive System
-class Google_Drive_System {
-private:
-    FileSystemTree fileSystem;
-    HashTable fileMetadata;
-    Recycle_Bin recycleBin;
-    Recent_Files_Queue recentFiles;
-    User_Graph userGraph;
-    User_Graph::UserNode* currentUser;
+    // gives targetUser "view" or "edit" on a file, or on a folder and
+    // everything under it, replacing whatever they had there
+    Drive_Status shareFile(Drive_Session& session, const string& path, const string& targetUser, const string& permission) {
+        if (!session.user) return DRIVE_NO_SESSION;
+        uint8_t permissions = parsePermission(permission);
+        if (!permissions) return DRIVE_BAD_COMMAND;
+        shared_lock<Distributed_Rw_Lock> engine(engineLock);
+        string leaf;
+        TreeNode* dir = fileSystem.resolveParent(path, session.cwd, leaf);
+        if (!dir || leaf.empty()) return DRIVE_NOT_FOUND;
+
+        shared_lock<Distributed_Rw_Lock> guard(fileSystem.lockOf(dir));
+        TreeNode* node = fileSystem.findChild(dir, leaf);
+        if (!node) return DRIVE_NOT_FOUND;
+        Drive_Status status = checkManage(session, node);
+        if (status != DRIVE_OK) return status;
+        User_Graph::UserNode* target = userGraph.findUser(targetUser);
+        if (!target) return DRIVE_UNKNOWN_USER;
+
+        acl.grant(node->id, session.user->uid, target->uid, permissions);
+        logMutation(session, Log_Record(LOG_GRANT).number(node->id).text(session.user->userId).text(targetUser)
+            .number(permissions));
+        return DRIVE_OK;
+    }
 
-public:
-    Google_Drive_System() : currentUser(nullptr) {
-        // Initialize with admin user
-        userGraph.addUser("admin", "password", "Favorite color?", "blue");
+    Drive_Status unshareFile(Drive_Session& session, const string& path, const string& targetUser) {
+        if (!session.user) return DRIVE_NO_SESSION;
+        shared_lock<Distributed_Rw_Lock> engine(engineLock);
+        string leaf;
+        TreeNode* dir = fileSystem.resolveParent(path, session.cwd, leaf);
+        if (!dir || leaf.empty()) return DRIVE_NOT_FOUND;
+
+        shared_lock<Distributed_Rw_Lock> guard(fileSystem.lockOf(dir));
+        TreeNode* node = fileSystem.findChild(dir, leaf);
+        if (!node) return DRIVE_NOT_FOUND;
+        Drive_Status status = checkManage(session, node);
+        if (status != DRIVE_OK) return status;
+        User_Graph::UserNode* target = userGraph.findUser(targetUser);
+        if (!target) return DRIVE_UNKNOWN_USER;
+        if (!acl.revoke(node->id, target->uid)) return DRIVE_NOT_FOUND;
+
+        logMutation(session, Log_Record(LOG_REVOKE).number(node->id).text(targetUser));
+        return DRIVE_OK;
     }
 
-    ~Google_Drive_System() {
-        if (currentUser) {
-            userGraph.logout(currentUser);
+    // Files and folders shared with the session's user (withMe) or by them,
+    // through visit(path, other user, permission bits).  Binned files are
+    // left out.  Folders never move, so locking the node's own folder is
+    // enough to keep its path still, as in findNames.
+    template <typename Visit>
+    Drive_Status listShares(Drive_Session& session, bool withMe, Visit visit) {
+        if (!session.user) return DRIVE_NO_SESSION;
+        shared_lock<Distributed_Rw_Lock> engine(engineLock);
+        vector<Share_Graph::Grant> grants;
+        auto collect = [&](const Share_Graph::Grant& grant) { grants.push_back(grant); };
+        if (withMe) acl.shares().forEachSharedWith(session.user->uid, collect);
+        else acl.shares().forEachSharedBy(session.user->uid, collect);
+
+        for (const Share_Graph::Grant& grant : grants) {
+            string path;
+            uint64_t parentId;
+            if (grant.nodeId == fileSystem.getRoot()->id) {
+                path = fileSystem.pathOf(fileSystem.getRoot()) + "/";
+            }
+            else if (fileSystem.parentIdOf(grant.nodeId, parentId)) {
+                TreeNode* dir = fileSystem.findById(parentId);
+                if (!dir) continue;
+                shared_lock<Distributed_Rw_Lock> guard(fileSystem.lockOf(dir));
+                TreeNode* node = fileSystem.findById(grant.nodeId);
+                if (!node || node->parent != dir) continue;
+                path = fileSystem.pathOf(node) + (node->isFile ? "" : "/");
+            }
+            else {
+                continue;
+            }
+            string other;
+            {
+                lock_guard<mutex> guard(usersLock);
+                User_Graph::UserNode* user = userGraph.userAt(withMe ? grant.owner : grant.grantee);
+                if (user) other = user->userId;
+            }
+            visit(path, other, grant.permissions);
+        }
+        return DRIVE_OK;
+    }
+
+    // the session's directory: its path and, through visit(name, isFile), its entries
+    template <typename Visit>
+    Drive_Status listDirectory(Drive_Session& session, string& path, Visit visit) {
+        if (!session.user) return DRIVE_NO_SESSION;
+        shared_lock<Distributed_Rw_Lock> engine(engineLock);
+        shared_lock<Distributed_Rw_Lock> guard(fileSystem.lockOf(session.cwd));
+        path = fileSystem.pathOf(session.cwd);
+        session.cwd->children.forEach([&](const TreeNode* child) { visit(child->name, child->isFile); });
+        return DRIVE_OK;
+    }
+
+    // ---- batch mode ----
+
+    // Runs a command script in a session of its own, one command per line:
+    //   login <user> <password>    resume <token>      logout
+    //   mkdir <dir>    cd <dir|..|path>    pwd    ls
+    //   put <file> <content>       edit <file> <content>
+    //   get <file>     stat <file>     rm <file>
+    //   restore [file]     restoreall      purge
+    //   share <path> <user> <view|edit>   unshare <path> <user>   (files or folders)
+    //   shared [by]    what is shared with the session's user, or by them
+    //   search <words, "phrases", OR>      best matching files the user can see
+    //   find <glob>    files and folders by name, e.g. *invoice*2025*
+    //   query [owner=<user>] [type=<type>] [min=<bytes>] [max=<bytes>] [days=<n>]
+    //         [sort=size|modified|created] [asc] [top=<n>]     files by metadata
+    //   usage [the same filters]       files and bytes per owner (admin)
+    // login answers with a token that resume accepts, in this script or another.
+    // Content runs to the end of the line, with \n, \t, \r and \\ escapes.
+    // Blank lines and lines starting with '#' are skipped.  Each command
+    // writes one line: [tag]<status>\t<command>[\t<field>...].  Results are
+    // written a batch at a time, after the batch's mutations are durable.
+    // Scripts may run concurrently, each on its own thread.
+    // Returns the number of commands that failed.
+    size_t runScript(istream& in, ostream& out, const string& tag = "") {
+        Drive_Session session;
+        string line, results;
+        size_t failures = 0, pending = 0;
+        vector<string> args;
+        session.deferSync = true;
+
+        auto flush = [&]() {
+            if (!syncBatch(session)) {
+                results += tag + "failed\tjournal\n";
+                failures++;
+            }
+            {
+                lock_guard<mutex> guard(outputLock);
+                out.write(results.data(), results.size());
+            }
+            results.clear();
+            pending = 0;
+            maybeCheckpoint();
+        };
+
+        while (getline(in, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            size_t at = line.find_first_not_of(" \t");
+            if (at == string::npos || line[at] == '#') continue;
+
+            // the command and up to three arguments; put/edit keep the rest of the line as
+            // content, and search as its query
+            args.clear();
+            string rest;
+            while (at < line.size() && args.size() < 4) {
+                size_t end = line.find_first_of(" \t", at);
+                if (end == string::npos) end = line.size();
+                args.push_back(line.substr(at, end - at));
+                at = end < line.size() ? end + 1 : end;
+                if (args.size() == 2 && (args[0] == "put" || args[0] == "edit")) {
+                    rest = unescapeField(line.data() + at, line.size() - at);
+                    break;
+                }
+                if (args.size() == 1 && (args[0] == "search" || args[0] == "query" || args[0] == "usage")) {
+                    rest = line.substr(at);
+                    break;
+                }
+                at = line.find_first_not_of(" \t", at);
+                if (at == string::npos) at = line.size();
+            }
+
+            results += tag;
+            Drive_Status status = runCommand(session, args, rest, results);
+            if (status != DRIVE_OK) failures++;
+            if (++pending == SCRIPT_BATCH) flush();
+        }
+        flush();
+        if (session.user && !session.resumed) logout(session);     // a resumed login belongs to whoever began it
+        return failures;
+    }
+
+private:
+    // "owner=bob type=txt min=1024 days=7 sort=modified asc top=20"; false
+    // on anything it doesn't know
+    static bool parseMetadataQuery(const string& text, Metadata_Filter& filter, Metadata_Order& order,
+        bool& ascending, size_t& limit) {
+        for (size_t at = text.find_first_not_of(" \t"); at != string::npos; at = text.find_first_not_of(" \t", at)) {
+            size_t stop = text.find_first_of(" \t", at);
+            string word = text.substr(at, stop - at);
+            at = stop;
+            size_t equals = word.find('=');
+            string key = word.substr(0, equals), value = equals == string::npos ? string() : word.substr(equals + 1);
+            char* end = nullptr;
+            unsigned long long number = strtoull(value.c_str(), &end, 10);
+            bool numeric = !value.empty() && *end == '\0';
+            if (key == "asc" && equals == string::npos) ascending = true;
+            else if (key == "owner" && !value.empty()) filter.owner = value;
+            else if (key == "type" && !value.empty()) filter.type = value;
+            else if (key == "min" && numeric) filter.minSize = number;
+            else if (key == "max" && numeric) filter.maxSize = number;
+            else if (key == "days" && numeric) filter.modifiedFrom = (int64_t)time(nullptr) - (int64_t)number * 86400;
+            else if (key == "top" && numeric && number) limit = (size_t)number;
+            else if (key == "sort" && value == "size") order = ORDER_SIZE;
+            else if (key == "sort" && value == "modified") order = ORDER_MODIFIED;
+            else if (key == "sort" && value == "created") order = ORDER_CREATED;
+            else return false;
+        }
+        return true;
+    }
+
+    // runs one parsed script command and appends its result line
+    Drive_Status runCommand(Drive_Session& session, const vector<string>& args, const string& content, string& results) {
+        const string& command = args[0];
+        size_t argc = args.size() - 1;
+        string fields;
+        Drive_Status status = DRIVE_BAD_COMMAND;
+
+        if (command == "login" && argc == 2) {
+            status = login(session, args[1], args[2]);
+            if (status == DRIVE_OK) {
+                fields += '\t';
+                fields += session.token.hex();
+            }
+        }
+        else if (command == "resume" && argc == 1) {
+            status = resume(session, Session_Token::parse(args[1]));
+        }
+        else if (command == "logout" && argc == 0) status = logout(session);
+        else if (command == "mkdir" && argc == 1) status = createDirectory(session, args[1]);
+        else if (command == "cd" && argc == 1) status = changeDirectory(session, args[1]);
+        else if ((command == "put" || command == "edit") && argc == 1) {
+            status = command == "put" ? uploadFile(session, args[1], content) : editFile(session, args[1], content);
+        }
+        else if (command == "rm" && argc == 1) status = deleteFile(session, args[1]);
+        else if (command == "find" && argc == 1) {
+            vector<string> paths;
+            status = findNames(session, args[1], FIND_PAGE, paths);
+            for (const string& path : paths) {
+                fields += '\t';
+                appendEscaped(fields, path);
+            }
+        }
+        else if (command == "search" && argc == 0) {
+            vector<pair<string, double>> found;
+            status = searchFiles(session, content, SEARCH_PAGE, found);
+            char score[32];
+            for (const pair<string, double>& hit : found) {
+                fields += '\t';
+                appendEscaped(fields, hit.first);
+                snprintf(score, sizeof(score), " %.3f", hit.second);
+                fields += score;
+            }
+        }
+        else if (command == "query" && argc == 0) {
+            Metadata_Filter filter;
+            Metadata_Order order = ORDER_SIZE;
+            bool ascending = false;
+            size_t limit = QUERY_PAGE;
+            vector<pair<string, File_Meta_data>> found;
+            if (parseMetadataQuery(content, filter, order, ascending, limit)) {
+                status = queryFiles(session, filter, order, ascending, limit, found);
+            }
+            for (const pair<string, File_Meta_data>& hit : found) {
+                fields += '\t';
+                appendEscaped(fields, hit.first);
+                fields += ' ' + to_string(hit.second.size) + ' ';
+                appendEscaped(fields, formatTime(hit.second.modified));
+            }
+        }
+        else if (command == "usage" && argc == 0) {
+            Metadata_Filter filter;
+            Metadata_Order order;
+            bool ascending;
+            size_t limit;
+            vector<Owner_Usage> usage;
+            if (parseMetadataQuery(content, filter, order, ascending, limit)) status = usageByOwner(session, filter, usage);
+            for (const Owner_Usage& owner : usage) {
+                fields += '\t';
+                appendEscaped(fields, owner.owner);
+                fields += ' ' + to_string(owner.files) + ' ' + to_string(owner.bytes);
+            }
+        }
+        else if (command == "purge" && argc == 0) status = emptyRecycleBin(session);
+        else if (command == "share" && argc == 3) status = shareFile(session, args[1], args[2], args[3]);
+        else if (command == "unshare" && argc == 2) status = unshareFile(session, args[1], args[2]);
+        else if (command == "shared" && (argc == 0 || (argc == 1 && args[1] == "by"))) {
+            status = listShares(session, argc == 0, [&](const string& path, const string& user, uint8_t permissions) {
+                fields += '\t';
+                appendEscaped(fields, path);
+                fields += ' ';
+                appendEscaped(fields, user);
+                fields += ' ';
+                fields += permissionName(permissions);
+            });
+        }
+        else if (command == "restore" && argc <= 1) {
+            string name;
+            status = restoreFile(session, &name, argc ? args[1] : string());
+            if (status == DRIVE_OK) {
+                fields += '\t';
+                appendEscaped(fields, name);
+            }
+        }
+        else if (command == "restoreall" && argc == 0) {
+            size_t restored = 0;
+            status = restoreAll(session, &restored);
+            fields += '\t' + to_string(restored);
+        }
+        else if ((command == "get" || command == "stat") && argc == 1) {
+            string body;
+            File_Meta_data meta;
+            status = downloadFile(session, args[1], body, &meta);
+            if (status == DRIVE_OK && command == "get") {
+                fields += '\t';
+                appendEscaped(fields, body);
+            }
+            else if (status == DRIVE_OK) {
+                fields += '\t' + to_string(meta.fileNode->id) + '\t' + to_string(meta.size) + '\t'
+                    + to_string(meta.storedSize) + '\t';
+                appendEscaped(fields, *meta.owner);
+                fields += '\t';
+                appendEscaped(fields, formatTime(meta.modified));
+            }
+        }
+        else if ((command == "pwd" || command == "ls") && argc == 0) {
+            string path;
+            status = listDirectory(session, path, [&](const string& name, bool isFile) {
+                if (command == "pwd") return;
+                fields += '\t';
+                appendEscaped(fields, name);
+                if (!isFile) fields += '/';
+            });
+            if (status == DRIVE_OK && command == "pwd") {
+                fields += '\t';
+                appendEscaped(fields, path);
+            }
         }
+
+        results += statusName(status);
+        results += '\t';
+        appendEscaped(results, command);
+        results += fields;
+        results += '\n';
+        return status;
     }
 
+public:
+
     void display_Main_Menu() {
         cout << "====================================================\n";
         cout << "\n   WELCOME TO GOOGLE DRIVE MANAGEMENT SYSTEM\n";
@@ -659,22 +7132,25 @@ public:
     }
 
     void run() {
-        while (true) {
-            srand(time(0));
-            int background = rand() % 8;
-            int text = rand() % 16;
-
-            // Ensure background and text colors are not the same
-            while (background == text) {
-                text = rand() % 16;
-            }
+#ifdef _WIN32
+        // pick the console colours once per run, not once per command
+        srand((unsigned)time(0));
+        int background = rand() % 8;
+        int text = rand() % 16;
+
+        // Ensure background and text colors are not the same
+        while (background == text) {
+            text = rand() % 16;
+        }
 
-            char colorCode[3];
-            snprintf(colorCode, sizeof(colorCode), "%X%X", background, text);
+        char colorCode[3];
+        snprintf(colorCode, sizeof(colorCode), "%X%X", background, text);
 
-            string command = string("color ") + colorCode;
-            system(command.c_str());
+        string command = string("color ") + colorCode;
+        system(command.c_str());
+#endif
 
+        while (true) {
             // Display main menu
             display_Main_Menu();
 
@@ -692,22 +7168,27 @@ public:
             case 3: share_File(); break;
             case 4: view_Version_History(); break;
             case 5: accessRecycleBin(); break;
-            case 6: recentFiles.display(); break;
+            case 6: recentFiles(); break;
             case 7: addUser(); break;
             case 8: recoverPassword(); break;
             case 9: log_out(); break;
             case 10: compressionAlgorithm(); break;
-            case 11: return;
+            case 11:
+                if (!snapshotPath.empty() && !checkpoint()) {
+                    cout << "Warning: could not save the drive to '" << snapshotPath << "'.\n";
+                }
+                return;
             default:
                 cout << "Invalid choice. Please enter a number between 1 and 10.\n";
                 cin.ignore(numeric_limits<streamsize>::max(), '\n');
             }
+            maybeCheckpoint();
         }
     }
 
     void log_in() {
-        if (currentUser) {
-            cout << "Already logged in as " << currentUser->userId << endl;
+        if (console.user) {
+            cout << "Already logged in as " << console.user->userId << endl;
             return;
         }
 
@@ -717,8 +7198,7 @@ public:
         cout << "Enter password: ";
         cin >> password;
 
-        currentUser = userGraph.authenticate(userId, password);
-        if (currentUser) {
+        if (login(console, userId, password) == DRIVE_OK) {
             cout << "Login successful! Welcome, " << userId << endl;
             cout << "Current Time: " << getCurrentTime() << endl;
         }
@@ -728,11 +7208,11 @@ public:
     }
 
     void log_out() {
-        if (currentUser) {
-            userGraph.logout(currentUser);
-            cout << "Logged out successfully. Goodbye, " << currentUser->userId << endl;
+        if (console.user) {
+            string userId = console.user->userId;
+            logout(console);
+            cout << "Logged out successfully. Goodbye, " << userId << endl;
             cout << "Current Time: " << getCurrentTime() << endl;
-            currentUser = nullptr;
         }
         else {
             cout << "No user is currently logged in.\n";
@@ -740,37 +7220,36 @@ public:
     }
 
     void compressionAlgorithm() {
-        cout << "Applying file compression (RLE)...\n";
+        cout << "Applying file compression (LZ block codec)...\n";
         string content;
         cout << "Enter file content to compress: ";
         cin.ignore();
         getline(cin, content);
 
-        // Implement Run-Length Encoding (RLE)
-        string compressed = "";
-        int count = 1;
-        for (size_t i = 1; i < content.length(); i++) {
-            if (content[i] == content[i - 1]) {
-                count++;
-            }
-            else {
-                compressed += to_string(count) + content[i - 1];
-                count = 1;
-            }
+        if (content.empty()) {
+            cout << "Nothing to compress.\n";
+            return;
         }
-        compressed += to_string(count) + content[content.length() - 1];
-        cout << "Compressed content: " << compressed << endl;
+
+        string compressed, restored;
+        codec.compress(content.data(), content.size(), compressed);
+        bool verified = Block_Codec::decompress(compressed.data(), compressed.size(), restored) && restored == content;
+
+        cout << "Original size: " << content.size() << " bytes\n";
+        cout << "Compressed frame: " << compressed.size() << " bytes ("
+            << (100.0 * compressed.size() / content.size()) << "% of original)\n";
+        cout << (verified ? "Round trip verified.\n" : "Round trip FAILED.\n");
     }
 
     void browse_Files() {
-        if (!currentUser) {
+        if (!console.user) {
             cout << "\\\\\\\\ Please login first ////////\n";
             return;
         }
 
         while (true) {
             try {
-                fileSystem.listContents();
+                fileSystem.listContents(console.cwd);
 
                 cout << "\n1. Change directory\n";
                 cout << "2. Create directory\n";
@@ -778,14 +7257,16 @@ public:
                 cout << "4. Download file\n";
                 cout << "5. Edit/Update file\n";
                 cout << "6. Delete file\n";
-                cout << "7. Back to main menu\n";
+                cout << "7. Search file contents\n";
+                cout << "8. Find files and folders by name\n";
+                cout << "9. Back to main menu\n";
 
                 cout << "Enter choice: ";
                 string input;
                 cin >> input;
 
-                if (input.length() != 1 || input[0] < '1' || input[0] > '7') {
-                    throw invalid_argument("Invalid input! Please enter a number from 1 to 7.");
+                if (input.length() != 1 || input[0] < '1' || input[0] > '9') {
+                    throw invalid_argument("Invalid input! Please enter a number from 1 to 9.");
                 }
 
                 int choice = stoi(input);
@@ -795,11 +7276,14 @@ public:
                     cout << "Enter directory name (or '..' for parent): ";
                     cin >> dirName;
 
-                    if (fileSystem.changeDirectory(dirName)) {
+                    if (changeDirectory(console, dirName) == DRIVE_OK) {
                         cout << "Changed to directory: " << dirName << endl;
                     }
+                    else if (dirName == "..") {
+                        cout << "Already at the root directory.\n";
+                    }
                     else {
-                        cout << "Directory not found.\n";
+                        cout << "Directory not found: " << dirName << endl;
                     }
                 }
                 else if (choice == 2) {  // Create directory
@@ -807,9 +7291,13 @@ public:
                     cout << "Enter new directory name: ";
                     cin >> dirName;
 
-                    if (fileSystem.makeDirectory(dirName)) {
+                    Drive_Status status = createDirectory(console, dirName);
+                    if (status == DRIVE_OK) {
                         cout << "Directory '" << dirName << "' created successfully.\n";
                     }
+                    else if (status == DRIVE_EXISTS) {
+                        cout << "A directory with the name '" << dirName << "' already exists.\n";
+                    }
                     else {
                         cout << "Failed to create directory.\n";
                     }
@@ -822,52 +7310,37 @@ public:
                     cin.ignore();
                     getline(cin, content);
 
-                    if (fileSystem.findFile(fileName)) {
+                    Drive_Status status = uploadFile(console, fileName, content);
+                    if (status == DRIVE_EXISTS) {
                         cout << "File '" << fileName << "' already exists in the directory.\n";
-                        continue;
                     }
-
-                    TreeNode* newFile = fileSystem.createFile(fileName, content);
-                    if (!newFile) {
+                    else if (status != DRIVE_OK) {
                         cout << "Failed to create the file. Please try again.\n";
-                        continue;
                     }
-
-                    // Add metadata
-                    File_Meta_data* metaData = new File_Meta_data();
-                    metaData->name = fileName;
-                    metaData->type = "txt";
-                    metaData->size = content.size();
-                    metaData->owner = currentUser ? currentUser->userId : "Unknown";
-                    metaData->creationDate = getCurrentTime();
-                    metaData->lastModified = getCurrentTime();
-                    metaData->fileNode = newFile;
-
-                    fileMetadata.insert(fileName, metaData);
-                    cout << "File '" << fileName << "' uploaded successfully.\n";
-
-                    // Add to Recent Files
-                    recentFiles.enqueue(newFile);
+                    else {
+                        cout << "File '" << fileName << "' uploaded successfully.\n";
+                    }
                 }
                 else if (choice == 4) {  // Download file
                     string fileName;
                     cout << "Enter file name to download: ";
                     cin >> fileName;
 
-                    File_Meta_data* meta = fileMetadata.search(fileName);
-                    if (meta && meta->fileNode) {
-                        TreeNode* file = meta->fileNode;
-                        cout << "\nFile Name: " << meta->name << endl;
-                        cout << "Type: " << meta->type << endl;
-                        cout << "Size: " << meta->size << " bytes" << endl;
-                        cout << "Owner: " << meta->owner << endl;
-                        cout << "Created: " << meta->creationDate << endl;
-                        cout << "Last Modified: " << meta->lastModified << endl;
-                        cout << "Content:\n" << file->content << endl;
+                    string content;
+                    File_Meta_data meta;
+                    Drive_Status status = downloadFile(console, fileName, content, &meta);
+                    if (status == DRIVE_OK) {
+                        cout << "\nFile Name: " << fileName.substr(fileName.find_last_of('/') + 1) << endl;
+                        cout << "Type: " << *meta.type << endl;
+                        cout << "Size: " << meta.size << " bytes (" << meta.storedSize << " stored)" << endl;
+                        cout << "Owner: " << *meta.owner << endl;
+                        cout << "Created: " << formatTime(meta.created) << endl;
+                        cout << "Last Modified: " << formatTime(meta.modified) << endl;
+                        cout << "Content:\n" << content << endl;
                         cout << "File downloaded successfully!\n";
-
-                        // Add to Recent Files
-                        recentFiles.enqueue(file);
+                    }
+                    else if (status == DRIVE_DENIED) {
+                        cout << "Error: This file hasn't been shared with you.\n";
                     }
                     else {
                         cout << "File not found.\n";
@@ -878,13 +7351,13 @@ public:
                     cout << "Enter the name of the file to edit: ";
                     cin >> fileName;
 
-                    File_Meta_data* meta = fileMetadata.search(fileName);
-                    if (!meta || !meta->fileNode) {
+                    Drive_Status editable = checkEditable(console, fileName);
+                    if (editable == DRIVE_NOT_FOUND) {
                         cout << "File not found.\n";
                         continue;
                     }
 
-                    if (meta->owner != currentUser->userId) {
+                    if (editable != DRIVE_OK) {
                         cout << "Error: You don't have permission to edit this file.\n";
                         continue;
                     }
@@ -893,57 +7366,68 @@ public:
                     cin.ignore();
                     getline(cin, newContent);
 
-                    TreeNode* file = meta->fileNode;
-                    file->content = newContent;  // Update file content
-                    meta->size = newContent.size();  // Update metadata size
-                    meta->lastModified = getCurrentTime();  // Update last modified timestamp
-
-                    cout << "File '" << fileName << "' updated successfully.\n";
-
-                    // Add to Recent Files
-                    recentFiles.enqueue(file);
+                    if (editFile(console, fileName, newContent) == DRIVE_OK) {
+                        cout << "File '" << fileName << "' updated successfully.\n";
+                    }
+                    else {
+                        cout << "Failed to update the file.\n";
+                    }
                 }
                 else if (choice == 6) {  // Delete file
                     string fileName;
                     cout << "Enter the name of the file to delete: ";
                     cin >> fileName;
 
-                    TreeNode* fileToDelete = fileSystem.findFile(fileName);
-                    if (!fileToDelete) {
-                        cout << "File not found.\n";
-                        continue;
-                    }
-
-                    File_Meta_data* meta = fileMetadata.search(fileName);
-                    if (!meta) {
-                        cout << "Metadata for the file not found. Cannot delete.\n";
-                        continue;
-                    }
-
-                    if (meta->owner != currentUser->userId) {
-                        cout << "Error: You don't have permission to delete this file.\n";
-                        continue;
-                    }
-
-                    if (fileSystem.removeFile(fileName)) {
-                        recycleBin.push(fileToDelete);
-                        fileMetadata.remove(fileName);
+                    Drive_Status status = deleteFile(console, fileName);
+                    if (status == DRIVE_OK) {
                         cout << "File '" << fileName << "' has been deleted and moved to the Recycle Bin.\n";
-
-                        // Add to Recent Files (optional, for deleted files)
-                        recentFiles.enqueue(fileToDelete);
+                    }
+                    else if (status == DRIVE_NOT_FOUND) {
+                        cout << "File not found.\n";
+                    }
+                    else if (status == DRIVE_DENIED) {
+                        cout << "Error: You don't have permission to delete this file.\n";
                     }
                     else {
                         cout << "Failed to delete the file.\n";
                     }
                 }
-                else if (choice == 7) {  // Exit
+                else if (choice == 7) {  // Search
+                    string query;
+                    cout << "Enter words to find (\"quotes\" for a phrase, OR for either): ";
+                    cin.ignore();
+                    getline(cin, query);
+
+                    vector<pair<string, double>> found;
+                    searchFiles(console, query, SEARCH_PAGE, found);
+                    if (found.empty()) {
+                        cout << "No matching files.\n";
+                    }
+                    for (const pair<string, double>& hit : found) {
+                        cout << "- " << hit.first << " (score " << hit.second << ")\n";
+                    }
+                }
+                else if (choice == 8) {  // Find by name
+                    string glob;
+                    cout << "Enter a name, part of one, or a pattern like *invoice*2025*: ";
+                    cin >> glob;
+
+                    vector<string> paths;
+                    findNames(console, glob, FIND_PAGE, paths);
+                    if (paths.empty()) {
+                        cout << "Nothing found.\n";
+                    }
+                    for (const string& path : paths) {
+                        cout << "- " << path << endl;
+                    }
+                }
+                else if (choice == 9) {  // Exit
                     cout << "Returning to the main menu...\n";
                     break;
                 }
             }
             catch (const invalid_argument& e) {
-                cout << e.what() << "\nPlease enter a valid number from 1 to 7.\n";
+                cout << e.what() << "\nPlease enter a valid number from 1 to 9.\n";
                 cin.clear();
                 cin.ignore(numeric_limits<streamsize>::max(), '\n');
             }
@@ -956,25 +7440,61 @@ public:
     }
 
     void share_File() {
-        if (!currentUser) {
+        if (!console.user) {
             cout << "\\\\\\\\ Please login first ////////\n";
             return;
         }
+        cout << "1. Share a file or folder\n";
+        cout << "2. Stop sharing a file or folder\n";
+        cout << "3. Files shared with me\n";
+        cout << "4. Files I've shared\n";
+        int choice;
+        cin >> choice;
+
+        if (choice == 3 || choice == 4) {
+            size_t listed = 0;
+            listShares(console, choice == 3, [&](const string& path, const string& user, uint8_t permissions) {
+                cout << "- " << path << (choice == 3 ? " from " : " with ") << user
+                    << " (" << permissionName(permissions) << " access)\n";
+                listed++;
+            });
+            if (!listed) cout << "Nothing shared\n";
+            return;
+        }
+        if (choice != 1 && choice != 2) {
+            cout << "Invalid choice.\n";
+            return;
+        }
+
         string fileName, targetUser, permission;
-        cout << "Enter file name to share: ";
+        cout << "Enter file or folder name: ";
         cin >> fileName;
-        cout << "Enter user to share with: ";
+        cout << "Enter user: ";
         cin >> targetUser;
-        cout << "Enter permission (view/edit): ";
-        cin >> permission;
+        Drive_Status status;
+        if (choice == 1) {
+            cout << "Enter permission (view/edit): ";
+            cin >> permission;
+            status = shareFile(console, fileName, targetUser, permission);
+        }
+        else {
+            status = unshareFile(console, fileName, targetUser);
+        }
 
-        if (fileSystem.findFile(fileName)) {
-            if (userGraph.shareFile(currentUser, targetUser, fileName, permission)) {
-                cout << "File shared successfully with " << targetUser << endl;
-            }
-            else {
-                cout << "Failed to share file. User not found.\n";
-            }
+        if (status == DRIVE_OK) {
+            cout << (choice == 1 ? "File shared successfully with " : "File no longer shared with ") << targetUser << endl;
+        }
+        else if (status == DRIVE_UNKNOWN_USER) {
+            cout << "User not found.\n";
+        }
+        else if (status == DRIVE_DENIED) {
+            cout << "Only the owner can change who this is shared with.\n";
+        }
+        else if (status == DRIVE_BAD_COMMAND) {
+            cout << "Permission must be view or edit.\n";
+        }
+        else if (choice == 2) {
+            cout << "File not found, or not shared with " << targetUser << endl;
         }
         else {
             cout << "File not found\n";
@@ -982,7 +7502,7 @@ public:
     }
 
     void view_Version_History() {
-        if (!currentUser) {
+        if (!console.user) {
             cout << "\\\\\\\\ Please login first ////////\n";
             return;
         }
@@ -990,37 +7510,72 @@ public:
         cout << "Enter file name: ";
         cin >> fileName;
 
-        File_Version_List versions;
-        TreeNode* file = fileSystem.findFile(fileName);
-        if (file) {
-            versions.addVersion(file->content);
-            versions.addVersion("Previous version content");
-            versions.addVersion("Original content");
+        vector<Version_Info> history;
+        Drive_Status status = versionHistory(console, fileName, history);
+        if (status == DRIVE_DENIED) {
+            cout << "You don't have access to this file\n";
+            return;
+        }
+        if (status != DRIVE_OK) {
+            cout << "File not found\n";
+            return;
+        }
+        if (history.empty()) {
+            cout << "No versions available\n";
+            return;
+        }
 
-            versions.display_Versions();
+        cout << "File Version History:\n";
+        for (size_t i = 0; i < history.size(); i++) {
+            cout << "Version " << i + 1 << " ("
+                << formatTime(history[i].modifiedAt) << ", " << history[i].size << " bytes"
+                << (history[i].snapshot ? ", snapshot" : "") << ")\n";
+        }
 
-            cout << "\nEnter version number to view (0 to cancel): ";
-            int version;
-            cin >> version;
+        cout << "\nEnter version number to view (0 to cancel): ";
+        int version;
+        cin >> version;
 
-            if (version > 0) {
-                string content = versions.getVersion(version);
-                if (!content.empty()) {
-                    cout << "\nVersion " << version << " content:\n";
-                    cout << content << endl;
-                }
-                else {
-                    cout << "Invalid version number\n";
-                }
+        if (version > 0) {
+            string content;
+            status = readVersion(console, fileName, version, content);
+            if (status == DRIVE_OK) {
+                cout << "\nVersion " << version << " content:\n";
+                cout << content << endl;
+            }
+            else if (status == DRIVE_EMPTY) {
+                cout << "Invalid version number\n";
+            }
+            else {
+                cout << "File not found\n";
             }
         }
-        else {
-            cout << "File not found\n";
+    }
+
+    void recentFiles() {
+        if (!console.user) {
+            cout << "\\\\\\\\ Please login first ////////\n";
+            return;
+        }
+        catchUpAccesses();
+        if (!console.user->recentFiles.size()) {
+            cout << "No recent files\n";
+            return;
         }
+
+        cout << "Recently Accessed Files:\n";
+        int index = 1;
+        lock_guard<mutex> guard(accessLock);
+        console.user->recentFiles.forEach([&](uint64_t fileId, const string& name) {
+            File_Access_Counts* counts = accessCounts.find(fileId);
+            cout << index++ << ". " << name;
+            if (counts) cout << " (" << counts->reads << " reads, " << counts->writes << " writes)";
+            cout << endl;
+        });
     }
 
     void accessRecycleBin() {
-        if (!currentUser) {
+        if (!console.user) {
             cout << "\\\\\\\\ Please login first ////////\n";
             return;
         }
@@ -1031,48 +7586,50 @@ public:
 
             cout << "\nSelect an option:\n";
             cout << "1. Restore a file\n";
-            cout << "2. Empty recycle bin\n";
-            cout << "3. Back to main menu\n";
+            cout << "2. Restore all my files\n";
+            cout << "3. Empty recycle bin\n";
+            cout << "4. Back to main menu\n";
 
             int choice;
             cin >> choice;
 
             if (choice == 1) {
-                TreeNode* restoredFile = recycleBin.pop();
-                if (restoredFile) {
-                    TreeNode* parent = fileSystem.getCurrentDir();
-                    restoredFile->parent = parent;
-
-                    TreeNode* newNode = fileSystem.createFile(restoredFile->name, restoredFile->content);
-                    if (!newNode) {
-                        cout << "Failed to restore file.\n";
-                        return;
-                    }
-
-                    File_Meta_data* meta = new File_Meta_data();
-                    meta->name = restoredFile->name;
-                    meta->type = "txt";
-                    meta->size = restoredFile->content.size();
-                    meta->owner = currentUser->userId;
-                    meta->creationDate = getCurrentTime();
-                    meta->lastModified = getCurrentTime();
-                    meta->fileNode = newNode;
-                    fileMetadata.insert(restoredFile->name, meta);
-
-                    cout << "File '" << restoredFile->name << "' has been restored.\n";
+                string name;
+                cout << "Enter file name (or . for the most recent deletion): ";
+                cin >> name;
+                if (name == ".") name.clear();
+                Drive_Status status = restoreFile(console, &name, name);
+                if (status == DRIVE_OK) {
+                    cout << "File '" << name << "' has been restored.\n";
                 }
-                else {
+                else if (status == DRIVE_EMPTY) {
                     cout << "Recycle Bin is empty.\n";
                 }
+                else if (status == DRIVE_NOT_FOUND) {
+                    cout << "No file named '" << name << "' in the Recycle Bin.\n";
+                }
+                else if (status == DRIVE_EXISTS) {
+                    cout << "A file with the name '" << name << "' already exists in its folder.\n";
+                }
+                else if (status == DRIVE_DENIED) {
+                    cout << "Only the owner of '" << name << "' can restore it.\n";
+                }
+                else {
+                    cout << "Failed to restore file.\n";
+                    return;
+                }
             }
             else if (choice == 2) {
-                while (!recycleBin.isEmpty()) {
-                    TreeNode* deletedFile = recycleBin.pop();
-                    delete deletedFile;
-                }
-                cout << "Recycle Bin emptied.\n";
+                size_t restored = 0;
+                Drive_Status status = restoreAll(console, &restored);
+                cout << restored << " file(s) restored.\n";
+                if (status == DRIVE_EXISTS) cout << "Some files stayed in the bin: their names are taken.\n";
             }
             else if (choice == 3) {
+                emptyRecycleBin(console);
+                cout << "Recycle Bin emptied.\n";
+            }
+            else if (choice == 4) {
                 cout << "Returning to main menu.\n";
                 break;
             }
@@ -1083,12 +7640,12 @@ public:
     }
 
     void addUser() {
-        if (!currentUser) {
+        if (!console.user) {
             cout << "\\\\\\\\ Please login first ////////\n";
             return;
         }
 
-        if (currentUser->userId != "admin") {
+        if (console.user->userId != "admin") {
             cout << "Only the admin can add new users.\n";
             return;
         }
@@ -1104,7 +7661,12 @@ public:
         cout << "Enter answer to the security question: ";
         getline(cin, answer);
 
+        shared_lock<Distributed_Rw_Lock> engine(engineLock);
+        lock_guard<mutex> guard(usersLock);
         if (userGraph.addUser(userId, password, question, answer)) {
+            User_Graph::UserNode* user = userGraph.findUser(userId);
+            logMutation(console, Log_Record(LOG_REGISTER).text(userId).text(user->password.load()->bytes())
+                .text(question).text(user->securityAnswer.bytes()));
             cout << "User '" << userId << "' added successfully!\n";
         }
         else {
@@ -1112,18 +7674,1042 @@ public:
         }
     }
 
+    // only hashes are kept, so recovery sets a new password rather than
+    // showing the old one
     void recoverPassword() {
         string userId;
         cout << "Enter your user ID: ";
         cin >> userId;
 
-        if (!userGraph.recoverPassword(userId)) {
+        User_Graph::UserNode* user = userGraph.findUser(userId);
+        if (!user) {
+            cout << "User ID not found.\n";
+            cout << "Password recovery failed.\n";
+            return;
+        }
+
+        cout << "Security Question: " << user->securityQuestion << endl;
+        cout << "Enter your answer: ";
+        string answer;
+        cin.ignore();
+        getline(cin, answer);
+        if (!user->securityAnswer.matches(answer)) {
+            cout << "Incorrect answer. Cannot recover password.\n";
+            cout << "Password recovery failed.\n";
+            return;
+        }
+
+        string password;
+        cout << "Enter new password: ";
+        cin >> password;
+
+        shared_lock<Distributed_Rw_Lock> engine(engineLock);
+        lock_guard<mutex> guard(usersLock);
+        Secret_Hash hash;
+        if (!userGraph.resetPassword(user, password, hash)) {
             cout << "Password recovery failed.\n";
+            return;
+        }
+        logMutation(console, Log_Record(LOG_SET_PASSWORD).text(userId).text(hash.bytes()));
+        cout << "Password changed. You can log in with it now.\n";
+    }
+};
+
+// Benchmarks, run with:  drive --bench [entries]
+class Drive_Benchmark {
+private:
+    typedef chrono::steady_clock Clock;
+
+    // the original single name-ordered BST, kept only as the "before" baseline
+    struct Legacy_Node {
+        string name;
+        Legacy_Node* left;
+        Legacy_Node* right;
+    };
+
+    struct Legacy_BST {
+        Legacy_Node* root = nullptr;
+
+        ~Legacy_BST() {
+            vector<Legacy_Node*> pending;
+            if (root) pending.push_back(root);
+            while (!pending.empty()) {
+                Legacy_Node* node = pending.back();
+                pending.pop_back();
+                if (node->left) pending.push_back(node->left);
+                if (node->right) pending.push_back(node->right);
+                delete node;
+            }
+        }
+
+        void insert(const string& name) {
+            Legacy_Node** link = &root;
+            while (*link) link = (name < (*link)->name) ? &(*link)->left : &(*link)->right;
+            *link = new Legacy_Node{ name, nullptr, nullptr };
+        }
+
+        Legacy_Node* find(const string& name) const {
+            Legacy_Node* node = root;
+            while (node && node->name != name) node = (name < node->name) ? node->left : node->right;
+            return node;
+        }
+    };
+
+    static double nsPerOp(Clock::time_point start, size_t ops) {
+        double ns = (double)chrono::duration_cast<chrono::nanoseconds>(Clock::now() - start).count();
+        return ops ? ns / ops : 0.0;
+    }
+
+    static vector<string> sortedNames(size_t n) {
+        vector<string> names;
+        names.reserve(n);
+        char buffer[32];
+        for (size_t i = 0; i < n; i++) {
+            snprintf(buffer, sizeof(buffer), "log_%08zu", i);
+            names.push_back(buffer);
+        }
+        return names;
+    }
+
+    static void report(const string& label, size_t n, double insertNs, double lookupNs) {
+        cout << "  " << label << " n=" << n
+            << "  sorted insert " << insertNs << " ns/op"
+            << "  lookup " << lookupNs << " ns/op\n";
+    }
+
+    static void benchTree(const string& label, Index_Mode mode, const vector<string>& names,
+        const vector<size_t>& probeOrder) {
+        FileSystemTree tree(mode);
+
+        Clock::time_point start = Clock::now();
+        for (const string& name : names) tree.createFile(name);
+        double insertNs = nsPerOp(start, names.size());
+
+        size_t found = 0;
+        start = Clock::now();
+        for (size_t i : probeOrder) found += tree.findFile(names[i]) != nullptr;
+        double lookupNs = nsPerOp(start, probeOrder.size());
+
+        if (found != probeOrder.size()) cout << "  (" << label << " lost entries!)\n";
+        report(label, names.size(), insertNs, lookupNs);
+    }
+
+public:
+    // sorted uploads into one folder: old BST vs flat vs balanced child index
+    static void nameIndex(size_t n) {
+        vector<string> names = sortedNames(n);
+        vector<size_t> probeOrder(n);
+        for (size_t i = 0; i < n; i++) probeOrder[i] = i;
+        mt19937_64 rng(42);
+        shuffle(probeOrder.begin(), probeOrder.end(), rng);
+
+        cout << "Name index benchmark (sorted names, random-order lookups)\n";
+
+        // the old BST is quadratic on sorted input, so it only gets a slice
+        size_t legacyN = n < 20000 ? n : 20000;
+        {
+            Legacy_BST legacy;
+            Clock::time_point start = Clock::now();
+            for (size_t i = 0; i < legacyN; i++) legacy.insert(names[i]);
+            double insertNs = nsPerOp(start, legacyN);
+
+            size_t found = 0;
+            start = Clock::now();
+            for (size_t i = 0; i < legacyN; i++) found += legacy.find(names[i]) != nullptr;
+            double lookupNs = nsPerOp(start, legacyN);
+            if (found != legacyN) cout << "  (legacy BST lost entries!)\n";
+            report("before (unbalanced BST)", legacyN, insertNs, lookupNs);
+        }
+
+        benchTree("flat child index       ", INDEX_FLAT, names, probeOrder);
+        benchTree("balanced child index   ", INDEX_BALANCED, names, probeOrder);
+        benchTree("auto child index       ", INDEX_AUTO, names, probeOrder);
+    }
+
+private:
+    // ---- full suite: every core structure, JSON out ----
+
+    enum Workload { SORTED, RANDOM, ZIPF };
+
+    static const char* workloadName(Workload workload) {
+        return workload == SORTED ? "sorted" : workload == RANDOM ? "random" : "zipf";
+    }
+
+    // Zipfian ranks in [0, n) with skew theta (Gray et al., as used by YCSB);
+    // rank 0 is the hottest
+    class Zipf_Generator {
+    private:
+        size_t n;
+        double theta, alpha, zetaN, eta;
+        uniform_real_distribution<double> uniform;
+
+    public:
+        Zipf_Generator(size_t items, double skew = 0.99) : n(items), theta(skew), uniform(0.0, 1.0) {
+            double zeta2 = 1.0 + pow(0.5, theta);
+            zetaN = 0.0;
+            for (size_t i = 1; i <= n; i++) zetaN += 1.0 / pow((double)i, theta);
+            alpha = 1.0 / (1.0 - theta);
+            eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetaN);
+        }
+
+        size_t next(mt19937_64& rng) {
+            double u = uniform(rng);
+            double uz = u * zetaN;
+            if (uz < 1.0) return 0;
+            if (uz < 1.0 + pow(0.5, theta)) return n > 1 ? 1 : 0;
+            size_t rank = (size_t)(n * pow(eta * u - eta + 1.0, alpha));
+            return rank < n ? rank : n - 1;
+        }
+    };
+
+    struct Result {
+        string structure, op, workload;
+        size_t n, ops;
+        double seconds, p50, p99;
+        double loadFactor;      // < 0 when it doesn't apply
+        size_t bytes;           // payload moved, for the codec
+        size_t threads;         // 0 for single-threaded runs
+    };
+
+    class Suite {
+    private:
+        vector<Result> results;
+        vector<uint32_t> samples;
+        string filter;
+        double timerNs;
+        mt19937_64 rng;
+        size_t sink;
+
+        // key indices in [0, n) for ops operations in the given order; Zipf
+        // ranks go through a fixed permutation so hot keys are spread out
+        vector<size_t> keyOrder(size_t n, size_t ops, Workload workload) {
+            vector<size_t> order(ops);
+            if (workload == SORTED) {
+                for (size_t i = 0; i < ops; i++) order[i] = i % n;
+            }
+            else if (workload == RANDOM && ops == n) {
+                for (size_t i = 0; i < n; i++) order[i] = i;
+                shuffle(order.begin(), order.end(), rng);
+            }
+            else if (workload == RANDOM) {
+                uniform_int_distribution<size_t> pick(0, n - 1);
+                for (size_t& key : order) key = pick(rng);
+            }
+            else {
+                vector<size_t> permutation(n);
+                for (size_t i = 0; i < n; i++) permutation[i] = i;
+                shuffle(permutation.begin(), permutation.end(), rng);
+                Zipf_Generator zipf(n);
+                for (size_t& key : order) key = permutation[zipf.next(rng)];
+            }
+            return order;
+        }
+
+        bool wanted(const string& structure) const {
+            return filter.empty() || structure.find(filter) != string::npos;
+        }
+
+        // times each call of op(i) for i in [0, ops) and records one result
+        template <typename Op>
+        Result& measure(const string& structure, const string& op, Workload workload, size_t n, size_t ops, Op body) {
+            samples.resize(ops);
+            Clock::time_point begin = Clock::now();
+            for (size_t i = 0; i < ops; i++) {
+                Clock::time_point start = Clock::now();
+                body(i);
+                double ns = (double)chrono::duration_cast<chrono::nanoseconds>(Clock::now() - start).count() - timerNs;
+                samples[i] = ns > 0 ? (uint32_t)(ns < 4e9 ? ns : 4e9) : 0;
+            }
+            double seconds = chrono::duration<double>(Clock::now() - begin).count();
+
+            return record(Result{ structure, op, workloadName(workload), n, ops, seconds, 0, 0, -1.0, 0, 0 });
+        }
+
+        // fills in the percentiles from samples and keeps the result
+        Result& record(Result result) {
+            size_t ops = samples.size();
+            if (ops) {
+                nth_element(samples.begin(), samples.begin() + ops / 2, samples.end());
+                result.p50 = samples[ops / 2];
+                size_t p99 = ops * 99 / 100;
+                nth_element(samples.begin(), samples.begin() + p99, samples.end());
+                result.p99 = samples[p99];
+            }
+            cerr << "  " << result.structure << "." << result.op << " [" << result.workload << "] n=" << result.n
+                << (result.threads ? " threads=" + to_string(result.threads) : string())
+                << "  " << (result.ops / result.seconds) << " ops/s  p50 " << result.p50 << " ns  p99 " << result.p99 << " ns\n";
+            results.push_back(result);
+            return results.back();
+        }
+
+        // Durable commits per second through group commit, against a real file
+        // (so this measures the disk too).  "sync" writers wait on every record,
+        // like interactive sessions; "batch" writers append BATCH and wait once,
+        // like batch scripts.  Throughput is about records per fsync over fsync
+        // latency, and a sync writer contributes one record per fsync.
+        void writeAheadLog() {
+            const string path = "drive_bench.wal";
+            const size_t COMMITS_PER_WRITER = 1024;
+            const size_t BATCH = 64;
+            for (bool batched : { false, true }) {
+                for (size_t writers : { 1, 32, 128 }) {
+                    remove(path.c_str());
+                    Write_Ahead_Log journal;
+                    if (!journal.open(path, 0)) return;
+                    vector<vector<uint32_t>> latencies(writers);
+                    Worker_Pool pool(writers);
+                    atomic<size_t> ready{ 0 };
+                    Clock::time_point begin;
+                    for (size_t t = 0; t < writers; t++) {
+                        pool.submit([&, t] {
+                            vector<uint32_t>& waits = latencies[t];
+                            if (++ready == writers) begin = Clock::now();
+                            while (ready < writers) this_thread::yield();
+                            for (size_t i = 0; i < COMMITS_PER_WRITER;) {
+                                Clock::time_point start = Clock::now();
+                                if (batched) {
+                                    uint64_t lsn = 0;
+                                    for (size_t end = i + BATCH; i < end; i++) {
+                                        lsn = journal.append(Log_Record(LOG_REWRITE).number(t).text("edited body").number(i));
+                                    }
+                                    journal.waitDurable(lsn);
+                                }
+                                else {
+                                    journal.commit(Log_Record(LOG_REWRITE).number(t).text("edited body").number(i++));
+                                }
+                                double ns = (double)chrono::duration_cast<chrono::nanoseconds>(Clock::now() - start).count() - timerNs;
+                                waits.push_back(ns > 0 ? (uint32_t)(ns < 4e9 ? ns : 4e9) : 0);
+                            }
+                        });
+                    }
+                    pool.wait();
+                    double seconds = chrono::duration<double>(Clock::now() - begin).count();
+                    sink += journal.fsyncs();
+                    journal.close();
+                    remove(path.c_str());
+
+                    samples.clear();
+                    for (const vector<uint32_t>& waits : latencies) samples.insert(samples.end(), waits.begin(), waits.end());
+                    size_t commits = writers * COMMITS_PER_WRITER;
+                    record(Result{ "Write_Ahead_Log", "commit", batched ? "batch" : "sync", commits, commits, seconds,
+                        0, 0, -1.0, 0, writers });
+                }
+            }
+        }
+
+        // Read scaling of the whole engine: one session per thread, each
+        // downloading Zipf-chosen files out of n spread over 64-file folders
+        void driveSessions(size_t n) {
+            Google_Drive_System drive("");
+            Drive_Session admin;
+            drive.login(admin, "admin", "password");
+            vector<string> paths;
+            for (size_t i = 0; i < n; i++) {
+                string folder = "d" + to_string(i / 64);
+                if (i % 64 == 0) drive.createDirectory(admin, folder);
+                paths.push_back(folder + "/f" + to_string(i) + ".txt");
+                drive.uploadFile(admin, paths.back(), "body of file " + to_string(i));
+            }
+
+            const size_t OPS_PER_THREAD = n < 200000 ? 200000 : n;
+            size_t maxThreads = thread::hardware_concurrency() ? thread::hardware_concurrency() : 1;
+            for (size_t threads = 1;; threads = threads * 2 < maxThreads ? threads * 2 : maxThreads) {
+                vector<vector<size_t>> keys(threads);
+                for (vector<size_t>& list : keys) list = keyOrder(n, OPS_PER_THREAD, ZIPF);
+                vector<vector<uint32_t>> latencies(threads, vector<uint32_t>(OPS_PER_THREAD));
+                vector<size_t> found(threads, 0);
+
+                Worker_Pool pool(threads);
+                atomic<size_t> ready{ 0 };
+                Clock::time_point begin;
+                for (size_t t = 0; t < threads; t++) {
+                    pool.submit([&, t] {
+                        Drive_Session session;
+                        drive.login(session, "admin", "password");
+                        string body;
+                        if (++ready == threads) begin = Clock::now();
+                        while (ready < threads) this_thread::yield();
+                        size_t hits = 0;        // counted locally: neighbouring counters would share a cache line
+                        for (size_t i = 0; i < OPS_PER_THREAD; i++) {
+                            Clock::time_point start = Clock::now();
+                            hits += drive.downloadFile(session, "/Root/" + paths[keys[t][i]], body) == DRIVE_OK;
+                            double ns = (double)chrono::duration_cast<chrono::nanoseconds>(Clock::now() - start).count() - timerNs;
+                            latencies[t][i] = ns > 0 ? (uint32_t)(ns < 4e9 ? ns : 4e9) : 0;
+                        }
+                        found[t] = hits;
+                    });
+                }
+                pool.wait();
+                double seconds = chrono::duration<double>(Clock::now() - begin).count();
+
+                samples.clear();
+                for (size_t t = 0; t < threads; t++) {
+                    samples.insert(samples.end(), latencies[t].begin(), latencies[t].end());
+                    sink += found[t];
+                }
+                record(Result{ "Drive_Sessions", "download", "zipf", n, threads * OPS_PER_THREAD, seconds,
+                    0, 0, -1.0, 0, threads });
+                if (threads == maxThreads) break;
+            }
+        }
+
+        void fileSystemTree(size_t n) {
+            vector<string> names = sortedNames(n);
+            for (Workload workload : { SORTED, RANDOM }) {
+                FileSystemTree tree;
+                vector<size_t> order = keyOrder(n, n, workload);
+                measure("FileSystemTree", "insert", workload, n, n, [&](size_t i) {
+                    sink += tree.createFile(names[order[i]]) != nullptr;
+                });
+                for (Workload probe : { SORTED, RANDOM, ZIPF }) {
+                    if (workload == RANDOM && probe != RANDOM) continue;    // lookups don't care how it was built
+                    vector<size_t> keys = keyOrder(n, n, probe);
+                    measure("FileSystemTree", "find", probe, n, n, [&](size_t i) {
+                        sink += tree.findFile(names[keys[i]]) != nullptr;
+                    });
+                }
+                measure("FileSystemTree", "remove", workload, n, n, [&](size_t i) {
+                    TreeNode* file = tree.findFile(names[order[i]]);
+                    if (tree.removeFile(file)) tree.discardNode(file);
+                });
+            }
+
+            // listing: the same files spread over folders of LIST_FANOUT
+            const size_t LIST_FANOUT = 64;
+            FileSystemTree tree;
+            vector<TreeNode*> folders;
+            for (size_t i = 0; i < n; i++) {
+                if (i % LIST_FANOUT == 0) {
+                    tree.changeDirectory("/Root");
+                    folders.push_back(tree.makeDirectory("d" + to_string(folders.size())));
+                    tree.changeDirectory(folders.back()->name);
+                }
+                tree.createFile(names[i]);
+            }
+            for (Workload probe : { SORTED, RANDOM, ZIPF }) {
+                vector<size_t> keys = keyOrder(folders.size(), folders.size(), probe);
+                measure("FileSystemTree", "list", probe, n, folders.size(), [&](size_t i) {
+                    folders[keys[i]]->children.forEach([&](const TreeNode* child) { sink += child->name.size(); });
+                });
+            }
+        }
+
+        // one random tree held as linked TreeNodes and as a Compact_Tree; every
+        // 8th node is a folder and each node lands in a random earlier folder.
+        // Walks over insertion order are [random], packed ones [sorted]; the
+        // FileSystemTree walks go through its own layout.
+        void compactTree(size_t n) {
+            vector<string> names = sortedNames(n);
+            vector<Compact_Tree::Index> parentOf(n);
+            vector<Compact_Tree::Index> folders{ Compact_Tree::ROOT };
+            FileSystemTree tree;
+            for (size_t i = 0; i < n; i++) {
+                parentOf[i] = folders[rng() % folders.size()];
+                uint64_t parentId = parentOf[i] == Compact_Tree::ROOT ? tree.getRoot()->id : parentOf[i] + 1;
+                tree.adoptNode(i + 2, parentId, names[i], i % 8 != 0, Content_Ref());
+                if (i % 8 == 0) folders.push_back((Compact_Tree::Index)(i + 1));
+            }
+
+            const size_t WALKS = 10;
+            measure("FileSystemTree", "walk", RANDOM, n, WALKS, [&](size_t) {
+                tree.forEachNode([&](const TreeNode* node) { sink += node->isFile; });
+            });
+            measure("FileSystemTree", "pack", RANDOM, n, 1, [&](size_t) { tree.packLayout(); });
+            measure("FileSystemTree", "walk", SORTED, n, WALKS, [&](size_t) {
+                tree.forEachNode([&](const TreeNode* node) { sink += node->isFile; });
+            });
+            cerr << "  FileSystemTree layout " << tree.layoutBytes() / (n + 1) << " bytes/node\n";
+
+            // node i + 1 of this one is node i + 2 of the FileSystemTree
+            Compact_Tree scattered;
+            scattered.reserve(n + 1, n * names[0].size());
+            measure("Compact_Tree", "add", RANDOM, n, n, [&](size_t i) {
+                sink += scattered.add(parentOf[i], names[i], i % 8 != 0, i + 2);
+            });
+            measure("Compact_Tree", "walk", RANDOM, n, WALKS, [&](size_t) {
+                scattered.walk([&](Compact_Tree::Index node) { sink += scattered.isFile(node); });
+            });
+            measure("Compact_Tree", "pack", RANDOM, n, 1, [&](size_t) { scattered.pack(); });
+
+            Compact_Tree& compact = scattered;
+            measure("Compact_Tree", "walk", SORTED, n, WALKS, [&](size_t) {
+                compact.walk([&](Compact_Tree::Index node) { sink += compact.isFile(node); });
+            });
+            cerr << "  Compact_Tree resident " << compact.bytes() / (n + 1) << " bytes/node\n";
+
+            const size_t QUERIES = 100000;
+            vector<string> paths(QUERIES);
+            for (string& path : paths) path = tree.pathOf(tree.findById(rng() % n + 2));
+            measure("FileSystemTree", "resolve", RANDOM, n, QUERIES, [&](size_t i) {
+                sink += tree.resolvePath(paths[i], tree.getRoot()) != nullptr;
+            });
+            measure("Compact_Tree", "resolve", RANDOM, n, QUERIES, [&](size_t i) {
+                sink += compact.resolve(paths[i]) != Compact_Tree::NONE;
+            });
+            measure("Compact_Tree", "path_of", RANDOM, n, QUERIES, [&](size_t) {
+                sink += compact.pathOf((Compact_Tree::Index)(rng() % n + 1)).size();
+            });
+        }
+
+        void hashTable(size_t n) {
+            // searches at a fixed fill of one table size: entries = load * capacity
+            size_t capacity = 16;
+            while (capacity < n) capacity *= 2;
+            for (double load : { 0.25, 0.5, 0.75, 0.85 }) {
+                size_t entries = (size_t)(capacity * load);
+                if (!entries) continue;
+                for (Workload workload : { SORTED, RANDOM }) {
+                    HashTable table;
+                    table.reserve(capacity * 7 / 8);
+                    vector<size_t> order = keyOrder(entries, entries, workload);
+                    measure("HashTable", "insert", workload, entries, entries, [&](size_t i) {
+                        table.insert(order[i] + 1, new File_Meta_data());
+                    }).loadFactor = table.loadFactor();
+                    for (Workload probe : { SORTED, RANDOM, ZIPF }) {
+                        if (workload == RANDOM && probe != RANDOM) continue;
+                        vector<size_t> keys = keyOrder(entries, entries, probe);
+                        measure("HashTable", "search", probe, entries, entries, [&](size_t i) {
+                            sink += table.search(keys[i] + 1) != nullptr;
+                        }).loadFactor = table.loadFactor();
+                        measure("HashTable", "search_miss", probe, entries, entries, [&](size_t i) {
+                            sink += table.search(keys[i] + 1 + entries) != nullptr;
+                        }).loadFactor = table.loadFactor();
+                    }
+                    double full = table.loadFactor();
+                    measure("HashTable", "remove", workload, entries, entries, [&](size_t i) {
+                        table.remove(order[i] + 1);
+                    }).loadFactor = full;
+                }
+            }
+        }
+
+        void recycleBin(size_t n) {
+            // the bin owns what it holds, so every entry is a node of its own
+            Recycle_Bin bin;
+            vector<string> names = sortedNames(n);
+            vector<TreeNode*> files(n);
+            for (size_t i = 0; i < n; i++) {
+                files[i] = new TreeNode(names[i], true);
+                files[i]->id = i + 1;
+            }
+            vector<size_t> order = keyOrder(n, n, RANDOM);
+            measure("Recycle_Bin", "push", RANDOM, n, n, [&](size_t i) {
+                bin.push(files[order[i]], nullptr, 1, (int64_t)i);
+            });
+            for (Workload probe : { RANDOM, ZIPF }) {
+                vector<size_t> keys = keyOrder(n, n, probe);
+                measure("Recycle_Bin", "find", probe, n, n, [&](size_t i) {
+                    sink += bin.find(keys[i] + 1) != nullptr;
+                });
+                measure("Recycle_Bin", "newestNamed", probe, n, n, [&](size_t i) {
+                    sink += bin.newestNamed(names[keys[i]]) != nullptr;
+                });
+            }
+
+            // half go back out by id (restores), the rest oldest first (retention)
+            Bin_Entry entry;
+            vector<size_t> restores = keyOrder(n, n, RANDOM);
+            measure("Recycle_Bin", "take", RANDOM, n, n / 2, [&](size_t i) {
+                if (bin.take(restores[i] + 1, entry)) delete entry.file;
+            });
+            size_t left = bin.size();
+            measure("Recycle_Bin", "purge_oldest", SORTED, n, left, [&](size_t) {
+                if (bin.take(bin.oldest()->file->id, entry)) delete entry.file;
+            });
+        }
+
+        void recentFiles(size_t n) {
+            // touches over n files: sorted always misses, zipf mostly hits
+            const string name = "recent.txt";
+            for (Workload workload : { SORTED, RANDOM, ZIPF }) {
+                Recent_Files_Lru recent;
+                vector<size_t> keys = keyOrder(n, n, workload);
+                measure("Recent_Files_Lru", "touch", workload, n, n, [&](size_t i) {
+                    recent.touch(keys[i] + 1, name);
+                });
+                sink += recent.size();
+            }
+
+            Access_Log log;
+            atomic<bool> done(false);
+            thread consumer([&] {
+                vector<Access_Event> batch(1024);
+                while (!done) {
+                    if (!log.drain(batch.data(), batch.size())) this_thread::yield();
+                }
+            });
+            measure("Access_Log", "publish", SORTED, n, n, [&](size_t i) {
+                log.publish(Access_Event{ i, nullptr, i, ACCESS_READ });
+            });
+            done = true;
+            consumer.join();
+            sink += log.droppedCount();
+        }
+
+        void userGraph(size_t n) {
+            User_Graph graph(1);        // one hash round: this measures the directory, not the stretching
+            vector<string> ids = sortedNames(n), passwords(n);
+            for (size_t i = 0; i < n; i++) passwords[i] = "pw" + ids[i];
+            vector<size_t> order = keyOrder(n, n, RANDOM);
+            measure("User_Graph", "addUser", RANDOM, n, n, [&](size_t i) {
+                sink += graph.addUser(ids[order[i]], passwords[order[i]], "Favorite color?", "blue");
+            });
+            for (Workload probe : { SORTED, RANDOM, ZIPF }) {
+                vector<size_t> keys = keyOrder(n, n, probe);
+                measure("User_Graph", "findUser", probe, n, n, [&](size_t i) {
+                    sink += graph.findUser(ids[keys[i]]) != nullptr;
+                });
+            }
+            for (Workload probe : { RANDOM, ZIPF }) {
+                vector<size_t> keys = keyOrder(n, n, probe);
+                measure("User_Graph", "authenticate", probe, n, n, [&](size_t i) {
+                    sink += graph.authenticate(ids[keys[i]], passwords[keys[i]]) != nullptr;
+                });
+            }
+            vector<Session_Token> tokens(n);
+            measure("User_Graph", "issueToken", RANDOM, n, n, [&](size_t i) {
+                tokens[order[i]] = graph.issueToken(graph.findUser(ids[order[i]]));
+            });
+            for (Workload probe : { RANDOM, ZIPF }) {
+                vector<size_t> keys = keyOrder(n, n, probe);
+                measure("User_Graph", "validateToken", probe, n, n, [&](size_t i) {
+                    sink += graph.validateToken(tokens[keys[i]]) != nullptr;
+                });
+            }
+            measure("User_Graph", "revokeToken", RANDOM, n, n, [&](size_t i) {
+                graph.revokeToken(tokens[order[i]]);
+            });
+            loginStorm(graph, ids, passwords);
+        }
+
+        void shareGraph(size_t n) {
+            // n grants of file i to zipf-popular grantees, owned by random users
+            Share_Graph shares;
+            vector<size_t> owners = keyOrder(n, n, RANDOM), grantees = keyOrder(n, n, ZIPF);
+            measure("Share_Graph", "grant", RANDOM, n, n, [&](size_t i) {
+                shares.grant(i + 1, (uint32_t)owners[i], (uint32_t)grantees[i], SHARE_VIEW);
+            });
+            for (Workload probe : { RANDOM, ZIPF }) {
+                // the access check on every download: half hits, half misses
+                vector<size_t> files = keyOrder(n, n, probe);
+                measure("Share_Graph", "permissionsOf", probe, n, n, [&](size_t i) {
+                    uint32_t grantee = (uint32_t)(i & 1 ? grantees[files[i]] : grantees[files[i]] + 1);
+                    sink += shares.permissionsOf(files[i] + 1, grantee);
+                });
+            }
+            vector<size_t> users = keyOrder(n, n, RANDOM);
+            measure("Share_Graph", "sharedWith", RANDOM, n, n, [&](size_t i) {
+                shares.forEachSharedWith((uint32_t)users[i], [&](const Share_Graph::Grant& grant) { sink += grant.nodeId; });
+            });
+            vector<size_t> order = keyOrder(n, n, RANDOM);
+            measure("Share_Graph", "revoke", RANDOM, n, n, [&](size_t i) {
+                sink += shares.revoke(order[i] + 1, (uint32_t)grantees[order[i]]);
+            });
+        }
+
+        void accessControl(size_t n) {
+            // n files spread over a folder chain DEPTH deep, shared at the top:
+            // cold checks walk to the root, warm ones hit the cache
+            const size_t DEPTH = 64;
+            const uint32_t GRANTEE = 1;
+            Access_Control acl;
+            vector<TreeNode*> folders(DEPTH), files(n);
+            for (size_t i = 0; i < DEPTH; i++) {
+                folders[i] = new TreeNode("folder");
+                folders[i]->id = i + 1;
+                folders[i]->parent = i ? folders[i - 1] : nullptr;
+            }
+            for (size_t i = 0; i < n; i++) {
+                files[i] = new TreeNode("file", true);
+                files[i]->id = DEPTH + i + 1;
+                files[i]->parent = folders[DEPTH / 2 + i % (DEPTH / 2)];
+            }
+            acl.adoptFolder(folders[0]->id, 0);
+            acl.grant(folders[1]->id, 0, GRANTEE, SHARE_VIEW);
+
+            vector<size_t> order = keyOrder(n, n, RANDOM);
+            measure("Access_Control", "effective_cold", RANDOM, n, n, [&](size_t i) {
+                sink += acl.effective(files[order[i]], GRANTEE);
+            });
+            for (Workload probe : { RANDOM, ZIPF }) {
+                vector<size_t> keys = keyOrder(n, n, probe);
+                measure("Access_Control", "effective_warm", probe, n, n, [&](size_t i) {
+                    sink += acl.effective(files[keys[i]], GRANTEE);
+                });
+            }
+            // one grant retires every cached answer
+            acl.grant(folders[DEPTH - 1]->id, 0, GRANTEE, SHARE_VIEW | SHARE_EDIT);
+            measure("Access_Control", "effective_after_grant", RANDOM, n, n, [&](size_t i) {
+                sink += acl.effective(files[order[i]], GRANTEE);
+            });
+            for (TreeNode* file : files) delete file;
+            for (TreeNode* folder : folders) delete folder;
+        }
+
+        void textIndex(size_t n) {
+            // n documents of WORDS words drawn zipf from a VOCABULARY-word
+            // language, so a few words are everywhere and most are rare
+            const size_t VOCABULARY = 50000, WORDS = 40, QUERIES = 2000;
+            vector<string> vocabulary(VOCABULARY);
+            for (size_t i = 0; i < VOCABULARY; i++) vocabulary[i] = "w" + to_string(i);
+            Zipf_Generator zipf(VOCABULARY);
+            auto document = [&]() {
+                string text;
+                for (size_t w = 0; w < WORDS; w++) {
+                    text += vocabulary[zipf.next(rng)];
+                    text += ' ';
+                }
+                return text;
+            };
+            vector<string> bodies(n);
+            for (string& body : bodies) body = document();
+
+            Text_Index index;
+            measure("Text_Index", "index", SORTED, n, n, [&](size_t i) { index.index(i + 1, 0, bodies[i]); });
+            sink += index.postingBytes();
+
+            auto word = [&](size_t lowest, size_t highest) {
+                return vocabulary[lowest + rng() % (highest - lowest)];
+            };
+            vector<string> queries(QUERIES);
+            struct Query_Kind { const char* op; function<string()> make; };
+            vector<Query_Kind> kinds = {
+                { "search_common", [&] { return word(0, 10); } },
+                { "search_rare", [&] { return word(1000, VOCABULARY); } },
+                { "search_and", [&] { return word(0, 10) + " " + word(100, 1000); } },
+                { "search_and_common", [&] { return word(0, 10) + " " + word(0, 10); } },
+                { "search_or", [&] { return word(0, 100) + " OR " + word(100, 1000); } },
+                { "search_phrase", [&] { return "\"" + word(0, 10) + " " + word(0, 10) + "\""; } },
+            };
+            for (const Query_Kind& kind : kinds) {
+                for (string& query : queries) query = kind.make();
+                measure("Text_Index", kind.op, RANDOM, n, QUERIES, [&](size_t i) {
+                    sink += index.search(queries[i], 10).size();
+                });
+            }
+
+            // edits: each re-indexed file leaves a dead document behind
+            vector<size_t> order = keyOrder(n, n, RANDOM);
+            measure("Text_Index", "reindex", RANDOM, n, n, [&](size_t i) { index.index(order[i] + 1, 0, bodies[i]); });
+            measure("Text_Index", "remove", RANDOM, n, n, [&](size_t i) { index.remove(order[i] + 1); });
+        }
+
+        void metadataColumns(size_t n) {
+            // a thousand owners with zipf-skewed file counts, a handful of
+            // types, sizes spread over six orders of magnitude and edits over
+            // the last two years
+            const size_t OWNERS = 1000, QUERIES = 20;
+            const char* fileTypes[] = { "txt", "pdf", "docx", "xlsx", "jpg", "png", "mp4", "zip" };
+            const int64_t now = (int64_t)time(nullptr), DAY = 86400;
+            Zipf_Generator zipf(OWNERS);
+            vector<const string*> owners(OWNERS), types(8);
+            for (size_t i = 0; i < OWNERS; i++) owners[i] = Interned_Strings::intern("user" + to_string(i));
+            for (size_t i = 0; i < 8; i++) types[i] = Interned_Strings::intern(fileTypes[i]);
+            Metadata_Columns columns;
+            File_Meta_data meta{};
+            measure("Metadata_Columns", "store", SORTED, n, n, [&](size_t i) {
+                meta.owner = owners[zipf.next(rng)];
+                meta.type = types[rng() % 8];
+                meta.size = (size_t)1 << (rng() % 20);
+                meta.size += rng() % meta.size;
+                meta.created = meta.modified = now - (int64_t)(rng() % (730 * DAY));
+                columns.store(i + 1, meta);
+            });
+
+            Metadata_Filter week;
+            week.modifiedFrom = now - 7 * DAY;
+            Metadata_Filter ownerWeek = week;
+            ownerWeek.owner = "user0";
+            Metadata_Filter bigPdfs;
+            bigPdfs.type = "pdf";
+            bigPdfs.minSize = 1 << 18;
+            measure("Metadata_Columns", "count_week", SORTED, n, QUERIES, [&](size_t) { sink += columns.count(week); });
+            measure("Metadata_Columns", "top10_largest_owner_week", SORTED, n, QUERIES, [&](size_t) {
+                sink += columns.top(ownerWeek, ORDER_SIZE, 10).size();
+            });
+            measure("Metadata_Columns", "top100_newest", SORTED, n, QUERIES, [&](size_t) {
+                sink += columns.top(Metadata_Filter(), ORDER_MODIFIED, 100).size();
+            });
+            measure("Metadata_Columns", "sort_big_pdfs", SORTED, n, QUERIES, [&](size_t) {
+                sink += columns.top(bigPdfs, ORDER_SIZE, n).size();
+            });
+            measure("Metadata_Columns", "usage_by_owner", SORTED, n, QUERIES, [&](size_t) {
+                sink += columns.usageByOwner(Metadata_Filter()).size();
+            });
+
+            vector<size_t> order = keyOrder(n, n, RANDOM);
+            measure("Metadata_Columns", "erase", RANDOM, n, n, [&](size_t i) { columns.erase(order[i] + 1); });
+        }
+
+        void nameIndex(size_t n) {
+            // names shaped like real ones: "invoice_2025_0413.pdf", "Holiday Photos 17"
+            const char* stems[] = { "invoice", "report", "notes", "budget", "draft", "photo", "scan", "meeting",
+                "contract", "resume", "slides", "backup", "Holiday Photos", "Project Plan", "receipt", "letter" };
+            const char* extensions[] = { ".pdf", ".txt", ".docx", ".xlsx", ".jpg", ".png", "", "" };
+            vector<string> names(n);
+            for (string& name : names) {
+                name = stems[rng() % 16];
+                name += (rng() % 2 ? "_" : " ") + to_string(2015 + rng() % 12) + "_" + to_string(rng() % 10000);
+                name += extensions[rng() % 8];
+            }
+
+            Name_Index index;
+            measure("Name_Index", "add", SORTED, n, n, [&](size_t i) { index.add(i + 1, 0, names[i]); });
+
+            const size_t QUERIES = 2000;
+            struct Query_Kind { const char* op; function<string()> make; };
+            vector<Query_Kind> kinds = {
+                { "substring", [&] { return to_string(rng() % 10000); } },
+                { "substring_common", [&] { return string(stems[rng() % 16]).substr(0, 4); } },
+                { "glob", [&] { return string("*") + stems[rng() % 16] + "*" + to_string(2015 + rng() % 12) + "*.pdf"; } },
+                { "glob_miss", [&] { return "*invoice*2031*"; } },
+                { "short_scan", [&] { return "s?a*"; } },
+            };
+            vector<string> queries(QUERIES);
+            for (const Query_Kind& kind : kinds) {
+                for (string& query : queries) query = kind.make();
+                measure("Name_Index", kind.op, RANDOM, n, QUERIES, [&](size_t i) {
+                    sink += index.search(queries[i], 100).size();
+                });
+            }
+
+            vector<size_t> order = keyOrder(n, n, RANDOM);
+            measure("Name_Index", "rename", RANDOM, n, n, [&](size_t i) { index.add(order[i] + 1, 0, names[i]); });
+            measure("Name_Index", "remove", RANDOM, n, n, [&](size_t i) { index.remove(order[i] + 1); });
+        }
+
+        // many threads logging in at once: each login checks the password,
+        // takes a token, makes a few token-checked requests and logs out
+        void loginStorm(User_Graph& graph, const vector<string>& ids, const vector<string>& passwords) {
+            const size_t n = ids.size();
+            const size_t LOGINS_PER_THREAD = 200000;
+            const size_t REQUESTS_PER_LOGIN = 4;
+            size_t maxThreads = thread::hardware_concurrency() ? thread::hardware_concurrency() : 1;
+            for (size_t threads = 1;; threads = threads * 2 < maxThreads ? threads * 2 : maxThreads) {
+                vector<vector<size_t>> keys(threads);
+                for (vector<size_t>& list : keys) list = keyOrder(n, LOGINS_PER_THREAD, ZIPF);
+                vector<vector<uint32_t>> latencies(threads, vector<uint32_t>(LOGINS_PER_THREAD));
+                vector<size_t> served(threads, 0);
+
+                Worker_Pool pool(threads);
+                atomic<size_t> ready{ 0 };
+                Clock::time_point begin;
+                for (size_t t = 0; t < threads; t++) {
+                    pool.submit([&, t] {
+                        if (++ready == threads) begin = Clock::now();
+                        while (ready < threads) this_thread::yield();
+                        size_t requests = 0;    // counted locally: neighbouring counters would share a cache line
+                        for (size_t i = 0; i < LOGINS_PER_THREAD; i++) {
+                            Clock::time_point start = Clock::now();
+                            User_Graph::UserNode* user = graph.authenticate(ids[keys[t][i]], passwords[keys[t][i]]);
+                            Session_Token token = graph.issueToken(user);
+                            for (size_t r = 0; r < REQUESTS_PER_LOGIN; r++) requests += graph.validateToken(token) == user;
+                            graph.revokeToken(token);
+                            double ns = (double)chrono::duration_cast<chrono::nanoseconds>(Clock::now() - start).count() - timerNs;
+                            latencies[t][i] = ns > 0 ? (uint32_t)(ns < 4e9 ? ns : 4e9) : 0;
+                        }
+                        served[t] = requests;
+                    });
+                }
+                pool.wait();
+                double seconds = chrono::duration<double>(Clock::now() - begin).count();
+
+                samples.clear();
+                for (size_t t = 0; t < threads; t++) {
+                    samples.insert(samples.end(), latencies[t].begin(), latencies[t].end());
+                    sink += served[t];
+                }
+                record(Result{ "User_Graph", "login_storm", "zipf", n, threads * LOGINS_PER_THREAD, seconds,
+                    0, 0, -1.0, 0, threads });
+                if (threads == maxThreads) break;
+            }
+        }
+
+        void versionList(size_t n) {
+            Chunk_Store store;
+            File_Version_List versions(&store);
+            string document;
+            for (size_t i = 0; i < 4096; i++) document += "lorem ipsum dolor sit amet "[i % 27];
+            Content_Ref body;
+            uniform_int_distribution<size_t> at(0, document.size() - 16);
+            char stamp[16];
+            for (size_t v = 0; v < n; v++) {
+                snprintf(stamp, sizeof(stamp), "%08zu", v % 100000000);
+                document.replace(at(rng), 8, stamp);     // a small edit per version
+                store.release(body);
+                body = store.store(document);
+                versions.addVersion(document, body);
+            }
+            store.release(body);
+            for (Workload probe : { SORTED, RANDOM, ZIPF }) {
+                vector<size_t> keys = keyOrder(n, n, probe);
+                measure("File_Version_List", "getVersion", probe, n, n, [&](size_t i) {
+                    sink += versions.getVersion((int)keys[i] + 1).size();
+                });
+            }
         }
+
+        // the codec behind compressionAlgorithm; n is the input size in bytes
+        void compression(size_t n) {
+            static const char* const words[] = { "drive ", "file ", "folder ", "shared ", "version ", "recycle ",
+                "owner ", "metadata ", "2026 ", "report ", "\n" };
+            string text;
+            uniform_int_distribution<size_t> pickWord(0, 10);
+            while (text.size() < n) text += words[pickWord(rng)];
+            text.resize(n);
+
+            Block_Codec codec;
+            size_t blocks = (n + Block_Codec::BLOCK_SIZE - 1) / Block_Codec::BLOCK_SIZE;
+            string frame, restored;
+            Block_Codec::beginFrame(frame);
+            measure("compressionAlgorithm", "compress", SORTED, n, blocks, [&](size_t i) {
+                size_t offset = i * Block_Codec::BLOCK_SIZE;
+                size_t length = n - offset < Block_Codec::BLOCK_SIZE ? n - offset : Block_Codec::BLOCK_SIZE;
+                codec.appendBlock(text.data() + offset, length, frame);
+            }).bytes = n;
+            Block_Codec::endFrame(frame);
+
+            size_t at = 4;
+            measure("compressionAlgorithm", "decompress", SORTED, n, blocks, [&](size_t) {
+                at += Block_Codec::appendDecodedBlock(frame.data() + at, frame.size() - at, restored);
+            }).bytes = n;
+            if (restored != text) cerr << "  (codec round trip failed!)\n";
+        }
+
+        static void writeString(ostream& out, const string& text) {
+            out << '"';
+            for (char c : text) {
+                if (c == '"' || c == '\\') out << '\\';
+                out << c;
+            }
+            out << '"';
+        }
+
+    public:
+        Suite(const string& only) : filter(only), timerNs(0), rng(42), sink(0) {
+            // what an empty timed call costs; subtracted from every sample
+            const size_t CALIBRATION = 100000;
+            Clock::time_point begin = Clock::now();
+            for (size_t i = 0; i < CALIBRATION; i++) {
+                Clock::time_point start = Clock::now();
+                sink += (size_t)chrono::duration_cast<chrono::nanoseconds>(Clock::now() - start).count();
+            }
+            timerNs = (double)chrono::duration_cast<chrono::nanoseconds>(Clock::now() - begin).count() / CALIBRATION / 2;
+        }
+
+        void run(size_t n) {
+            // versions are whole histories of one file
+            const size_t VERSION_LIMIT = 100000;
+
+            cerr << "n = " << n << "\n";
+            if (wanted("FileSystemTree")) fileSystemTree(n);
+            if (wanted("Compact_Tree")) compactTree(n);
+            if (wanted("HashTable")) hashTable(n);
+            if (wanted("Recycle_Bin")) recycleBin(n);
+            if (wanted("Recent_Files_Lru")) recentFiles(n);
+            if (wanted("User_Graph")) userGraph(n);
+            if (wanted("Share_Graph")) shareGraph(n);
+            if (wanted("Access_Control")) accessControl(n);
+            if (wanted("Text_Index")) textIndex(n);
+            if (wanted("Name_Index")) nameIndex(n);
+            if (wanted("Metadata_Columns")) metadataColumns(n);
+            if (wanted("File_Version_List")) versionList(n < VERSION_LIMIT ? n : VERSION_LIMIT);
+            if (wanted("compressionAlgorithm")) compression(n * 64);    // 64 bytes of text per entry
+            if (wanted("Drive_Sessions")) driveSessions(n);
+            if (wanted("Write_Ahead_Log")) writeAheadLog();
+        }
+
+        void writeJson(ostream& out) const {
+            out << "{\n  \"benchmark\": \"drive\",\n  \"timer_overhead_ns\": " << timerNs
+                << ",\n  \"checksum\": " << sink << ",\n  \"results\": [";
+            for (size_t i = 0; i < results.size(); i++) {
+                const Result& result = results[i];
+                out << (i ? ",\n" : "\n") << "    {\"structure\": ";
+                writeString(out, result.structure);
+                out << ", \"op\": ";
+                writeString(out, result.op);
+                out << ", \"workload\": ";
+                writeString(out, result.workload);
+                out << ", \"n\": " << result.n << ", \"ops\": " << result.ops
+                    << ", \"seconds\": " << result.seconds
+                    << ", \"ops_per_sec\": " << (result.seconds > 0 ? result.ops / result.seconds : 0.0)
+                    << ", \"p50_ns\": " << result.p50 << ", \"p99_ns\": " << result.p99;
+                if (result.loadFactor >= 0) out << ", \"load_factor\": " << result.loadFactor;
+                if (result.bytes) out << ", \"bytes_per_sec\": " << (result.seconds > 0 ? result.bytes / result.seconds : 0.0);
+                if (result.threads) out << ", \"threads\": " << result.threads;
+                out << "}";
+            }
+            out << "\n  ]\n}\n";
+        }
+    };
+
+public:
+    // drive --bench-suite [sizes] [structure]: sizes is a comma list such as
+    // 1000,100000,10000000; results go to stdout as JSON, progress to stderr
+    static void suite(const vector<size_t>& sizes, const string& filter, ostream& json) {
+        Suite runner(filter);
+        for (size_t n : sizes) runner.run(n);
+        runner.writeJson(json);
     }
 };
 
-int main() {
+int main(int argc, char* argv[]) {
+    if (argc > 1 && string(argv[1]) == "--bench") {
+        size_t n = argc > 2 ? (size_t)stoull(argv[2]) : 1000000;
+        Drive_Benchmark::nameIndex(n);
+        Pool_Registry::get().display();
+        return 0;
+    }
+
+    if (argc > 1 && string(argv[1]) == "--bench-suite") {
+        vector<size_t> sizes;
+        string list = argc > 2 ? argv[2] : "1000,10000,100000,1000000";
+        for (size_t at = 0; at < list.size();) {
+            size_t comma = list.find(',', at);
+            if (comma == string::npos) comma = list.size();
+            sizes.push_back((size_t)stoull(list.substr(at, comma - at)));
+            at = comma + 1;
+        }
+        Drive_Benchmark::suite(sizes, argc > 3 ? argv[3] : "", cout);
+        return 0;
+    }
+
+    // drive --batch <script|-> [script...]: run commands without the menus.
+    // Several scripts run as concurrent sessions, and their result lines
+    // start with the script's position on the command line.
+    if (argc > 1 && string(argv[1]) == "--batch") {
+        string script = argc > 2 ? argv[2] : "-";
+        Google_Drive_System driveSystem;
+        atomic<size_t> failures{ 0 };
+        if (script == "-") {
+            failures = driveSystem.runScript(cin, cout);
+        }
+        else {
+            vector<unique_ptr<ifstream>> scripts;
+            for (int i = 2; i < argc; i++) {
+                scripts.emplace_back(new ifstream(argv[i], ios::binary));
+                if (!*scripts.back()) {
+                    cerr << "Cannot open script '" << argv[i] << "'.\n";
+                    return 2;
+                }
+            }
+            if (scripts.size() == 1) {
+                failures = driveSystem.runScript(*scripts[0], cout);
+            }
+            else {
+                size_t cores = thread::hardware_concurrency() ? thread::hardware_concurrency() : 1;
+                Worker_Pool pool(scripts.size() < cores ? scripts.size() : cores);
+                for (size_t i = 0; i < scripts.size(); i++) {
+                    pool.submit([&, i] { failures += driveSystem.runScript(*scripts[i], cout, to_string(i + 1) + "\t"); });
+                }
+                pool.wait();
+            }
+        }
+        cout.flush();
+        if (!driveSystem.checkpoint()) cerr << "Warning: could not save the drive snapshot.\n";
+        return failures ? 1 : 0;
+    }
+
     Google_Drive_System driveSystem;
     driveSystem.run();
     system("pause");